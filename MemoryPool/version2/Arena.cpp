@@ -0,0 +1,105 @@
+#include "Arena.h"
+#include "PageCache.h"
+
+Arena::~Arena() {
+	release();
+}
+
+Arena::Arena(Arena&& other) noexcept {
+	*this = std::move(other);
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+	if (this != &other) {
+		release();
+		m_firstChunk = other.m_firstChunk;
+		m_currentChunk = other.m_currentChunk;
+		m_cursor = other.m_cursor;
+		m_end = other.m_end;
+		m_destructors = other.m_destructors;
+		m_capacity = other.m_capacity;
+
+		other.m_firstChunk = nullptr;
+		other.m_currentChunk = nullptr;
+		other.m_cursor = nullptr;
+		other.m_end = nullptr;
+		other.m_destructors = nullptr;
+		other.m_capacity = 0;
+	}
+	return *this;
+}
+
+void* Arena::allocateSlow(size_t size, size_t alignment) {
+	//reset()之后后面的span还在，优先复用
+	if (m_currentChunk && m_currentChunk->next) {
+		Chunk* next = m_currentChunk->next;
+		char* p = alignUp(chunkBegin(next), alignment);
+		if (p <= chunkEnd(next) && size <= static_cast<size_t>(chunkEnd(next) - p)) {
+			m_currentChunk = next;
+			m_cursor = p + size;
+			m_end = chunkEnd(next);
+			return p;
+		}
+	}
+
+	//申请新span，超大的分配单独占一个span
+	size_t needBytes = sizeof(Chunk) + size + alignment;
+	size_t pageNum = std::max(ARENA_CHUNK_PAGES, (needBytes + PAGE_SIZE - 1) / PAGE_SIZE);
+	Chunk* chunk = static_cast<Chunk*>(PageCache::getInstance().allocateSpan(pageNum));
+	if (!chunk) {
+		return nullptr;
+	}
+	chunk->pageNum = pageNum;
+	m_capacity += pageNum * PAGE_SIZE;
+
+	//新span插到当前span之后，不打断reset()后待复用的span链
+	if (m_currentChunk) {
+		chunk->next = m_currentChunk->next;
+		m_currentChunk->next = chunk;
+	}
+	else {
+		chunk->next = nullptr;
+		m_firstChunk = chunk;
+	}
+	m_currentChunk = chunk;
+
+	char* p = alignUp(chunkBegin(chunk), alignment);
+	m_cursor = p + size;
+	m_end = chunkEnd(chunk);
+	return p;
+}
+
+void Arena::runDestructors() {
+	//后构造的先析构
+	while (m_destructors) {
+		Destructor* node = m_destructors;
+		m_destructors = node->next;
+		node->destroy(node->object);
+	}
+}
+
+void Arena::reset() {
+	runDestructors();
+	if (!m_firstChunk) {
+		return;
+	}
+	m_currentChunk = m_firstChunk;
+	m_cursor = chunkBegin(m_firstChunk);
+	m_end = chunkEnd(m_firstChunk);
+}
+
+void Arena::release() {
+	runDestructors();
+
+	Chunk* chunk = m_firstChunk;
+	while (chunk) {
+		Chunk* next = chunk->next;
+		PageCache::getInstance().deallocateSpan(chunk, chunk->pageNum);
+		chunk = next;
+	}
+	m_firstChunk = nullptr;
+	m_currentChunk = nullptr;
+	m_cursor = nullptr;
+	m_end = nullptr;
+	m_capacity = 0;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "Common.h"
+#include <new>
+#include <cstdint>
+#include <utility>
+#include <type_traits>
+
+// 区域分配器：从PageCache取整块span，分配只移动指针，不支持单独释放
+// 适合一次请求内大量短生命周期对象，最后reset()或release()整体回收
+// Arena对象本身不是线程安全的，每个线程/请求各用一个
+class Arena
+{
+public:
+	Arena() = default;
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	Arena(Arena&& other) noexcept;
+	Arena& operator=(Arena&& other) noexcept;
+
+	//分配size字节，按alignment对齐，失败返回nullptr
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	//在arena中构造对象，非平凡析构的类型会登记析构函数，在reset()/release()时逆序调用
+	template<typename T, typename... Args>
+	T* create(Args&&... args);
+
+	//调用已登记的析构函数，保留所有span从头复用
+	void reset();
+
+	//调用已登记的析构函数，并把所有span还给PageCache
+	void release();
+
+	//已从PageCache取得的总字节数
+	size_t capacity() const { return m_capacity; }
+
+private:
+	//每个span开头的块头，把span串成链表
+	struct Chunk
+	{
+		Chunk* next;
+		size_t pageNum;
+	};
+
+	//登记的析构函数，节点本身也分配在arena中
+	struct Destructor
+	{
+		void (*destroy)(void*);
+		void* object;
+		Destructor* next;
+	};
+
+	//当前span放不下时，切换到下一个已有span或申请新span
+	void* allocateSlow(size_t size, size_t alignment);
+
+	void runDestructors();
+
+	static char* alignUp(char* p, size_t alignment) {
+		uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+		return reinterpret_cast<char*>((addr + alignment - 1) & ~(uintptr_t(alignment) - 1));
+	}
+
+	static char* chunkBegin(Chunk* chunk) { return reinterpret_cast<char*>(chunk + 1); }
+	static char* chunkEnd(Chunk* chunk) { return reinterpret_cast<char*>(chunk) + chunk->pageNum * PAGE_SIZE; }
+
+private:
+	Chunk* m_firstChunk{ nullptr };   //第一个span
+	Chunk* m_currentChunk{ nullptr }; //当前正在分配的span
+	char* m_cursor{ nullptr };        //当前span中下一个可用地址
+	char* m_end{ nullptr };           //当前span的结束地址
+	Destructor* m_destructors{ nullptr };
+	size_t m_capacity{ 0 };
+};
+
+inline void* Arena::allocate(size_t size, size_t alignment) {
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+	if (m_cursor) {
+		char* p = alignUp(m_cursor, alignment);
+		if (p <= m_end && size <= static_cast<size_t>(m_end - p)) {
+			m_cursor = p + size;
+			return p;
+		}
+	}
+	return allocateSlow(size, alignment);
+}
+
+template<typename T, typename... Args>
+T* Arena::create(Args&&... args) {
+	void* mem = allocate(sizeof(T), alignof(T));
+	if (!mem) {
+		return nullptr;
+	}
+
+	if (!std::is_trivially_destructible<T>::value) {
+		//先登记析构节点，构造失败时不会留下登记
+		void* nodeMem = allocate(sizeof(Destructor), alignof(Destructor));
+		if (!nodeMem) {
+			return nullptr;
+		}
+		T* obj = new(mem) T(std::forward<Args>(args)...);
+		Destructor* node = static_cast<Destructor*>(nodeMem);
+		node->destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+		node->object = obj;
+		node->next = m_destructors;
+		m_destructors = node;
+		return obj;
+	}
+	return new(mem) T(std::forward<Args>(args)...);
+}
@@ -0,0 +1,529 @@
+// 分配器基准测试：用几种标准负载对比 version1、version2 和系统 malloc
+// 独立的可执行程序（和PerformanceTest.cpp一样不在工程里），例如：
+//   g++ -std=c++17 -O2 -pthread Benchmark.cpp ThreadCache.cpp CentralCache.cpp PageCache.cpp Arena.cpp Instrument.cpp TraceRecorder.cpp Tuning.cpp PageProvider.cpp LargeCache.cpp -o bench
+//   ./bench --threads=1,2,4,8 --workloads=larson,xmalloc --format=csv --out=result.csv
+// 参数：
+//   --threads=1,2,4     线程数列表
+//   --workloads=a,b     larson, threadtest, xmalloc, cache-scratch, churn, fragmentation
+//   --backends=a,b      system, version1, version2
+//   --scale=N           每个线程的操作数倍率，默认1（越大越久）
+//   --format=table|csv|json  --out=文件路径（默认标准输出）
+// 峰值RSS是运行期间相对开始时的增量；version1从不把内存还给系统，单独测某个后端时请用--backends
+
+#include "BenchmarkCommon.h"
+
+// ---------------------------------------------------------------------------
+// 统计
+// ---------------------------------------------------------------------------
+
+// 每个线程每SAMPLE_EVERY次操作计一次时，避免计时本身拖慢热路径
+constexpr uint64_t SAMPLE_EVERY = 16;
+
+struct ThreadStats
+{
+	uint64_t ops{ 0 };
+	std::vector<uint32_t> samples;
+};
+
+template<typename F>
+inline auto timedOp(ThreadStats& stats, F&& op) -> decltype(op()) {
+	if ((stats.ops++ % SAMPLE_EVERY) != 0) {
+		return op();
+	}
+	auto start = Clock::now();
+	struct Record
+	{
+		ThreadStats& stats;
+		Clock::time_point start;
+		~Record() {
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			stats.samples.push_back(static_cast<uint32_t>(std::min<long long>(ns, UINT32_MAX)));
+		}
+	} record{ stats, start };
+	return op();
+}
+
+struct Result
+{
+	std::string workload;
+	std::string backend;
+	int threads{ 0 };
+	double seconds{ 0 };
+	double opsPerSec{ 0 };
+	uint32_t p50{ 0 };
+	uint32_t p99{ 0 };
+	uint32_t p999{ 0 };
+	size_t peakRss{ 0 };
+	size_t peakLive{ 0 };      //峰值存活字节，只有fragmentation负载填写
+	double fragmentation{ 0 }; //峰值RSS / 峰值存活字节
+};
+
+struct Config
+{
+	std::vector<int> threads{ 1, 2, 4, 8 };
+	std::vector<std::string> workloads{ "larson", "threadtest", "xmalloc", "cache-scratch", "churn", "fragmentation" };
+	std::vector<std::string> backends{ "system", "version1", "version2" };
+	double scale{ 1.0 };
+	std::string format{ "table" };
+	std::string out;
+
+	uint64_t scaled(uint64_t base) const {
+		return std::max<uint64_t>(1, static_cast<uint64_t>(static_cast<double>(base) * scale));
+	}
+};
+
+// 运行threadNum个线程，汇总操作数和延迟样本
+void runThreads(int threadNum, const std::function<void(int, ThreadStats&)>& body, Result& result) {
+	std::vector<ThreadStats> stats(threadNum);
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+	for (int t = 0; t < threadNum; ++t) {
+		threads.emplace_back([&, t]() { body(t, stats[t]); });
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	uint64_t ops = 0;
+	std::vector<uint32_t> samples;
+	for (auto& s : stats) {
+		ops += s.ops;
+		samples.insert(samples.end(), s.samples.begin(), s.samples.end());
+	}
+	result.opsPerSec = result.seconds > 0 ? static_cast<double>(ops) / result.seconds : 0;
+
+	if (!samples.empty()) {
+		std::sort(samples.begin(), samples.end());
+		auto at = [&](double q) { return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))]; };
+		result.p50 = at(0.50);
+		result.p99 = at(0.99);
+		result.p999 = at(0.999);
+	}
+}
+
+class Barrier
+{
+public:
+	explicit Barrier(int count) : m_count(count) {}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		int generation = m_generation;
+		if (++m_waiting == m_count) {
+			m_waiting = 0;
+			++m_generation;
+			m_cv.notify_all();
+			return;
+		}
+		m_cv.wait(lock, [&]() { return generation != m_generation; });
+	}
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	int m_count;
+	int m_waiting{ 0 };
+	int m_generation{ 0 };
+};
+
+struct Slot
+{
+	void* ptr{ nullptr };
+	size_t size{ 0 };
+};
+
+// ---------------------------------------------------------------------------
+// 负载
+// ---------------------------------------------------------------------------
+
+// larson：每个线程随机替换自己槽位里的对象，每轮结束后槽位数组传给下一个线程，
+// 于是上一个线程分配的对象由下一个线程释放，模拟服务器里对象在线程间流转
+void runLarson(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	constexpr size_t SLOTS = 1000;
+	constexpr int ROUNDS = 10;
+	const uint64_t opsPerRound = config.scaled(200000) / ROUNDS;
+
+	std::vector<std::vector<Slot>> arrays(threadNum, std::vector<Slot>(SLOTS));
+	Barrier barrier(threadNum);
+
+	runThreads(threadNum, [&](int t, ThreadStats& stats) {
+		std::mt19937 rng(t + 1);
+		std::uniform_int_distribution<size_t> sizeDist(16, 512);
+		std::uniform_int_distribution<size_t> slotDist(0, SLOTS - 1);
+
+		for (int round = 0; round < ROUNDS; ++round) {
+			auto& slots = arrays[(t + round) % threadNum];
+			for (uint64_t i = 0; i < opsPerRound; ++i) {
+				Slot& slot = slots[slotDist(rng)];
+				if (slot.ptr) {
+					timedOp(stats, [&]() { backend.deallocate(slot.ptr, slot.size); });
+				}
+				slot.size = sizeDist(rng);
+				slot.ptr = timedOp(stats, [&]() { return backend.allocate(slot.size); });
+			}
+			barrier.wait();
+		}
+
+		auto& slots = arrays[(t + ROUNDS) % threadNum];
+		for (auto& slot : slots) {
+			if (slot.ptr) {
+				backend.deallocate(slot.ptr, slot.size);
+				slot.ptr = nullptr;
+			}
+		}
+	}, result);
+}
+
+// threadtest：每个线程反复分配一批同样大小的对象再全部释放
+void runThreadTest(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	constexpr size_t BATCH = 1000;
+	constexpr size_t SIZE = 64;
+	const uint64_t iterations = config.scaled(200);
+
+	runThreads(threadNum, [&](int, ThreadStats& stats) {
+		std::vector<void*> ptrs(BATCH);
+		for (uint64_t it = 0; it < iterations; ++it) {
+			for (size_t i = 0; i < BATCH; ++i) {
+				ptrs[i] = timedOp(stats, [&]() { return backend.allocate(SIZE); });
+			}
+			for (size_t i = 0; i < BATCH; ++i) {
+				timedOp(stats, [&]() { backend.deallocate(ptrs[i], SIZE); });
+			}
+		}
+	}, result);
+}
+
+// xmalloc：一半线程只分配，另一半线程只释放（生产者/消费者跨线程释放）
+void runXmalloc(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	constexpr size_t BATCH = 256;
+	constexpr size_t MAX_QUEUED_BATCHES = 64;
+	const int producers = std::max(1, threadNum / 2);
+	const int consumers = std::max(1, threadNum - producers);
+	const uint64_t batchesPerProducer = config.scaled(400);
+
+	std::mutex mutex;
+	std::condition_variable notEmpty;
+	std::condition_variable notFull;
+	std::deque<std::vector<Slot>> queue;
+	int producersLeft = producers;
+
+	runThreads(producers + consumers, [&](int t, ThreadStats& stats) {
+		if (t < producers) {
+			std::mt19937 rng(t + 1);
+			std::uniform_int_distribution<size_t> sizeDist(16, 256);
+			for (uint64_t b = 0; b < batchesPerProducer; ++b) {
+				std::vector<Slot> batch(BATCH);
+				for (auto& slot : batch) {
+					slot.size = sizeDist(rng);
+					slot.ptr = timedOp(stats, [&]() { return backend.allocate(slot.size); });
+				}
+				std::unique_lock<std::mutex> lock(mutex);
+				notFull.wait(lock, [&]() { return queue.size() < MAX_QUEUED_BATCHES; });
+				queue.push_back(std::move(batch));
+				notEmpty.notify_one();
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			--producersLeft;
+			notEmpty.notify_all();
+		}
+		else {
+			while (true) {
+				std::vector<Slot> batch;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					notEmpty.wait(lock, [&]() { return !queue.empty() || producersLeft == 0; });
+					if (queue.empty()) {
+						break;
+					}
+					batch = std::move(queue.front());
+					queue.pop_front();
+					notFull.notify_one();
+				}
+				for (auto& slot : batch) {
+					timedOp(stats, [&]() { backend.deallocate(slot.ptr, slot.size); });
+				}
+			}
+		}
+	}, result);
+	result.threads = producers + consumers;
+}
+
+// cache-scratch：主线程给每个线程分配一个小对象，线程释放后反复分配同样大小的对象并写入，
+// 如果分配器把相邻的块交给不同线程，就会出现伪共享
+void runCacheScratch(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	constexpr size_t SIZE = 8;
+	constexpr int WRITES = 100;
+	const uint64_t iterations = config.scaled(100000);
+
+	std::vector<void*> initial(threadNum);
+	for (int t = 0; t < threadNum; ++t) {
+		initial[t] = backend.allocate(SIZE);
+	}
+
+	runThreads(threadNum, [&](int t, ThreadStats& stats) {
+		backend.deallocate(initial[t], SIZE);
+		for (uint64_t i = 0; i < iterations; ++i) {
+			volatile char* p = static_cast<volatile char*>(timedOp(stats, [&]() { return backend.allocate(SIZE); }));
+			for (int w = 0; w < WRITES; ++w) {
+				p[w % SIZE] = static_cast<char>(p[w % SIZE] + 1);
+			}
+			timedOp(stats, [&]() { backend.deallocate(const_cast<char*>(p), SIZE); });
+		}
+	}, result);
+}
+
+// churn：随机大小（8B~8KB对数分布）随机分配释放，存活对象数保持在一定范围
+void runChurn(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	constexpr size_t SLOTS = 4096;
+	const uint64_t ops = config.scaled(400000);
+
+	runThreads(threadNum, [&](int t, ThreadStats& stats) {
+		std::mt19937 rng(t + 1);
+		std::uniform_real_distribution<double> logSize(3.0, 13.0);
+		std::uniform_int_distribution<size_t> slotDist(0, SLOTS - 1);
+		std::vector<Slot> slots(SLOTS);
+
+		for (uint64_t i = 0; i < ops; ++i) {
+			Slot& slot = slots[slotDist(rng)];
+			if (slot.ptr) {
+				timedOp(stats, [&]() { backend.deallocate(slot.ptr, slot.size); });
+				slot.ptr = nullptr;
+			}
+			else {
+				slot.size = static_cast<size_t>(std::exp2(logSize(rng)));
+				slot.ptr = timedOp(stats, [&]() { return backend.allocate(slot.size); });
+			}
+		}
+		for (auto& slot : slots) {
+			if (slot.ptr) {
+				backend.deallocate(slot.ptr, slot.size);
+			}
+		}
+	}, result);
+}
+
+// fragmentation：多轮“填满-随机释放大部分-换一种大小再填满”，
+// 小对象留下的空洞不能被大对象复用时RSS会持续上涨
+void runFragmentation(const Backend& backend, int threadNum, const Config& config, Result& result) {
+	const size_t targetBytes = static_cast<size_t>(config.scaled(32) * 1024 * 1024) / threadNum;
+	constexpr int PHASES = 8;
+	std::atomic<size_t> liveBytes{ 0 };
+	std::atomic<size_t> peakLiveBytes{ 0 };
+
+	auto addLive = [&](long long delta) {
+		size_t now = liveBytes.fetch_add(static_cast<size_t>(delta)) + static_cast<size_t>(delta);
+		size_t peak = peakLiveBytes.load(std::memory_order_relaxed);
+		while (now > peak && !peakLiveBytes.compare_exchange_weak(peak, now)) {
+		}
+	};
+
+	runThreads(threadNum, [&](int t, ThreadStats& stats) {
+		std::mt19937 rng(t + 1);
+		std::vector<Slot> live;
+		size_t bytes = 0;
+
+		for (int phase = 0; phase < PHASES; ++phase) {
+			//每轮换一个大小区间：8~128、128~1K、1K~4K 交替
+			size_t low = phase % 3 == 0 ? 8 : (phase % 3 == 1 ? 128 : 1024);
+			size_t high = phase % 3 == 0 ? 128 : (phase % 3 == 1 ? 1024 : 4096);
+			std::uniform_int_distribution<size_t> sizeDist(low, high);
+
+			while (bytes < targetBytes) {
+				Slot slot;
+				slot.size = sizeDist(rng);
+				slot.ptr = timedOp(stats, [&]() { return backend.allocate(slot.size); });
+				memset(slot.ptr, 1, slot.size);
+				live.push_back(slot);
+				bytes += slot.size;
+				addLive(static_cast<long long>(slot.size));
+			}
+
+			//随机留下1/4
+			std::shuffle(live.begin(), live.end(), rng);
+			size_t keep = live.size() / 4;
+			for (size_t i = keep; i < live.size(); ++i) {
+				timedOp(stats, [&]() { backend.deallocate(live[i].ptr, live[i].size); });
+				bytes -= live[i].size;
+				addLive(-static_cast<long long>(live[i].size));
+			}
+			live.resize(keep);
+		}
+
+		for (auto& slot : live) {
+			backend.deallocate(slot.ptr, slot.size);
+			addLive(-static_cast<long long>(slot.size));
+		}
+	}, result);
+
+	result.peakLive = peakLiveBytes.load();
+}
+
+using WorkloadFn = void (*)(const Backend&, int, const Config&, Result&);
+
+std::vector<std::pair<std::string, WorkloadFn>> allWorkloads() {
+	return {
+		{ "larson", runLarson },
+		{ "threadtest", runThreadTest },
+		{ "xmalloc", runXmalloc },
+		{ "cache-scratch", runCacheScratch },
+		{ "churn", runChurn },
+		{ "fragmentation", runFragmentation },
+	};
+}
+
+// ---------------------------------------------------------------------------
+// 输出
+// ---------------------------------------------------------------------------
+
+void printTable(std::ostream& os, const std::vector<Result>& results) {
+	os << std::left << std::setw(15) << "workload" << std::setw(10) << "backend" << std::right
+		<< std::setw(8) << "threads" << std::setw(14) << "ops/s"
+		<< std::setw(10) << "p50(ns)" << std::setw(10) << "p99(ns)" << std::setw(11) << "p99.9(ns)"
+		<< std::setw(14) << "peakRSS(KB)" << std::setw(8) << "frag" << "\n";
+	for (const auto& r : results) {
+		os << std::left << std::setw(15) << r.workload << std::setw(10) << r.backend << std::right
+			<< std::setw(8) << r.threads << std::setw(14) << std::fixed << std::setprecision(0) << r.opsPerSec
+			<< std::setw(10) << r.p50 << std::setw(10) << r.p99 << std::setw(11) << r.p999
+			<< std::setw(14) << r.peakRss / 1024 << std::setw(8) << std::setprecision(2) << r.fragmentation << "\n";
+	}
+}
+
+void printCsv(std::ostream& os, const std::vector<Result>& results) {
+	os << "workload,backend,threads,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,peak_rss_bytes,fragmentation\n";
+	for (const auto& r : results) {
+		os << r.workload << ',' << r.backend << ',' << r.threads << ',' << r.seconds << ',' << r.opsPerSec << ','
+			<< r.p50 << ',' << r.p99 << ',' << r.p999 << ',' << r.peakRss << ',' << r.fragmentation << "\n";
+	}
+}
+
+void printJson(std::ostream& os, const std::vector<Result>& results) {
+	os << "[\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		const auto& r = results[i];
+		os << "  {\"workload\": \"" << r.workload << "\", \"backend\": \"" << r.backend << "\", \"threads\": " << r.threads
+			<< ", \"seconds\": " << r.seconds << ", \"ops_per_sec\": " << r.opsPerSec
+			<< ", \"p50_ns\": " << r.p50 << ", \"p99_ns\": " << r.p99 << ", \"p999_ns\": " << r.p999
+			<< ", \"peak_rss_bytes\": " << r.peakRss << ", \"fragmentation\": " << r.fragmentation << "}"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	os << "]\n";
+}
+
+// ---------------------------------------------------------------------------
+// 参数
+// ---------------------------------------------------------------------------
+
+std::vector<std::string> split(const std::string& s) {
+	std::vector<std::string> parts;
+	std::stringstream ss(s);
+	std::string part;
+	while (std::getline(ss, part, ',')) {
+		if (!part.empty()) {
+			parts.push_back(part);
+		}
+	}
+	return parts;
+}
+
+bool parseArgs(int argc, char** argv, Config& config) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		auto value = [&](const char* prefix) -> const char* {
+			size_t len = strlen(prefix);
+			return arg.compare(0, len, prefix) == 0 ? arg.c_str() + len : nullptr;
+		};
+
+		if (const char* v = value("--threads=")) {
+			config.threads.clear();
+			for (const auto& t : split(v)) {
+				config.threads.push_back(std::max(1, atoi(t.c_str())));
+			}
+		}
+		else if (const char* v = value("--workloads=")) {
+			config.workloads = split(v);
+		}
+		else if (const char* v = value("--backends=")) {
+			config.backends = split(v);
+		}
+		else if (const char* v = value("--scale=")) {
+			config.scale = atof(v);
+		}
+		else if (const char* v = value("--format=")) {
+			config.format = v;
+		}
+		else if (const char* v = value("--out=")) {
+			config.out = v;
+		}
+		else {
+			std::cerr << "unknown argument: " << arg << "\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Config config;
+	if (!parseArgs(argc, argv, config)) {
+		return 1;
+	}
+
+	v1::initializeMemoryPools();
+
+	std::vector<Result> results;
+	for (const auto& workload : allWorkloads()) {
+		if (std::find(config.workloads.begin(), config.workloads.end(), workload.first) == config.workloads.end()) {
+			continue;
+		}
+		for (int threads : config.threads) {
+			for (const auto& backend : allBackends()) {
+				if (std::find(config.backends.begin(), config.backends.end(), backend.name) == config.backends.end()) {
+					continue;
+				}
+
+				Result result;
+				result.workload = workload.first;
+				result.backend = backend.name;
+				result.threads = threads;
+
+				RssMonitor monitor;
+				workload.second(backend, threads, config, result);
+				monitor.stop();
+				result.peakRss = monitor.peakDelta();
+				if (result.peakLive > 0) {
+					result.fragmentation = static_cast<double>(result.peakRss) / static_cast<double>(result.peakLive);
+				}
+
+				if (backend.name == "version2") {
+					MemoryPool::releaseFreeMemory();
+				}
+
+				std::cerr << "done: " << result.workload << " / " << result.backend << " / " << result.threads << " threads\n";
+				results.push_back(result);
+			}
+		}
+	}
+
+	std::ofstream file;
+	if (!config.out.empty()) {
+		file.open(config.out);
+		if (!file) {
+			std::cerr << "cannot open " << config.out << "\n";
+			return 1;
+		}
+	}
+	std::ostream& os = config.out.empty() ? std::cout : file;
+
+	if (config.format == "csv") {
+		printCsv(os, results);
+	}
+	else if (config.format == "json") {
+		printJson(os, results);
+	}
+	else {
+		printTable(os, results);
+	}
+	return 0;
+}
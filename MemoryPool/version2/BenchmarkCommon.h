@@ -0,0 +1,186 @@
+#pragma once
+// Benchmark.cpp 和 TraceReplay.cpp 共用的部分：被测后端、RSS采样
+// 只能被一个可执行程序的一个源文件包含（version1的实现直接包含进来）
+
+#include <atomic>
+#include <mutex>
+#include <iostream>
+#include <cassert>
+#include <cstdio>
+
+// version1 和 version2 都有名为 MemoryPool 的类，把 version1 包进命名空间
+namespace v1 {
+#include "../version1/MemoryPool.cpp"
+#include "../version1/MemoryPoolInterface.h"
+}
+
+#include "MemoryPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+// ---------------------------------------------------------------------------
+// 后端
+// ---------------------------------------------------------------------------
+
+struct Backend
+{
+	std::string name;
+	void* (*allocate)(size_t size);
+	void (*deallocate)(void* ptr, size_t size);
+};
+
+namespace version1Backend {
+	// version1 只能按类型分配，为每个8字节档位生成一个类型
+	template<size_t N>
+	struct Buffer
+	{
+		char data[N];
+	};
+
+	constexpr size_t SLOT_NUM = MAX_SLOT_SIZE / SLOT_BASE_SIZE;
+
+	template<size_t I>
+	void* allocateSlot() { return v1::newElement<Buffer<(I + 1) * SLOT_BASE_SIZE>>(); }
+
+	template<size_t I>
+	void deallocateSlot(void* ptr) { v1::deleteElement(static_cast<Buffer<(I + 1) * SLOT_BASE_SIZE>*>(ptr)); }
+
+	template<size_t... I>
+	std::vector<void* (*)()> makeAllocators(std::index_sequence<I...>) { return { &allocateSlot<I>... }; }
+
+	template<size_t... I>
+	std::vector<void (*)(void*)> makeDeallocators(std::index_sequence<I...>) { return { &deallocateSlot<I>... }; }
+
+	const std::vector<void* (*)()>& allocators() {
+		static const auto table = makeAllocators(std::make_index_sequence<SLOT_NUM>());
+		return table;
+	}
+
+	const std::vector<void (*)(void*)>& deallocators() {
+		static const auto table = makeDeallocators(std::make_index_sequence<SLOT_NUM>());
+		return table;
+	}
+
+	void* allocate(size_t size) {
+		if (size == 0 || size > MAX_SLOT_SIZE) {
+			return operator new(size == 0 ? 1 : size);
+		}
+		return allocators()[(size + SLOT_BASE_SIZE - 1) / SLOT_BASE_SIZE - 1]();
+	}
+
+	void deallocate(void* ptr, size_t size) {
+		if (size == 0 || size > MAX_SLOT_SIZE) {
+			operator delete(ptr);
+			return;
+		}
+		deallocators()[(size + SLOT_BASE_SIZE - 1) / SLOT_BASE_SIZE - 1](ptr);
+	}
+}
+
+void* systemAllocate(size_t size) { return malloc(size); }
+void systemDeallocate(void* ptr, size_t) { free(ptr); }
+
+void* version2Allocate(size_t size) { return MemoryPool::allocate(size); }
+void version2Deallocate(void* ptr, size_t size) { MemoryPool::deallocate(ptr, size); }
+
+std::vector<Backend> allBackends() {
+	return {
+		{ "system", systemAllocate, systemDeallocate },
+		{ "version1", version1Backend::allocate, version1Backend::deallocate },
+		{ "version2", version2Allocate, version2Deallocate },
+	};
+}
+
+// ---------------------------------------------------------------------------
+// RSS
+// ---------------------------------------------------------------------------
+
+size_t currentRss() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return 0;
+#else
+	std::ifstream statm("/proc/self/statm");
+	size_t totalPages = 0, residentPages = 0;
+	if (statm >> totalPages >> residentPages) {
+		return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+	return 0;
+#endif
+}
+
+// 后台线程定期采样RSS，记录运行期间的峰值
+class RssMonitor
+{
+public:
+	RssMonitor() : m_baseline(currentRss()), m_peak(m_baseline) {
+		m_thread = std::thread([this]() {
+			while (!m_stop.load(std::memory_order_relaxed)) {
+				sample();
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			}
+		});
+	}
+
+	~RssMonitor() { stop(); }
+
+	void stop() {
+		if (m_thread.joinable()) {
+			m_stop.store(true, std::memory_order_relaxed);
+			m_thread.join();
+			sample();
+		}
+	}
+
+	size_t peakDelta() const {
+		size_t peak = m_peak.load(std::memory_order_relaxed);
+		return peak > m_baseline ? peak - m_baseline : 0;
+	}
+
+private:
+	void sample() {
+		size_t rss = currentRss();
+		size_t peak = m_peak.load(std::memory_order_relaxed);
+		while (rss > peak && !m_peak.compare_exchange_weak(peak, rss)) {
+		}
+	}
+
+	size_t m_baseline;
+	std::atomic<size_t> m_peak;
+	std::atomic<bool> m_stop{ false };
+	std::thread m_thread;
+};
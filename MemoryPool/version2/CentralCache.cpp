@@ -1,10 +1,25 @@
 #include "CentralCache.h"
-#include <thread>
 #include "PageCache.h"
+#include "Instrument.h"
 #include <iostream>
-#include <set>
-
-const std::chrono::milliseconds CentralCache::MAX_DELAY_INTERVAL{ 1000 };
+#include <algorithm>
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	//͵1λλãvalueΪ0
+	size_t countTrailingZeros(uint64_t value) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, value);
+		return index;
+#else
+		return __builtin_ctzll(value);
+#endif
+	}
+}
 
 CentralCache& CentralCache::getInstance() {
 	static CentralCache instance;
@@ -12,312 +27,377 @@ CentralCache& CentralCache::getInstance() {
 }
 
 CentralCache::CentralCache() {
-	//ʼĻ
-	for(auto & freeList : m_centralFreeList) {
-		freeList.store(nullptr);
-	}
+}
 
-	for(auto & lock : m_centralFreeListLock) {
-		//ͷšԭӱ־λΪ false
-		lock.clear();
+void CentralCache::lockFreeList(size_t index) {
+	CentralFreeList& list = m_freeLists[index];
+	if (!list.lock.try_lock()) {
+		auto start = std::chrono::steady_clock::now();
+		list.lock.lock();
+		auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+		//ѾֱӶд
+		list.contendedCount.store(list.contendedCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		list.waitNs.store(list.waitNs.load(std::memory_order_relaxed) + static_cast<uint64_t>(waited), std::memory_order_relaxed);
 	}
-	m_spanNum.store(0);
+	list.lockCount.store(list.lockCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 }
 
-void* CentralCache::fetchRange(size_t index,size_t batchNum) {
+size_t CentralCache::fetchRange(size_t index, size_t batchNum, void*& start, void*& end, RemoteFreeQueue* owner,
+	AllocHint hint) {
 	assert(index>=0);
 
-	//ڴӦֱϵͳ
+	//ڴӦֱϵͳ
 	assert(index < FREE_LIST_NUM);
-	/*if(index>= FREE_LIST_NUM) {
-		return nullptr;
-	}*/
 
-	//ȴȡ
-	while (m_centralFreeListLock[index].test_and_set()) {
-		std::this_thread::yield(); //óCPUʱƬ
-	} 
+	start = end = nullptr;
+
+	//òʱ˱˯
+	lockFreeList(index);
 	void* returnHead = nullptr;
 	void* returnTail = nullptr;
 	size_t returnBlockNum = 0;
 
-	//ԴĻлȡڴ
 	try {
-		void* head = m_centralFreeList[index].load();
-
-		if(head){
-			// ͷȡ MAX_BATCH_BLOCK_NUM ڵ
-			void* current = head;
-			void* prev = nullptr;
-			size_t blockCount = 0;
-
-			while(current && blockCount < batchNum) {
-				prev = current;
-				//ȡһڵ
-				current = *(reinterpret_cast<void**>(current)); 
-				++blockCount;
-
-				// spanĿм
-				//һָThreadCacheڴ鲻һͬһSpan
-				SpanTracker* spanTracker = getSpanTracker(prev);
-				if (spanTracker) {
-					//ڸspanмһڴ
-					spanTracker->freeCount.fetch_sub(1);
-				}
-			}
-
-			if(prev){
-				//Ͽ
-				*(reinterpret_cast<void**>(prev)) = nullptr;
+		//Cold/LongLivedĿֻԼspanȡ
+		bool cold = hint != AllocHint::Hot;
+		SpanTracker*& partialSpans = partialList(m_freeLists[index], cold);
+
+		//ֿspanûпʱPageCacheµspan
+		//ڼ䲻дСPageCacheҪڴûص
+		if (!partialSpans) {
+			unlockFreeList(index);
+			SpanTracker* span = allocateSpan(index, cold);
+			if (!span) {
+				//PageCacheȡspanʧ
+				return 0;
 			}
-			m_centralFreeList[index].store(current);
-			//÷صͷβ
-			returnHead = head;
-			returnTail = prev;
-			returnBlockNum = blockCount;
+			lockFreeList(index);
+			pushSpan(partialSpans, span);
 		}
 
-		//Ļû㹻ڴ飬PageCacheȡµspan
-		if (!returnHead) {
-			size_t size = (index + 1) * ALIGNMENT;
-			returnHead = fetchFromPageCache(size);
+		//δӲֿspanȡ飬ֱչbatchNumֻʵʽȥĿ
+		while (returnBlockNum < batchNum && partialSpans) {
+			SpanTracker* span = partialSpans;
+			span->owner.store(owner, std::memory_order_relaxed);
 
-			if(!returnHead) {
-				//PageCacheȡspanʧܣͷnullptr
-				m_centralFreeListLock[index].clear();
-				return nullptr;
-			}
-
-			// ʵʷҳ
-			size_t numPages = (size <= SPAN_PAGES * PAGE_SIZE) ?
-				SPAN_PAGES : (size + PAGE_SIZE - 1) / PAGE_SIZE;
-			
-			// ʹʵҳ
-			size_t totalBlockNum = (numPages * PAGE_SIZE) / size;
-
-			//ʵʷڴһbatchNum
-			size_t allocBlockNum = std::min(batchNum, totalBlockNum);
+			returnBlockNum += takeBlocks(span, batchNum - returnBlockNum, returnHead, returnTail);
 
-			//PageCacheȡڴзֳС
-			char* start = static_cast<char*>(returnHead);
-
-			// ظThreadCacheڴ
-			for (size_t i = 0; i < allocBlockNum; ++i) {
-				void* cur = start + i * size;
-				void* next = (i + 1 < allocBlockNum) ? (start + (i + 1) * size) : nullptr;
-				*(reinterpret_cast<void**>(cur)) = next;
-			}
-			returnHead = start;
-
-			// CentralCache
-			// 뻺
-			if (totalBlockNum > allocBlockNum) {
-				void* centralHead = start + allocBlockNum * size;
-				for (size_t i = allocBlockNum; i < totalBlockNum; ++i) {
-					void* cur = start + i * size;
-					void* next = (i + 1 < totalBlockNum) ? (start + (i + 1) * size) : nullptr;
-					*(reinterpret_cast<void**>(cur)) = next;
-				}
-				m_centralFreeList[index].store(centralHead);
+			//spanеĿȫȥƵ
+			if (!span->hasFreeBlock()) {
+				removeSpan(partialSpans, span);
+				pushSpan(fullList(m_freeLists[index], cold), span);
 			}
+		}
 
-			// ʹʽ¼spanϢ
-			size_t trackerIndex = m_spanNum++;
-			if (trackerIndex <m_spanTrackerArray.size())
-			{
-				m_spanTrackerArray[trackerIndex].spanAddr.store(start);
-				m_spanTrackerArray[trackerIndex].numPages.store(numPages);
-				m_spanTrackerArray[trackerIndex].blockCount.store(totalBlockNum); // totalBlockNumڴ
-				m_spanTrackerArray[trackerIndex].freeCount.store(totalBlockNum-allocBlockNum); //ѾȥallocBlockNumڴ
-			}
-		
+		if (returnTail) {
+			//Ͽ
+			*(reinterpret_cast<void**>(returnTail)) = nullptr;
 		}
 	}catch (...) {
 		//ͷ
-		m_centralFreeListLock[index].clear();
+		unlockFreeList(index);
 		throw; //׳쳣
 	}
 
 	//ͷ
-	m_centralFreeListLock[index].clear();
-	return returnHead;
+	unlockFreeList(index);
+	start = returnHead;
+	end = returnTail;
+	return returnBlockNum;
 }
 
+size_t CentralCache::reserve(size_t index, size_t blockNum) {
+	assert(index < FREE_LIST_NUM);
 
-SpanTracker* CentralCache::getSpanTracker(void* blockAddr) {
-	//spanTrackers_飬ҵڴspan
-	for(size_t i=0;i<m_spanNum.load(); ++i) {
-		void* spanAddr = m_spanTrackerArray[i].spanAddr.load();
-		size_t numPages = m_spanTrackerArray[i].numPages.load();
-		if(blockAddr >= spanAddr && blockAddr < static_cast<char*>(spanAddr) + numPages * PAGE_SIZE) {
-			return &m_spanTrackerArray[i];
+	//еĲֿspanеĿпҲ
+	lockFreeList(index);
+	size_t freeBlockNum = 0;
+	for (SpanTracker* span = m_freeLists[index].partialSpans; span; span = span->next) {
+		freeBlockNum += span->blockCount - span->useCount;
+	}
+	unlockFreeList(index);
+	if (freeBlockNum >= blockNum) {
+		return freeBlockNum;
+	}
+
+	size_t size = (index + 1) * ALIGNMENT;
+	size_t numPages = SizeClass::getSpanPages(size);
+	size_t blocksPerSpan = numPages * PAGE_SIZE / size;
+	size_t spanNum = (blockNum - freeBlockNum + blocksPerSpan - 1) / blocksPerSpan;
+
+	//һϵͳȡspanҳԤȱҳspanг
+	//ʧܣ糬ڴޣʱԤȱҳճ
+	PageCache::getInstance().reserveSpans(numPages, spanNum);
+
+	for (size_t i = 0; i < spanNum; ++i) {
+		SpanTracker* span = allocateSpan(index);
+		if (!span) {
+			break;
 		}
+		//Ž߳̿ȡ黹spanȼ¿
+		freeBlockNum += span->blockCount;
+		lockFreeList(index);
+		pushSpan(m_freeLists[index].partialSpans, span);
+		unlockFreeList(index);
 	}
-	//δҵӦSpanTracker
-	return nullptr;
+	return freeBlockNum;
 }
 
-void* CentralCache::fetchFromPageCache(size_t size) {
-	//ʵҪҳ
-	size_t totalPages = (size + PAGE_SIZE - 1) / PAGE_SIZE; //ȡ
+SpanTracker* CentralCache::allocateSpan(size_t index, bool cold) {
+	MP_LATENCY_SCOPE(LatencyTier::FetchFromPageCache);
 
-	if(totalPages < SPAN_PAGES) {
-		// Сڵ32KBʹù̶8ҳ
-		totalPages = SPAN_PAGES;
+	size_t size = (index + 1) * ALIGNMENT;
+	void* start = fetchFromPageCache(size, cold);
+	if (!start) {
+		return nullptr;
+	}
+
+	// ÿСspanҳǹ̶ģfetchFromPageCacheһ
+	size_t numPages = SizeClass::getSpanPages(size);
+
+	MP_TRACE(fetch_from_page_cache, index, numPages);
+
+	// ʹʵҳ
+	size_t totalBlockNum = (numPages * PAGE_SIZE) / size;
+
+	//Ԥз֣spanĿfetchRangeагûȥĿ鲻ᱻд
+	SpanTracker* span = new SpanTracker;
+	span->spanAddr = start;
+	span->numPages = numPages;
+	span->index = index;
+	span->blockCount = totalBlockNum;
+	span->useCount = 0;
+	span->freeList = nullptr;
+	span->cold = cold;
+	if (size <= SPAN_BITMAP_MAX_BYTES) {
+		//пΪУһֶλΪ0
+		span->bitmapWords = (totalBlockNum + 63) / 64;
+		span->freeBitmap = new uint64_t[span->bitmapWords];
+		std::fill(span->freeBitmap, span->freeBitmap + span->bitmapWords, ~uint64_t(0));
+		if (totalBlockNum % 64) {
+			span->freeBitmap[span->bitmapWords - 1] = (uint64_t(1) << (totalBlockNum % 64)) - 1;
+		}
+	}
+	else {
+		span->bumpCursor = static_cast<char*>(start);
+		span->bumpEnd = static_cast<char*>(start) + totalBlockNum * size;
 	}
 
-	return PageCache::getInstance().allocateSpan(totalPages);
+	//¼spanǵÿһҳ黹ʱݴҵspan
+	m_spanMap.set(PageMap<SpanTracker>::pageIdOf(start), numPages, span);
+	return span;
 }
 
 
-void CentralCache::returnRange(void* start, size_t size, size_t index) {
-	if (!start || size<0 || index>FREE_LIST_NUM)
+SpanTracker* CentralCache::getSpanTracker(void* blockAddr) {
+	return m_spanMap.get(blockAddr);
+}
+
+void* CentralCache::fetchFromPageCache(size_t size, bool cold) {
+	//Сȡspanҳβ˷Ѳ1/SPAN_WASTE_RATIO
+	return PageCache::getInstance().allocateSpan(SizeClass::getSpanPages(size), cold ? AllocHint::Cold : AllocHint::Hot);
+}
+
+
+void CentralCache::returnRange(void* start, size_t blockNum, size_t index) {
+	if (!start || index>=FREE_LIST_NUM)
 		return;
-	//صĵڴĴС
-	size_t alignedBlockSize = (index + 1) * ALIGNMENT;
 
-	//˶ٸڴ
-	size_t blockNum = size / alignedBlockSize;
+	//ȫеspanٻPageCache
+	SpanTracker* emptySpans = nullptr;
 
-	//
-	while (m_centralFreeListLock[index].test_and_set()) {
-		std::this_thread::yield();
-	}
+	//
+	lockFreeList(index);
 
 	try {
-		//黹ӵĻ
-		void* end = start;
-		size_t count = 1;
-		SpanTracker* spanTracker = nullptr;
-		while (*(reinterpret_cast<void**>(end)) != nullptr && count < blockNum) {
-			//¹黹ڴӦspanĿп
-			spanTracker = getSpanTracker(end);
-
-			if (spanTracker) {
-				++(spanTracker->freeCount);
-			}
-			else {
-				std::cout << "spanTrackerָΪ!" <<std::endl;
+		//ŻspanĿ
+		void* current = start;
+		size_t count = 0;
+		while (current && count < blockNum) {
+			void* next = *(reinterpret_cast<void**>(current));
+
+			SpanTracker* span = getSpanTracker(current);
+			if (!span) {
+				std::cout << "spanTrackerָΪ!" << std::endl;
+				current = next;
+				++count;
+				continue;
 			}
 
-			end = *(reinterpret_cast<void**>(end));
-			++count;
-		}
-
-		//һ黹ڴӦspanĿп
-		spanTracker = getSpanTracker(end);
-		if (spanTracker) {
-			++(spanTracker->freeCount);
-		}else {
-			std::cout << "spanTrackerָΪ!" << std::endl;
-		}
+			//spanԭ¹һزֿspanԼļϹң鱻ͷҲҴ
+			if (!span->hasFreeBlock()) {
+				removeSpan(fullList(m_freeLists[index], span->cold), span);
+				pushSpan(partialList(m_freeLists[index], span->cold), span);
+			}
 
-		//ͷ巨黹
-		*(reinterpret_cast<void**>(end)) = m_centralFreeList[index].load();
-		m_centralFreeList[index].store(start);
+			putBlock(span, current);
+			--span->useCount;
 
-		// 2. ӳټ(ļ1ɻ)
-		size_t currentCount = m_delayCountsArray[index].fetch_add(1) +1;
-		auto currentTime = std::chrono::steady_clock::now();
+			//spanеĿȫˣ黹PageCache
+			if (span->useCount == 0) {
+				removeSpan(partialList(m_freeLists[index], span->cold), span);
+				m_spanMap.set(PageMap<SpanTracker>::pageIdOf(span->spanAddr), span->numPages, nullptr);
+				span->next = emptySpans;
+				emptySpans = span;
+			}
 
-		// 3. ǷҪִӳٹ黹
-		if (shouldPerformDelayedReturn(index, currentCount, currentTime))
-		{
-			performDelayedReturn(index);
+			current = next;
+			++count;
 		}
 	}
 	catch (...) {
-		m_centralFreeListLock[index].clear();
+		unlockFreeList(index);
 		throw;
 	}
-	m_centralFreeListLock[index].clear();
+	unlockFreeList(index);
 
+	while (emptySpans) {
+		SpanTracker* next = emptySpans->next;
+		returnSpanToPageCache(emptySpans);
+		emptySpans = next;
+	}
 }
 
-bool CentralCache::shouldPerformDelayedReturn(size_t index, size_t currentCount, std::chrono::steady_clock::time_point currentTime) {
-	//
-	if (currentCount >= MAX_DELAY_COUNT) {
-		return true;
-	}
+void CentralCache::returnSpanToPageCache(SpanTracker* spanTracker) {
+	assert(spanTracker);
+	MP_LATENCY_SCOPE(LatencyTier::ReturnSpanToPageCache);
+	MP_TRACE(return_span, spanTracker->spanAddr, spanTracker->numPages);
 
-	auto lastReturnTime = m_lastReturnTimeArray[index];
-	return (currentTime - lastReturnTime) >= MAX_DELAY_INTERVAL;
+	PageCache::getInstance().deallocateSpan(spanTracker->spanAddr, spanTracker->numPages);
+	delete[] spanTracker->freeBitmap;
+	delete spanTracker;
 }
 
-void CentralCache::performDelayedReturn(size_t index) {
+CentralLockStats CentralCache::getLockStats(size_t index) const {
+	const CentralFreeList& list = m_freeLists[index];
+	CentralLockStats stats;
+	stats.index = index;
+	stats.lockCount = list.lockCount.load(std::memory_order_relaxed);
+	stats.contendedCount = list.contendedCount.load(std::memory_order_relaxed);
+	stats.waitNs = list.waitNs.load(std::memory_order_relaxed);
+	return stats;
+}
 
-	while (m_centralFreeListLock[index].test_and_set()) {
-		std::this_thread::yield();
-	}
-	// ӳټ
-	m_delayCountsArray[index].store(0);
-
-	// 黹ʱ
-	m_lastReturnTimeArray[index] = std::chrono::steady_clock::now();
-
-	// ͳ黹span
-	std::set<SpanTracker*> spanFreeSet;
-	void* currentBlock = m_centralFreeList[index].load();
-
-	while (currentBlock)
-	{
-		SpanTracker* spanTracker = getSpanTracker(currentBlock);
-		if (spanTracker)
-		{
-			//spanTrackerŵset
-			spanFreeSet.insert(spanTracker);
+std::vector<CentralLockStats> CentralCache::getContendedClasses() const {
+	std::vector<CentralLockStats> result;
+	for (size_t index = 0; index < FREE_LIST_NUM; ++index) {
+		if (m_freeLists[index].contendedCount.load(std::memory_order_relaxed) > 0) {
+			result.push_back(getLockStats(index));
 		}
-		currentBlock = *reinterpret_cast<void**>(currentBlock);
 	}
+	std::sort(result.begin(), result.end(), [](const CentralLockStats& a, const CentralLockStats& b) {
+		return a.waitNs > b.waitNs;
+	});
+	return result;
+}
 
-	// ÿspanĿмǷԹ黹
-	for (auto tracker : spanFreeSet)
-	{
-		if (tracker) {
-			if ((tracker->blockCount.load()) <= (tracker->freeCount.load())) {
-				returnSpanToPageCache(tracker,index);
-			}
-		}
+void CentralCache::resetLockStats() {
+	//ͳֻڳʱдҲҪ
+	for (auto& list : m_freeLists) {
+		list.lock.lock();
+		list.lockCount.store(0, std::memory_order_relaxed);
+		list.contendedCount.store(0, std::memory_order_relaxed);
+		list.waitNs.store(0, std::memory_order_relaxed);
+		list.lock.unlock();
 	}
-	m_centralFreeListLock[index].clear();
 }
 
-void CentralCache::returnSpanToPageCache(SpanTracker* spanTracker,size_t index) {
-	assert(spanTracker);
-
-	void* spanAddr = spanTracker->spanAddr.load();
-	size_t pageNum = spanTracker->numPages.load();
+size_t CentralCache::takeBlocks(SpanTracker* span, size_t n, void*& head, void*& tail) {
+	size_t size = (span->index + 1) * ALIGNMENT;
+	char* base = static_cast<char*>(span->spanAddr);
+	size_t taken = 0;
 
-	while (m_centralFreeListLock[index].test_and_set()) {
-		std::this_thread::yield();
+	auto append = [&](void* block) {
+		if (tail) {
+			*(reinterpret_cast<void**>(tail)) = block;
+		}
+		else {
+			head = block;
+		}
+		tail = block;
+	};
+
+	if (span->freeBitmap) {
+		//ɨ裬ÿctzȡ͵Ŀλ
+		size_t word = span->bitmapHint;
+		while (taken < n && word < span->bitmapWords) {
+			uint64_t bits = span->freeBitmap[word];
+			while (bits && taken < n) {
+				append(base + (word * 64 + countTrailingZeros(bits)) * size);
+				bits &= bits - 1;
+				++taken;
+			}
+			span->freeBitmap[word] = bits;
+			if (!bits) {
+				++word;
+			}
+		}
+		span->bitmapHint = word;
 	}
+	else {
+		//ȡѹ黹Ŀ飬ٴδз
+		while (span->freeList && taken < n) {
+			void* block = span->freeList;
+			span->freeList = *(reinterpret_cast<void**>(block));
+			append(block);
+			++taken;
+		}
 
-	//ƳЩ
-	void* head = m_centralFreeList[index].load();
-	void* newHead = nullptr;
-	void* prev = nullptr;
-	void* current = head;
-
-	while (current) {
-		void* next = *(reinterpret_cast<void**>(current));
-		if (current >= spanAddr && current < (static_cast<char*>(spanAddr) + pageNum * PAGE_SIZE)) {
-			if (prev) {
-				*(reinterpret_cast<void**>(prev)) = next;
-			}else {
-				newHead = next;
+		if (taken < n && span->bumpCursor != span->bumpEnd) {
+			size_t bumpNum = std::min(n - taken, static_cast<size_t>(span->bumpEnd - span->bumpCursor) / size);
+			char* block = span->bumpCursor;
+			append(block);
+			for (size_t i = 0; i + 1 < bumpNum; ++i, block += size) {
+				*(reinterpret_cast<void**>(block)) = block + size;
 			}
+			tail = block;
+			span->bumpCursor = block + size;
+			taken += bumpNum;
 		}
-		else {
-			prev = current;
+	}
+
+	span->useCount += taken;
+	return taken;
+}
+
+void CentralCache::putBlock(SpanTracker* span, void* block) {
+	if (span->freeBitmap) {
+		//ֻλͼд鱾
+		size_t size = (span->index + 1) * ALIGNMENT;
+		size_t slot = static_cast<size_t>(static_cast<char*>(block) - static_cast<char*>(span->spanAddr)) / size;
+		size_t word = slot / 64;
+		span->freeBitmap[word] |= uint64_t(1) << (slot % 64);
+		if (word < span->bitmapHint) {
+			span->bitmapHint = word;
 		}
-		current = next;
 	}
+	else {
+		*(reinterpret_cast<void**>(block)) = span->freeList;
+		span->freeList = block;
+	}
+}
 
-	//ĵһڴ鱻
-	if (newHead) {
-		m_centralFreeList[index].store(newHead);
+void CentralCache::pushSpan(SpanTracker*& list, SpanTracker* span) {
+	//ͷ巨
+	span->prev = nullptr;
+	span->next = list;
+	if (list) {
+		list->prev = span;
 	}
-	PageCache::getInstance().deallocateSpan(spanAddr, pageNum);
+	list = span;
+}
 
-	m_centralFreeListLock[index].clear();
-}
\ No newline at end of file
+void CentralCache::removeSpan(SpanTracker*& list, SpanTracker* span) {
+	if (span->prev) {
+		span->prev->next = span->next;
+	}
+	else {
+		list = span->next;
+	}
+	if (span->next) {
+		span->next->prev = span->prev;
+	}
+	span->prev = nullptr;
+	span->next = nullptr;
+}
@@ -1,16 +1,62 @@
 #pragma once
 #include "Common.h"
+#include "PageMap.h"
+#include "SpinLock.h"
 #include <atomic>
 #include <array>
-#include <chrono>
+#include <vector>
+
+struct RemoteFreeQueue;
 
 //CentralCacheеһspanдŵڴĴСһ
+//spanԼάÿֶζɶӦС
 struct SpanTracker
 {
-	std::atomic<void*> spanAddr{ nullptr };  //spanʼַ
-	std::atomic<size_t> numPages{ 0 };   //ռҳ
-	std::atomic<size_t> blockCount{ 0 }; //ܿ
-	std::atomic<size_t> freeCount{ 0 };  //п
+	void* spanAddr{ nullptr };  //spanʼַ
+	size_t numPages{ 0 };   //ռҳ
+	size_t index{ 0 };      //С±
+	size_t blockCount{ 0 }; //ܿ
+	size_t useCount{ 0 };   //ѷȥThreadCacheûУĿ
+	void* freeList{ nullptr }; //spanѹ黹Ŀп
+	char* bumpCursor{ nullptr }; //δ㣬spanԤз֣ȡʱŴ
+	char* bumpEnd{ nullptr };    //зյ㣨һĩβ
+
+	//ССλͼiλΪ1ʾiУfreeListbumpCursor
+	uint64_t* freeBitmap{ nullptr };
+	size_t bitmapWords{ 0 };
+	size_t bitmapHint{ 0 }; //֮ǰȫΪ0ȡ￪ʼɨ
+	bool cold{ false }; //Cold/LongLivedʾspan
+	SpanTracker* prev{ nullptr }; //spanеǰһ
+	SpanTracker* next{ nullptr }; //spanеĺһ
+
+	//һδӸspanȡ̵߳ԶͷŶУ߳ͷŵĿȻ
+	std::atomic<RemoteFreeQueue*> owner{ nullptr };
+
+	bool hasFreeBlock() const { return useCount < blockCount; }
+};
+
+//ÿСĻ״̬ռһУڴСụ
+struct alignas(CACHE_LINE_SIZE) CentralFreeList
+{
+	SpinLock lock;
+	SpanTracker* partialSpans{ nullptr }; //ֿspanspanлпп飩
+	SpanTracker* fullSpans{ nullptr };    //spanspanеĿȫȥ
+	SpanTracker* coldPartialSpans{ nullptr }; //Cold/LongLivedʾspanֿ
+	SpanTracker* coldFullSpans{ nullptr };
+
+	//ͳƣֻڳʱдʱ
+	std::atomic<uint64_t> lockCount{ 0 };      //
+	std::atomic<uint64_t> contendedCount{ 0 }; //һγûõĴ
+	std::atomic<uint64_t> waitNs{ 0 };         //ʱ
+};
+
+//ĳС
+struct CentralLockStats
+{
+	size_t index;
+	uint64_t lockCount;
+	uint64_t contendedCount;
+	uint64_t waitNs;
 };
 
 class CentralCache
@@ -18,53 +64,67 @@ class CentralCache
 public:
 	static CentralCache& getInstance();
 
-	//ThreadCacheṩڴӿ
-	void* fetchRange(size_t index,size_t batchNum);
+	//ThreadCacheṩڴӿڣownerΪȡ̵߳ԶͷŶ
+	//ȡĿ鴮nullptrβ[start, end]ؿ÷Ҫٱ
+	//hintHotʱӸʾspanȡ
+	size_t fetchRange(size_t index, size_t batchNum, void*& start, void*& end, RemoteFreeQueue* owner = nullptr,
+		AllocHint hint = AllocHint::Hot);
+
+	//ThreadCacheṩ黹ڴӿڣstartʼ黹blockNum
+	void returnRange(void* start, size_t blockNum, size_t index);
 
-	//ThreadCacheṩ黹ڴӿ
-	void returnRange(void* start, size_t size, size_t index);
+	//Ԥ֤СindexĲֿspanblockNumп飬spanԤȱҳڴ油
+	//ԤĿп
+	size_t reserve(size_t index, size_t blockNum);
+
+	// ȡspanϢδ黹ǰspanһڣ
+	SpanTracker* getSpanTracker(void* blockAddr);
+
+	//Сͳ
+	CentralLockStats getLockStats(size_t index) const;
+
+	//ĴС࣬ʱӸߵ
+	std::vector<CentralLockStats> getContendedClasses() const;
+
+	void resetLockStats();
 
 private:
 	CentralCache();
 
-	// ȡspanϢ
-	SpanTracker* getSpanTracker(void* blockAddr);
+	//¼
+	void lockFreeList(size_t index);
+	void unlockFreeList(size_t index) { m_freeLists[index].lock.unlock(); }
+
+	//PageCacheȡspanҳɴС
+	void* fetchFromPageCache(size_t size, bool cold);
 
-	//PageCacheȡspan
-	void* fetchFromPageCache(size_t size);
+	//PageCacheȡspanҪдС
+	SpanTracker* allocateSpan(size_t index, bool cold = false);
 
-	// ǷҪִӳٹ黹
-	bool shouldPerformDelayedReturn(size_t index, size_t currentCount, std::chrono::steady_clock::time_point currentTime);
+	//spanڵĲֿ/
+	static SpanTracker*& partialList(CentralFreeList& list, bool cold) {
+		return cold ? list.coldPartialSpans : list.partialSpans;
+	}
+	static SpanTracker*& fullList(CentralFreeList& list, bool cold) {
+		return cold ? list.coldFullSpans : list.fullSpans;
+	}
 
-	//ִӳٹ黹
-	void performDelayedReturn(size_t index);
+	//spanеĿȫ黹󣬰spanPageCache
+	void returnSpanToPageCache(SpanTracker* spanTracker);
 
-	void returnSpanToPageCache(SpanTracker* spanTracker, size_t index);
+	//spanȡnӵ[head, tail]棬ȡĿ
+	static size_t takeBlocks(SpanTracker* span, size_t n, void*& head, void*& tail);
+
+	//ѿŻspan
+	static void putBlock(SpanTracker* span, void* block);
+
+	static void pushSpan(SpanTracker*& list, SpanTracker* span);
+	static void removeSpan(SpanTracker*& list, SpanTracker* span);
 
 private:
-	//Ļ
-	std::array<std::atomic<void*>, FREE_LIST_NUM> m_centralFreeList;
-
-	//Ļ
-	std::array<std::atomic_flag, FREE_LIST_NUM> m_centralFreeListLock;
-
-	//ʹ洢spanϢ
-	std::array<SpanTracker, MAX_SPAN_NUM> m_spanTrackerArray;
-
-	//ǰspan
-	std::atomic<size_t> m_spanNum{ 0 }; 
-
-	// ӳٹ黹صĳԱ
-	//ӳټ
-	static const size_t MAX_DELAY_COUNT = 48;
-
-	//ÿСӳټ
-	std::array<std::atomic<size_t>, FREE_LIST_NUM> m_delayCountsArray;
-	
-	// ϴι黹ʱ
-	std::array<std::chrono::steady_clock::time_point, FREE_LIST_NUM> m_lastReturnTimeArray;
-	
-	//ӳټ
-	static const std::chrono::milliseconds MAX_DELAY_INTERVAL;
-};
+	//ÿСspanͳ
+	std::array<CentralFreeList, FREE_LIST_NUM> m_freeLists;
 
+	//ҳŵspanӳ䣬O(1)ҵڴspan
+	PageMap<SpanTracker> m_spanMap;
+};
@@ -1,19 +1,81 @@
 ﻿#pragma once
+#include <cstddef>
 #include <utility>
+#include <algorithm>
 #include <assert.h>
 
 constexpr size_t ALIGNMENT = 8;   //对齐大小
 constexpr size_t MAX_BYTES = 256 * 1024; //256KB
 constexpr size_t FREE_LIST_NUM = MAX_BYTES / ALIGNMENT; //自由链表数量	
-constexpr size_t MAX_SPAN_NUM = 1024;   
 constexpr size_t PAGE_SIZE =4096;  // 4K 页大小
+constexpr size_t CACHE_LINE_SIZE = 64; // 缓存行大小
 
 // 线程本地缓存中单个大小类内存块的最大数量阈值，超过则归还给中心缓存
 constexpr size_t THREAD_FREE_BLOCK_THRESHOLD = 64;  
 
-// 每次从PageCache获取span大小（以页为单位）
+// 每次从PageCache获取span的最小大小（以页为单位），小对象都用这个大小
 constexpr size_t SPAN_PAGES = 8;
 
+// span尾部浪费不超过span大小的1/SPAN_WASTE_RATIO
+constexpr size_t SPAN_WASTE_RATIO = 8;
+
+// span至少容纳的对象数；对象较大时按SPAN_MIN_OBJECT_BYTES / 对象大小递减，但至少1个
+constexpr size_t SPAN_MIN_OBJECTS = 8;
+constexpr size_t SPAN_MIN_OBJECT_BYTES = 64 * 1024;
+
+// 不超过该大小的大小类，span用位图记录空闲块，归还的块不会被写入
+// 更大的大小类每个span块数少，仍用块内链表加指针切分
+constexpr size_t SPAN_BITMAP_MAX_BYTES = 1024;
+
+// PageCache分片缓存：不超过SMALL_SPAN_MAX_PAGES页的span在线程所属分片中缓存，不进全局锁
+constexpr size_t PAGE_SHARD_NUM = 16;
+constexpr size_t SMALL_SPAN_MAX_PAGES = 64;
+// 分片为空时一次从全局取多少页，切成若干个同样大小的span
+constexpr size_t PAGE_SHARD_REFILL_PAGES = 32;
+// 单个分片最多缓存的页数，超过则整体还给全局
+constexpr size_t PAGE_SHARD_MAX_PAGES = 128;
+
+// 大对象：MAX_BYTES到LARGE_MAX_BYTES之间按页的整数倍分成粗粒度的大小类，每次翻倍分LARGE_CLASSES_PER_DOUBLING个，
+// 整块span缓存在按CPU划分的小缓存中；更大的仍然直接用malloc
+constexpr size_t LARGE_MAX_BYTES = 4 * 1024 * 1024;
+constexpr size_t LARGE_CLASSES_PER_DOUBLING = 4;
+constexpr size_t LARGE_CLASS_NUM = 16;
+// 按CPU划分的缓存个数（CPU编号取模），以及单个CPU缓存最多缓存的字节数
+constexpr size_t LARGE_CACHE_CPU_NUM = 64;
+constexpr size_t LARGE_CACHE_CPU_BYTES = 8 * 1024 * 1024;
+
+// Arena每次从PageCache获取的span大小（以页为单位）
+constexpr size_t ARENA_CHUNK_PAGES = 16;
+
+// 所有线程缓存共享一个总额度（thread_cache.total_bytes，见Tuning.h），每个线程占其中一份：
+// 新线程从总额度中拿THREAD_CACHE_MIN_BYTES（不够就从其他线程偷），缓存超出自己的额度时每次扩大THREAD_CACHE_STEAL_BYTES，
+// 总额度用完后从其他线程偷，单个线程不超过THREAD_CACHE_MAX_BYTES；
+// 被偷的线程即使一直空闲，回收线程也每隔THREAD_CACHE_SCAVENGE_INTERVAL_US替它把缓存缩回额度以内
+constexpr size_t THREAD_CACHE_MIN_BYTES = 2 * MAX_BYTES;
+constexpr size_t THREAD_CACHE_MAX_BYTES = 4 * 1024 * 1024;
+constexpr size_t THREAD_CACHE_STEAL_BYTES = 64 * 1024;
+constexpr size_t THREAD_CACHE_TOTAL_BYTES = 32 * 1024 * 1024;
+constexpr size_t THREAD_CACHE_SCAVENGE_INTERVAL_US = 10000;
+
+// 单个线程远程释放队列中积压的内存块上限，超过则直接归还中心缓存
+constexpr size_t REMOTE_FREE_QUEUE_LIMIT = 4096;
+
+// 异步释放：后台回收线程两次归还之间最多等待的时间（微秒），释放线程不唤醒它，保证释放路径上没有系统调用
+constexpr size_t OFFLOAD_RECLAIM_INTERVAL_US = 1000;
+
+// 纪元回收：每个退休块链表节点容纳的块数，以及每退休多少个块尝试推进一次全局纪元
+constexpr size_t EPOCH_RETIRE_CHUNK_BLOCKS = 63;
+constexpr size_t EPOCH_ADVANCE_INTERVAL = 64;
+
+//分配提示：冷数据和长期存活的对象放进单独的span，不和短命的热数据混在一起，
+//热数据的span因此更紧凑，也不会被少数长期存活的块钉住而无法归还
+enum class AllocHint : unsigned char
+{
+	Hot,       //默认，经过线程缓存
+	Cold,      //很少访问
+	LongLived, //长期存活，和Cold共用单独的span集合
+};
+
 //内存块头部信息
 struct BlockHeader {
 	size_t size;          //内存块大小
@@ -25,18 +87,72 @@ struct BlockHeader {
 class SizeClass {
 public:
 	//先将申请内存的大小转换为8的倍数向上取整
-	static size_t roundUp(size_t bytes) {
+	static constexpr size_t roundUp(size_t bytes) {
 		return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);   //向上取整到对齐大小,~取反，二进制最后三位清0
 	}
 
 	//计算申请的内存从ThreadCache自由链表的哈希桶的下标
-	static size_t getFreeListIndex(size_t bytes) {
-
-		assert(bytes >= 0);
+	//constexpr函数，ObjectPool在编译期算出类型对应的下标
+	static constexpr size_t getFreeListIndex(size_t bytes) {
 
 		//确保bytes至少为ALIGNMENT
-		bytes = std::max(bytes, ALIGNMENT);
+		bytes = bytes < ALIGNMENT ? ALIGNMENT : bytes;
 
 		return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1; //0对应8字节，1对应16字节
 	}
-};
\ No newline at end of file
+
+	//大小为size（已对齐）的大小类每个span占多少页：
+	//在至少SPAN_PAGES页、至少容纳若干个对象的前提下，取尾部浪费不超过1/SPAN_WASTE_RATIO的最小页数
+	//constexpr函数，参数为常量时在编译期求值
+	static constexpr size_t getSpanPages(size_t size) {
+		size_t objects = SPAN_MIN_OBJECT_BYTES / size;
+		if (objects > SPAN_MIN_OBJECTS) {
+			objects = SPAN_MIN_OBJECTS;
+		}
+		if (objects == 0) {
+			objects = 1;
+		}
+
+		size_t pages = (size * objects + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (pages < SPAN_PAGES) {
+			pages = SPAN_PAGES;
+		}
+		while ((pages * PAGE_SIZE) % size * SPAN_WASTE_RATIO > pages * PAGE_SIZE) {
+			++pages;
+		}
+		return pages;
+	}
+};
+
+//大对象大小类：(2^p, 2^(p+1)]按2^(p-2)取整，每个大小类尾部浪费不超过1/4，且都是页的整数倍
+class LargeSizeClass {
+public:
+	//size在(MAX_BYTES, LARGE_MAX_BYTES]之间
+	static constexpr size_t getIndex(size_t size) {
+		size_t doubling = 0;
+		while ((MAX_BYTES << (doubling + 1)) < size) {
+			++doubling;
+		}
+		size_t step = (MAX_BYTES << doubling) / LARGE_CLASSES_PER_DOUBLING;
+		size_t steps = (size + step - 1) / step;
+		return doubling * LARGE_CLASSES_PER_DOUBLING + steps - LARGE_CLASSES_PER_DOUBLING - 1;
+	}
+
+	static constexpr size_t getBytes(size_t index) {
+		size_t doubling = index / LARGE_CLASSES_PER_DOUBLING;
+		size_t step = (MAX_BYTES << doubling) / LARGE_CLASSES_PER_DOUBLING;
+		return (index % LARGE_CLASSES_PER_DOUBLING + LARGE_CLASSES_PER_DOUBLING + 1) * step;
+	}
+};
+
+static_assert(LargeSizeClass::getIndex(MAX_BYTES + 1) == 0, "first large class");
+static_assert(LargeSizeClass::getBytes(0) == MAX_BYTES + MAX_BYTES / LARGE_CLASSES_PER_DOUBLING, "first large class size");
+static_assert(LargeSizeClass::getBytes(LargeSizeClass::getIndex(512 * 1024)) == 512 * 1024, "512KB fits exactly");
+static_assert(LargeSizeClass::getBytes(LargeSizeClass::getIndex(1024 * 1024)) == 1024 * 1024, "1MB fits exactly");
+static_assert(LargeSizeClass::getIndex(LARGE_MAX_BYTES) == LARGE_CLASS_NUM - 1, "last large class");
+static_assert(LargeSizeClass::getBytes(LARGE_CLASS_NUM - 1) == LARGE_MAX_BYTES, "last large class size");
+static_assert((MAX_BYTES / LARGE_CLASSES_PER_DOUBLING) % PAGE_SIZE == 0, "large classes are whole pages");
+
+static_assert(SizeClass::getSpanPages(8) == SPAN_PAGES, "small classes use the minimum span");
+static_assert(SizeClass::getSpanPages(20 * 1024) == 15, "20KB class: 3 objects, no tail waste");
+static_assert(SizeClass::getSpanPages(MAX_BYTES) == MAX_BYTES / PAGE_SIZE, "largest class: one object per span");
\ No newline at end of file
@@ -0,0 +1,304 @@
+#include "Epoch.h"
+#include "ThreadCache.h"
+#include "Tuning.h"
+#include "TraceRecorder.h"
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <linux/membarrier.h>
+#include <linux/version.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+//MEMBARRIER_CMD_*是枚举，不能用#ifdef判断，按内核头文件版本判断（PRIVATE_EXPEDITED从4.14开始有）
+#if defined(SYS_membarrier) && LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#define MP_HAS_MEMBARRIER 1
+#endif
+#endif
+
+//纪元从1开始，0表示不在临界区
+std::atomic<uint64_t> EpochReclaimer::s_globalEpoch{ 1 };
+std::atomic<bool> EpochReclaimer::s_asymmetricFence{ false };
+
+namespace {
+	struct RetiredBlock
+	{
+		void* ptr;
+		size_t size;
+	};
+
+	//退休块按纪元分组存放在链表节点中，退休的块本身可能还在被读，不能借用它的内存
+	struct RetireChunk
+	{
+		RetireChunk* next;
+		uint64_t epoch; //节点中的块退休时的纪元
+		size_t count;
+		RetiredBlock blocks[EPOCH_RETIRE_CHUNK_BLOCKS];
+	};
+
+	//相差2个纪元才能释放，按纪元模3轮换，同一时刻最多三组有块
+	constexpr size_t RETIRE_BAG_NUM = 3;
+
+	struct EpochThreadState
+	{
+		RetireChunk* bags[RETIRE_BAG_NUM]; //每组是同一纪元的节点链表，头节点未满
+		RetireChunk* spare;                //留一个空节点，避免反复new/delete
+		size_t retiredNum;                 //上次尝试推进以来退休的块数
+	};
+
+	std::atomic<EpochRecord*> g_records{ nullptr };
+
+	//已退出线程留下的退休节点，由之后回收的线程在安全时释放
+	std::mutex g_orphanMutex;
+	RetireChunk* g_orphans = nullptr;
+
+	thread_local EpochThreadState t_state{};
+	thread_local bool t_exited = false;
+
+	bool initAsymmetricFence() {
+#if defined(__SANITIZE_THREAD__)
+		//ThreadSanitizer看不到系统调用带来的同步
+		return false;
+#elif defined(_WIN32)
+		return true;
+#elif defined(MP_HAS_MEMBARRIER)
+		return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+#else
+		return false;
+#endif
+	}
+
+	//让所有线程在此之前的写对本线程可见，和进入临界区一侧的屏障配对
+	void heavyFence(bool asymmetric) {
+		if (asymmetric) {
+#if defined(_WIN32)
+			FlushProcessWriteBuffers();
+			return;
+#elif defined(MP_HAS_MEMBARRIER)
+			syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+			return;
+#endif
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	//把节点中的块还给本线程的ThreadCache，节点本身留作备用或释放
+	void freeChunks(RetireChunk* chunk) {
+		ThreadCache* threadCache = ThreadCache::getInstance();
+		while (chunk) {
+			RetireChunk* next = chunk->next;
+			for (size_t i = 0; i < chunk->count; ++i) {
+				MP_RECORD_TRACE(TraceOp::Deallocate, chunk->blocks[i].ptr, chunk->blocks[i].size);
+				threadCache->deallocate(chunk->blocks[i].ptr, chunk->blocks[i].size);
+			}
+			if (!t_state.spare && !t_exited) {
+				t_state.spare = chunk;
+			}
+			else {
+				delete chunk;
+			}
+			chunk = next;
+		}
+	}
+
+	void pushOrphans(RetireChunk* chunk) {
+		if (!chunk) {
+			return;
+		}
+		RetireChunk* tail = chunk;
+		while (tail->next) {
+			tail = tail->next;
+		}
+		std::lock_guard<std::mutex> lock(g_orphanMutex);
+		tail->next = g_orphans;
+		g_orphans = chunk;
+	}
+
+	//释放纪元已经不晚于epoch-2的块：本线程各组，以及已退出线程留下的
+	void reclaim(uint64_t epoch) {
+		for (RetireChunk*& bag : t_state.bags) {
+			if (bag && bag->epoch + 2 <= epoch) {
+				RetireChunk* chunk = bag;
+				bag = nullptr;
+				freeChunks(chunk);
+			}
+		}
+
+		RetireChunk* ready = nullptr;
+		{
+			//其他线程正在处理时跳过，下次再来
+			std::unique_lock<std::mutex> lock(g_orphanMutex, std::try_to_lock);
+			if (!lock.owns_lock()) {
+				return;
+			}
+			RetireChunk** link = &g_orphans;
+			while (RetireChunk* chunk = *link) {
+				if (chunk->epoch + 2 <= epoch) {
+					*link = chunk->next;
+					chunk->next = ready;
+					ready = chunk;
+				}
+				else {
+					link = &chunk->next;
+				}
+			}
+		}
+		freeChunks(ready);
+	}
+}
+
+//线程退出时调用EpochReclaimer::unregisterThread
+struct EpochThreadExit
+{
+	~EpochThreadExit() {
+		EpochReclaimer::unregisterThread();
+	}
+};
+
+namespace {
+	thread_local EpochThreadExit t_threadExit;
+}
+
+EpochRecord* EpochReclaimer::registerThread() {
+	//第一个线程注册时确定屏障方式，之后所有线程的临界区都按同一种方式进入
+	(void)asymmetricFenceAvailable();
+
+	//优先复用已退出线程留下的记录
+	EpochRecord* record = nullptr;
+	for (EpochRecord* r = g_records.load(std::memory_order_acquire); r; r = r->next) {
+		bool expected = false;
+		if (!r->inUse.load(std::memory_order_relaxed)
+			&& r->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			record = r;
+			break;
+		}
+	}
+	if (!record) {
+		record = new EpochRecord;
+		record->inUse.store(true, std::memory_order_relaxed);
+		EpochRecord* head = g_records.load(std::memory_order_relaxed);
+		do {
+			record->next = head;
+		} while (!g_records.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	//线程退出后（其他thread_local析构中）再进入临界区的，记录不再归还
+	if (!t_exited) {
+		(void)&t_threadExit;
+	}
+	localRecord() = record;
+	return record;
+}
+
+void EpochReclaimer::unregisterThread() {
+	t_exited = true;
+
+	//ThreadCache可能已经析构，退休块交给其他线程释放
+	for (RetireChunk*& bag : t_state.bags) {
+		pushOrphans(bag);
+		bag = nullptr;
+	}
+	delete t_state.spare;
+	t_state.spare = nullptr;
+
+	EpochRecord*& record = localRecord();
+	if (record && record->nesting == 0) {
+		record->inUse.store(false, std::memory_order_release);
+		record = nullptr;
+	}
+}
+
+bool EpochReclaimer::asymmetricFenceAvailable() {
+	static const bool available = [] {
+		bool asymmetric = initAsymmetricFence();
+		s_asymmetricFence.store(asymmetric, std::memory_order_relaxed);
+		return asymmetric;
+	}();
+	return available;
+}
+
+void EpochReclaimer::asymmetricHeavyFence() {
+	heavyFence(asymmetricFenceAvailable());
+}
+
+bool EpochReclaimer::tryAdvance() {
+	uint64_t epoch = s_globalEpoch.load(std::memory_order_acquire);
+	heavyFence(s_asymmetricFence.load(std::memory_order_relaxed));
+
+	for (EpochRecord* record = g_records.load(std::memory_order_acquire); record; record = record->next) {
+		uint64_t local = record->epoch.load(std::memory_order_acquire);
+		if (local != 0 && local != epoch) {
+			return false; //有线程还停在上一个纪元的临界区中
+		}
+	}
+	return s_globalEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+}
+
+void EpochReclaimer::retire(void* ptr, size_t size) {
+	if (!ptr) {
+		return;
+	}
+	if (!localRecord()) {
+		registerThread();
+	}
+
+	uint64_t epoch = s_globalEpoch.load(std::memory_order_acquire);
+	RetireChunk*& bag = t_state.bags[epoch % RETIRE_BAG_NUM];
+	if (bag && bag->epoch != epoch) {
+		//同组中是至少三个纪元以前的块，早已安全
+		RetireChunk* chunk = bag;
+		bag = nullptr;
+		if (t_exited) {
+			pushOrphans(chunk);
+		}
+		else {
+			freeChunks(chunk);
+		}
+	}
+
+	if (!bag || bag->count == EPOCH_RETIRE_CHUNK_BLOCKS) {
+		RetireChunk* chunk = t_state.spare ? t_state.spare : new RetireChunk;
+		t_state.spare = nullptr;
+		chunk->next = bag;
+		chunk->epoch = epoch;
+		chunk->count = 0;
+		bag = chunk;
+	}
+	bag->blocks[bag->count++] = RetiredBlock{ ptr, size };
+
+	if (t_exited) {
+		//线程已在退出，没有机会再回收
+		pushOrphans(bag);
+		bag = nullptr;
+		return;
+	}
+
+	if (++t_state.retiredNum >= g_tuning.epochAdvanceInterval.load(std::memory_order_relaxed)) {
+		t_state.retiredNum = 0;
+		tryAdvance();
+		reclaim(currentEpoch());
+	}
+}
+
+void EpochReclaimer::synchronize() {
+	if (!localRecord()) {
+		registerThread();
+	}
+	assert(localRecord()->nesting == 0);
+
+	//推进两次后，调用前退休的块都已安全
+	uint64_t target = currentEpoch() + 2;
+	while (currentEpoch() < target) {
+		if (!tryAdvance()) {
+			std::this_thread::yield();
+		}
+	}
+	reclaim(currentEpoch());
+}
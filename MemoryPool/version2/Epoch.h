@@ -0,0 +1,110 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <cstdint>
+
+// 基于纪元的延迟回收，给无锁数据结构用：
+//   {
+//       EpochGuard guard;            // 进入临界区，只写一次线程本地的纪元
+//       Node* node = head.load();    // 临界区内读到的节点不会被释放
+//       ...
+//   }
+//   EpochReclaimer::retire(oldNode, sizeof(Node)); // 从结构中摘下后退休，宽限期过后再真正释放
+// 全局纪元推进两次之后，之前退休的块不可能再被任何临界区访问，此时按本线程批量还给ThreadCache
+// 进入临界区只需要一次普通写：推进纪元的一方用非对称屏障（Linux的membarrier、Windows的
+// FlushProcessWriteBuffers）让所有线程的写可见；系统不支持时进入临界区退回使用完整的内存屏障
+
+//每个线程一个，线程退出后留给新线程复用，从不释放
+//用new分配（C++14不保证超过16字节的对齐），靠尾部填充让不同线程的纪元不落在同一缓存行
+struct EpochRecord
+{
+	std::atomic<uint64_t> epoch{ 0 }; //临界区内为进入时看到的全局纪元，0表示不在临界区
+	size_t nesting{ 0 };              //临界区嵌套层数，只有所属线程访问
+	std::atomic<bool> inUse{ false };
+	EpochRecord* next{ nullptr };     //所有记录串成的链表，只在头部插入
+	char padding[CACHE_LINE_SIZE];
+};
+
+class EpochReclaimer
+{
+public:
+	//进入/离开临界区，可以嵌套
+	static void enter();
+	static void exit();
+
+	//退休一个已从数据结构中摘下的块，宽限期过后由本线程按size归还内存池
+	static void retire(void* ptr, size_t size);
+
+	//推进纪元直到本线程之前退休的块全部释放；其他线程停在临界区中时会一直等待，不能在临界区内调用
+	static void synchronize();
+
+	static uint64_t currentEpoch() { return s_globalEpoch.load(std::memory_order_acquire); }
+
+	//非对称屏障也给其他模块用：轻的一侧在写之后、读之前调用asymmetricLightFence，重的一侧调用asymmetricHeavyFence
+	//系统不支持时两侧都退回完整的内存屏障
+	static bool asymmetricFenceAvailable();
+	static void asymmetricLightFence();
+	static void asymmetricHeavyFence();
+
+private:
+	//本线程的记录，函数内的thread_local指针不需要初始化保护，访问就是一次线程本地读
+	static EpochRecord*& localRecord() {
+		static thread_local EpochRecord* record = nullptr;
+		return record;
+	}
+
+	static EpochRecord* registerThread();
+
+	//线程退出时把没释放的退休块交给其他线程，记录留给新线程复用
+	static void unregisterThread();
+	friend struct EpochThreadExit;
+
+	//所有线程都看到当前纪元（或不在临界区）时推进一次，返回是否推进
+	static bool tryAdvance();
+
+	static std::atomic<uint64_t> s_globalEpoch;
+
+	//推进方能用非对称屏障时，进入临界区只需编译器屏障；第一次调用asymmetricFenceAvailable时确定
+	static std::atomic<bool> s_asymmetricFence;
+};
+
+inline void EpochReclaimer::enter() {
+	EpochRecord* record = localRecord();
+	if (!record) {
+		record = registerThread();
+	}
+	if (record->nesting++ == 0) {
+		record->epoch.store(s_globalEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		//纪元的写必须先于临界区内的读，推进方检查时才不会漏掉本线程
+		asymmetricLightFence();
+	}
+}
+
+inline void EpochReclaimer::asymmetricLightFence() {
+	//还没确定时为false，多用一次完整屏障也是对的
+	if (s_asymmetricFence.load(std::memory_order_relaxed)) {
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+	}
+	else {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+}
+
+inline void EpochReclaimer::exit() {
+	EpochRecord* record = localRecord();
+	assert(record && record->nesting > 0);
+	if (--record->nesting == 0) {
+		record->epoch.store(0, std::memory_order_release);
+	}
+}
+
+//作用域内处于临界区
+class EpochGuard
+{
+public:
+	EpochGuard() { EpochReclaimer::enter(); }
+	~EpochGuard() { EpochReclaimer::exit(); }
+
+	EpochGuard(const EpochGuard&) = delete;
+	EpochGuard& operator=(const EpochGuard&) = delete;
+};
@@ -0,0 +1,228 @@
+#include "Heap.h"
+#include "PageCache.h"
+#include <new>
+
+Heap::Heap() : m_pageCache(&PageCache::getInstance()) {}
+
+Heap::Heap(PageProvider& provider)
+	: m_pageCache(nullptr)
+	, m_ownPageCache(new PageCache(provider)) {
+	m_pageCache = m_ownPageCache.get();
+}
+
+Heap::~Heap() {
+	destroy();
+	if (m_ownPageCache) {
+		m_ownPageCache->releaseFreeSpans();
+	}
+}
+
+void* Heap::allocate(size_t size) {
+	if (size > MAX_BYTES) {
+		//大块单独占一个span，直接登记即可
+		HeapSpan* span = allocateSpan((size + PAGE_SIZE - 1) / PAGE_SIZE, LARGE_INDEX, size);
+		if (!span) {
+			return nullptr;
+		}
+		span->useCount = 1;
+		m_lock.lock();
+		linkSpan(span);
+		m_lock.unlock();
+		return span->spanAddr;
+	}
+
+	size_t index = SizeClass::getFreeListIndex(size);
+	size_t blockSize = (index + 1) * ALIGNMENT;
+
+	m_lock.lock();
+	HeapSpan** list = partialList(index);
+	if (!list) {
+		m_lock.unlock();
+		return nullptr;
+	}
+
+	//没有部分空闲span时向PageCache申请，申请期间不持有锁
+	if (!*list) {
+		m_lock.unlock();
+		HeapSpan* span = allocateSpan(SizeClass::getSpanPages(blockSize), index, blockSize);
+		if (!span) {
+			return nullptr;
+		}
+		m_lock.lock();
+		linkSpan(span);
+		pushSpan(*list, span);
+	}
+
+	HeapSpan* span = *list;
+	void* block;
+	if (span->freeList) {
+		block = span->freeList;
+		span->freeList = *reinterpret_cast<void**>(block);
+	}
+	else {
+		block = span->bumpCursor;
+		span->bumpCursor += blockSize;
+	}
+	++span->useCount;
+
+	//已满的span只留在所有span链表中，有块归还时再挂回来
+	if (!span->hasFreeBlock()) {
+		removeSpan(*list, span);
+	}
+	m_lock.unlock();
+	return block;
+}
+
+void Heap::deallocate(void* ptr, size_t size) {
+	if (!ptr) {
+		return;
+	}
+
+	HeapSpan* span = m_spanMap.get(ptr);
+	assert(span && "block does not belong to this heap");
+	assert(span->index == (size > MAX_BYTES ? LARGE_INDEX : SizeClass::getFreeListIndex(size)));
+	(void)size;
+
+	m_lock.lock();
+	if (span->index == LARGE_INDEX) {
+		unlinkSpan(span);
+		m_lock.unlock();
+		releaseSpan(span);
+		return;
+	}
+
+	//大小类的链表表头在span建立时已创建
+	HeapSpan*& list = m_partialGroups[span->index / CLASS_GROUP_SIZE][span->index % CLASS_GROUP_SIZE];
+	bool wasFull = !span->hasFreeBlock();
+	*reinterpret_cast<void**>(ptr) = span->freeList;
+	span->freeList = ptr;
+	--span->useCount;
+
+	//span中的块全部回来了，立即还给PageCache
+	if (span->useCount == 0) {
+		if (!wasFull) {
+			removeSpan(list, span);
+		}
+		unlinkSpan(span);
+		m_lock.unlock();
+		releaseSpan(span);
+		return;
+	}
+	if (wasFull) {
+		pushSpan(list, span);
+	}
+	m_lock.unlock();
+}
+
+void Heap::destroy() {
+	m_lock.lock();
+	HeapSpan* span = m_allSpans;
+	m_allSpans = nullptr;
+	for (auto& group : m_partialGroups) {
+		delete[] group;
+		group = nullptr;
+	}
+	m_lock.unlock();
+
+	//只遍历span，不碰其中的块；页映射按节点整体删除，不逐页清除
+	while (span) {
+		HeapSpan* next = span->allNext;
+		m_pageCache->deallocateSpan(span->spanAddr, span->numPages);
+		delete span;
+		span = next;
+	}
+	m_spanMap.clear();
+	m_spanCount.store(0, std::memory_order_relaxed);
+	m_capacity.store(0, std::memory_order_relaxed);
+}
+
+Heap::HeapSpan** Heap::partialList(size_t index) {
+	HeapSpan**& group = m_partialGroups[index / CLASS_GROUP_SIZE];
+	if (!group) {
+		group = new(std::nothrow) HeapSpan*[CLASS_GROUP_SIZE]();
+		if (!group) {
+			return nullptr;
+		}
+	}
+	return &group[index % CLASS_GROUP_SIZE];
+}
+
+Heap::HeapSpan* Heap::allocateSpan(size_t numPages, size_t index, size_t blockSize) {
+	void* start = m_pageCache->allocateSpan(numPages);
+	if (!start) {
+		return nullptr;
+	}
+
+	HeapSpan* span = new(std::nothrow) HeapSpan;
+	if (!span) {
+		m_pageCache->deallocateSpan(start, numPages);
+		return nullptr;
+	}
+	span->spanAddr = start;
+	span->numPages = numPages;
+	span->index = index;
+	span->blockSize = blockSize;
+	span->blockCount = index == LARGE_INDEX ? 1 : numPages * PAGE_SIZE / blockSize;
+	span->useCount = 0;
+	span->freeList = nullptr;
+	span->bumpCursor = static_cast<char*>(start);
+	span->prev = nullptr;
+	span->next = nullptr;
+
+	m_spanMap.set(PageMap<HeapSpan>::pageIdOf(start), numPages, span);
+	m_spanCount.fetch_add(1, std::memory_order_relaxed);
+	m_capacity.fetch_add(numPages * PAGE_SIZE, std::memory_order_relaxed);
+	return span;
+}
+
+void Heap::releaseSpan(HeapSpan* span) {
+	m_spanMap.set(PageMap<HeapSpan>::pageIdOf(span->spanAddr), span->numPages, nullptr);
+	m_spanCount.fetch_sub(1, std::memory_order_relaxed);
+	m_capacity.fetch_sub(span->numPages * PAGE_SIZE, std::memory_order_relaxed);
+	m_pageCache->deallocateSpan(span->spanAddr, span->numPages);
+	delete span;
+}
+
+void Heap::linkSpan(HeapSpan* span) {
+	span->allPrev = nullptr;
+	span->allNext = m_allSpans;
+	if (m_allSpans) {
+		m_allSpans->allPrev = span;
+	}
+	m_allSpans = span;
+}
+
+void Heap::unlinkSpan(HeapSpan* span) {
+	if (span->allPrev) {
+		span->allPrev->allNext = span->allNext;
+	}
+	else {
+		m_allSpans = span->allNext;
+	}
+	if (span->allNext) {
+		span->allNext->allPrev = span->allPrev;
+	}
+}
+
+void Heap::pushSpan(HeapSpan*& list, HeapSpan* span) {
+	span->prev = nullptr;
+	span->next = list;
+	if (list) {
+		list->prev = span;
+	}
+	list = span;
+}
+
+void Heap::removeSpan(HeapSpan*& list, HeapSpan* span) {
+	if (span->prev) {
+		span->prev->next = span->next;
+	}
+	else {
+		list = span->next;
+	}
+	if (span->next) {
+		span->next->prev = span->prev;
+	}
+	span->prev = nullptr;
+	span->next = nullptr;
+}
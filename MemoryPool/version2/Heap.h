@@ -0,0 +1,103 @@
+#pragma once
+#include "Common.h"
+#include "PageMap.h"
+#include "SpinLock.h"
+#include <array>
+#include <atomic>
+#include <memory>
+
+class PageCache;
+class PageProvider;
+
+// 私有堆：有自己的大小类span链表和页映射，span从全局PageCache取，和主内存池共用向系统申请的内存
+// 不经过线程缓存，整个堆一把锁，可以在多个线程中使用
+// destroy()把堆中所有span整体还给PageCache，代价与span数成正比，不需要逐个释放对象
+// 适合插件等需要整体卸载的子系统：卸载时destroy()，忘记释放的对象也不会泄漏
+// 也可以指定页来源（见PageProvider.h），堆在其上建自己的PageCache，例如整个堆放在锁定的固定内存或大页中
+// 主内存池的块不能交给堆释放，反之亦然
+class Heap
+{
+public:
+	Heap();
+
+	//在provider上建立独立的PageCache，provider的生命周期要长于堆；析构时把空闲内存全部还给provider
+	explicit Heap(PageProvider& provider);
+
+	~Heap();
+
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+
+	//分配size字节，超过MAX_BYTES的单独占一个span，失败返回nullptr
+	void* allocate(size_t size);
+
+	//释放本堆分配的块，span中的块全部归还后span立即还给PageCache
+	void deallocate(void* ptr, size_t size);
+
+	//一次性释放堆中所有内存，之后堆为空，可以继续使用
+	//调用时不能有其他线程在使用本堆，之前分配的块全部失效
+	void destroy();
+
+	//块是否由本堆分配且尚未释放span
+	bool contains(const void* ptr) const { return m_spanMap.get(ptr) != nullptr; }
+
+	//当前持有的span数和字节数
+	size_t spanCount() const { return m_spanCount.load(std::memory_order_relaxed); }
+	size_t capacity() const { return m_capacity.load(std::memory_order_relaxed); }
+
+private:
+	//堆中的一个span，所有字段由堆的锁保护
+	struct HeapSpan
+	{
+		void* spanAddr;
+		size_t numPages;
+		size_t index;      //大小类下标，大块为LARGE_INDEX
+		size_t blockSize;
+		size_t blockCount;
+		size_t useCount;
+		void* freeList;    //span内已归还的空闲块链表
+		char* bumpCursor;  //从未分配过的区域的起点
+		HeapSpan* prev;    //部分空闲链表
+		HeapSpan* next;
+		HeapSpan* allPrev; //堆中所有span的链表，destroy()时遍历
+		HeapSpan* allNext;
+
+		bool hasFreeBlock() const { return useCount < blockCount; }
+	};
+
+	static constexpr size_t LARGE_INDEX = FREE_LIST_NUM;
+
+	//部分空闲链表表头按组延迟分配，堆不用为用不到的大小类占内存
+	static constexpr size_t CLASS_GROUP_SIZE = 512;
+	static constexpr size_t CLASS_GROUP_NUM = FREE_LIST_NUM / CLASS_GROUP_SIZE;
+
+	//大小类index的部分空闲链表表头，所在组不存在时创建，失败返回nullptr；调用方持有锁
+	HeapSpan** partialList(size_t index);
+
+	//从PageCache取numPages页建立span并登记到页映射，不需要持有锁
+	HeapSpan* allocateSpan(size_t numPages, size_t index, size_t blockSize);
+
+	//从页映射中移除并把页还给PageCache，调用方已把span从所有链表中摘下
+	void releaseSpan(HeapSpan* span);
+
+	void linkSpan(HeapSpan* span);
+	void unlinkSpan(HeapSpan* span);
+
+	static void pushSpan(HeapSpan*& list, HeapSpan* span);
+	static void removeSpan(HeapSpan*& list, HeapSpan* span);
+
+private:
+	//span的来源：全局PageCache，或建在指定页来源上的私有PageCache
+	PageCache* m_pageCache;
+	std::unique_ptr<PageCache> m_ownPageCache;
+
+	SpinLock m_lock;
+	std::array<HeapSpan**, CLASS_GROUP_NUM> m_partialGroups{};
+	HeapSpan* m_allSpans{ nullptr };
+
+	//页号到span的映射，释放时由地址找到span
+	PageMap<HeapSpan> m_spanMap;
+
+	std::atomic<size_t> m_spanCount{ 0 };
+	std::atomic<size_t> m_capacity{ 0 };
+};
@@ -0,0 +1,215 @@
+#include "Instrument.h"
+#include <atomic>
+#include <mutex>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+	//最高有效位的位置，value不能为0
+	size_t floorLog2(uint64_t value) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, value);
+		return index;
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t ns) {
+	constexpr uint64_t SUB_BUCKETS = uint64_t(1) << LATENCY_SUB_BUCKET_BITS;
+	constexpr uint64_t MAX_NS = (uint64_t(1) << LATENCY_MAX_LOG2) - 1;
+
+	if (ns < SUB_BUCKETS) {
+		return static_cast<size_t>(ns);
+	}
+	ns = std::min(ns, MAX_NS);
+
+	//前3位决定组内的线性位置
+	size_t msb = floorLog2(ns);
+	size_t sub = static_cast<size_t>((ns >> (msb - LATENCY_SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+	return ((msb - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS) + sub;
+}
+
+uint64_t LatencyHistogram::bucketLowerBound(size_t index) {
+	constexpr size_t SUB_BUCKETS = size_t(1) << LATENCY_SUB_BUCKET_BITS;
+
+	if (index < SUB_BUCKETS) {
+		return index;
+	}
+	size_t msb = (index >> LATENCY_SUB_BUCKET_BITS) + LATENCY_SUB_BUCKET_BITS - 1;
+	uint64_t sub = index & (SUB_BUCKETS - 1);
+	return (SUB_BUCKETS + sub) << (msb - LATENCY_SUB_BUCKET_BITS);
+}
+
+uint64_t LatencyHistogram::percentile(double p) const {
+	if (count == 0) {
+		return 0;
+	}
+	uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(count));
+	rank = std::max<uint64_t>(rank, 1);
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < LATENCY_BUCKET_NUM; ++i) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			return bucketLowerBound(i);
+		}
+	}
+	return bucketLowerBound(LATENCY_BUCKET_NUM - 1);
+}
+
+#ifdef MEMORYPOOL_INSTRUMENT
+
+namespace {
+	//单个线程的直方图，只有本线程写；其他线程汇总时用relaxed读
+	struct ThreadLatency
+	{
+		std::array<std::atomic<uint64_t>, LATENCY_TIER_NUM> counts{};
+		std::array<std::atomic<uint64_t>, LATENCY_TIER_NUM> totalNs{};
+		std::array<std::array<std::atomic<uint64_t>, LATENCY_BUCKET_NUM>, LATENCY_TIER_NUM> buckets{};
+
+		ThreadLatency* prev{ nullptr };
+		ThreadLatency* next{ nullptr };
+
+		ThreadLatency();
+		~ThreadLatency();
+	};
+
+	//所有存活线程的直方图，以及已退出线程合并后的结果
+	//清零时不去改其他线程的计数，而是记下当时的总和作为基线
+	struct LatencyRegistry
+	{
+		std::mutex mutex;
+		ThreadLatency* threads{ nullptr };
+		LatencySnapshot retired;
+		LatencySnapshot baseline;
+	};
+
+	LatencyRegistry& registry() {
+		//故意不析构，线程退出晚于静态对象析构时仍然可用
+		static LatencyRegistry* instance = new LatencyRegistry;
+		return *instance;
+	}
+
+	void addTo(LatencySnapshot& snapshot, const ThreadLatency& thread) {
+		for (size_t t = 0; t < LATENCY_TIER_NUM; ++t) {
+			LatencyHistogram& hist = snapshot.tiers[t];
+			hist.count += thread.counts[t].load(std::memory_order_relaxed);
+			hist.totalNs += thread.totalNs[t].load(std::memory_order_relaxed);
+			for (size_t b = 0; b < LATENCY_BUCKET_NUM; ++b) {
+				hist.buckets[b] += thread.buckets[t][b].load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	//调用方持有registry的锁
+	LatencySnapshot totalLocked(LatencyRegistry& reg) {
+		LatencySnapshot total = reg.retired;
+		for (ThreadLatency* thread = reg.threads; thread; thread = thread->next) {
+			addTo(total, *thread);
+		}
+		return total;
+	}
+
+	ThreadLatency::ThreadLatency() {
+		LatencyRegistry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		next = reg.threads;
+		if (next) {
+			next->prev = this;
+		}
+		reg.threads = this;
+	}
+
+	ThreadLatency::~ThreadLatency() {
+		LatencyRegistry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		addTo(reg.retired, *this);
+		if (prev) {
+			prev->next = next;
+		}
+		else {
+			reg.threads = next;
+		}
+		if (next) {
+			next->prev = prev;
+		}
+	}
+
+	//线程退出时ThreadCache的析构可能晚于本线程的统计对象，之后的记录直接丢弃
+	thread_local ThreadLatency* t_latency = nullptr;
+	thread_local bool t_latencyExited = false;
+
+	struct ThreadLatencyOwner
+	{
+		~ThreadLatencyOwner() {
+			delete t_latency;
+			t_latency = nullptr;
+			t_latencyExited = true;
+		}
+	};
+	thread_local ThreadLatencyOwner t_latencyOwner;
+
+	ThreadLatency* currentThreadLatency() {
+		if (!t_latency && !t_latencyExited) {
+			//访问owner保证它被构造，线程退出时才会析构
+			(void)&t_latencyOwner;
+			t_latency = new ThreadLatency;
+		}
+		return t_latency;
+	}
+
+	void increase(std::atomic<uint64_t>& counter, uint64_t value) {
+		//只有本线程写，不需要原子读改写
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+}
+
+void recordLatency(LatencyTier tier, uint64_t ns) {
+	ThreadLatency* latency = currentThreadLatency();
+	if (!latency) {
+		return;
+	}
+
+	size_t t = static_cast<size_t>(tier);
+	increase(latency->buckets[t][LatencyHistogram::bucketIndex(ns)], 1);
+	increase(latency->counts[t], 1);
+	increase(latency->totalNs[t], ns);
+}
+
+LatencySnapshot getLatencySnapshot() {
+	LatencyRegistry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+
+	LatencySnapshot snapshot = totalLocked(reg);
+	for (size_t t = 0; t < LATENCY_TIER_NUM; ++t) {
+		LatencyHistogram& hist = snapshot.tiers[t];
+		const LatencyHistogram& base = reg.baseline.tiers[t];
+		hist.count -= base.count;
+		hist.totalNs -= base.totalNs;
+		for (size_t b = 0; b < LATENCY_BUCKET_NUM; ++b) {
+			hist.buckets[b] -= base.buckets[b];
+		}
+	}
+	return snapshot;
+}
+
+void resetLatencyStats() {
+	LatencyRegistry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	reg.baseline = totalLocked(reg);
+}
+
+#else
+
+LatencySnapshot getLatencySnapshot() {
+	return LatencySnapshot{};
+}
+
+void resetLatencyStats() {
+}
+
+#endif
@@ -0,0 +1,109 @@
+#pragma once
+#include "Common.h"
+#include <array>
+#include <cstdint>
+
+// 慢路径延迟统计和跟踪点
+// 默认不编译进来，定义 MEMORYPOOL_INSTRUMENT 后才生效：
+//   1. 每个线程为每一层慢路径记录对数-线性延迟直方图，可以随时汇总快照或清零
+//   2. 系统有 <sys/sdt.h> 时同时生成 USDT 探针（provider为memorypool），可用 perf/bpftrace 挂载
+// 未定义时下面的宏展开为空，热路径上没有任何开销；查询接口仍然可用，只是全为0
+
+//被统计的慢路径
+enum class LatencyTier
+{
+	FetchFromCentralCache,  //ThreadCache未命中，向CentralCache批量取块
+	FetchFromPageCache,     //CentralCache没有空闲span，向PageCache申请并切分
+	SystemAlloc,            //PageCache向操作系统申请内存
+	ReturnToCentralCache,   //ThreadCache超过阈值，把块还给CentralCache
+	ReturnSpanToPageCache,  //span完全空闲，还给PageCache
+	Count
+};
+
+constexpr size_t LATENCY_TIER_NUM = static_cast<size_t>(LatencyTier::Count);
+
+//每个2的幂区间再线性分成8份，最大统计到2^40纳秒
+constexpr size_t LATENCY_SUB_BUCKET_BITS = 3;
+constexpr size_t LATENCY_MAX_LOG2 = 40;
+constexpr size_t LATENCY_BUCKET_NUM = (LATENCY_MAX_LOG2 - 2) << LATENCY_SUB_BUCKET_BITS;
+
+//单个慢路径的延迟直方图（单位：纳秒）
+struct LatencyHistogram
+{
+	uint64_t count{ 0 };
+	uint64_t totalNs{ 0 };
+	std::array<uint64_t, LATENCY_BUCKET_NUM> buckets{};
+
+	//纳秒数对应的桶下标
+	static size_t bucketIndex(uint64_t ns);
+
+	//桶的下界（纳秒）
+	static uint64_t bucketLowerBound(size_t index);
+
+	//p取0~100，返回该分位数所在桶的下界
+	uint64_t percentile(double p) const;
+};
+
+struct LatencySnapshot
+{
+	std::array<LatencyHistogram, LATENCY_TIER_NUM> tiers;
+
+	const LatencyHistogram& operator[](LatencyTier tier) const {
+		return tiers[static_cast<size_t>(tier)];
+	}
+};
+
+//汇总所有线程（包括已退出线程）自上次清零以来的直方图
+LatencySnapshot getLatencySnapshot();
+
+//清零，之后的快照只包含清零以后的记录
+void resetLatencyStats();
+
+#ifdef MEMORYPOOL_INSTRUMENT
+#include <chrono>
+
+//记录一次延迟，只写本线程的直方图
+void recordLatency(LatencyTier tier, uint64_t ns);
+
+//作用域计时器，析构时记录经过的时间
+class LatencyScope
+{
+public:
+	explicit LatencyScope(LatencyTier tier)
+		: m_tier(tier), m_start(std::chrono::steady_clock::now()) {}
+
+	~LatencyScope() {
+		auto elapsed = std::chrono::steady_clock::now() - m_start;
+		recordLatency(m_tier, static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+	}
+
+	LatencyScope(const LatencyScope&) = delete;
+	LatencyScope& operator=(const LatencyScope&) = delete;
+
+private:
+	LatencyTier m_tier;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+#define MP_LATENCY_CONCAT_INNER(a, b) a##b
+#define MP_LATENCY_CONCAT(a, b) MP_LATENCY_CONCAT_INNER(a, b)
+#define MP_LATENCY_SCOPE(tier) LatencyScope MP_LATENCY_CONCAT(mpLatencyScope_, __LINE__)(tier)
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define MP_TRACE(name, a, b) DTRACE_PROBE2(memorypool, name, a, b)
+#endif
+#endif
+
+#ifndef MP_TRACE
+#define MP_TRACE(name, a, b) ((void)0)
+#endif
+
+#else
+
+#define MP_LATENCY_SCOPE(tier) ((void)0)
+#define MP_TRACE(name, a, b) ((void)0)
+
+#endif
@@ -0,0 +1,115 @@
+#include "LargeCache.h"
+#include "PageCache.h"
+#include "Instrument.h"
+#include "Tuning.h"
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+LargeObjectCache& LargeObjectCache::getInstance() {
+	static LargeObjectCache instance;
+	return instance;
+}
+
+LargeCpuCache& LargeObjectCache::currentCpuCache() {
+#ifdef _WIN32
+	size_t cpu = GetCurrentProcessorNumber();
+#elif defined(__linux__)
+	//sched_getcpu走vDSO，不进内核
+	int result = sched_getcpu();
+	size_t cpu = result < 0 ? 0 : static_cast<size_t>(result);
+#else
+	//拿不到CPU编号时按线程固定分配，和PageCache的分片一样
+	static std::atomic<size_t> nextCpu{ 0 };
+	thread_local size_t cpu = nextCpu.fetch_add(1, std::memory_order_relaxed);
+#endif
+	return m_cpuCaches[cpu % LARGE_CACHE_CPU_NUM];
+}
+
+void* LargeObjectCache::allocate(size_t size) {
+	assert(size > MAX_BYTES && size <= LARGE_MAX_BYTES);
+	size_t index = LargeSizeClass::getIndex(size);
+	size_t bytes = LargeSizeClass::getBytes(index);
+
+	LargeCpuCache& cache = currentCpuCache();
+	cache.lock.lock();
+	void* span = cache.spans[index];
+	if (span) {
+		cache.spans[index] = *(reinterpret_cast<void**>(span));
+		cache.cachedBytes.store(cache.cachedBytes.load(std::memory_order_relaxed) - bytes, std::memory_order_relaxed);
+		cache.lock.unlock();
+		return span;
+	}
+	cache.lock.unlock();
+
+	//本CPU没有缓存，从PageCache取整块span
+	MP_TRACE(large_cache_miss, index, bytes);
+	return PageCache::getInstance().allocateSpan(bytes / PAGE_SIZE);
+}
+
+void LargeObjectCache::deallocate(void* ptr, size_t size) {
+	assert(size > MAX_BYTES && size <= LARGE_MAX_BYTES);
+	size_t index = LargeSizeClass::getIndex(size);
+	size_t bytes = LargeSizeClass::getBytes(index);
+
+	//超过软上限时不再缓存，直接还给PageCache，由它归还给系统
+	PageCache& pageCache = PageCache::getInstance();
+	if (pageCache.isOverSoftLimit()) {
+		pageCache.deallocateSpan(ptr, bytes / PAGE_SIZE);
+		return;
+	}
+
+	LargeCpuCache& cache = currentCpuCache();
+	cache.lock.lock();
+	size_t cachedBytes = cache.cachedBytes.load(std::memory_order_relaxed);
+	if (cachedBytes + bytes <= g_tuning.largeCacheCpuBytes.load(std::memory_order_relaxed)) {
+		*(reinterpret_cast<void**>(ptr)) = cache.spans[index];
+		cache.spans[index] = ptr;
+		cache.cachedBytes.store(cachedBytes + bytes, std::memory_order_relaxed);
+		cache.lock.unlock();
+		return;
+	}
+	cache.lock.unlock();
+
+	//本CPU的缓存满了，直接还给PageCache
+	pageCache.deallocateSpan(ptr, bytes / PAGE_SIZE);
+}
+
+size_t LargeObjectCache::flush() {
+	size_t releasedBytes = 0;
+	for (LargeCpuCache& cache : m_cpuCaches) {
+		std::array<void*, LARGE_CLASS_NUM> spans;
+		cache.lock.lock();
+		spans = cache.spans;
+		cache.spans.fill(nullptr);
+		releasedBytes += cache.cachedBytes.load(std::memory_order_relaxed);
+		cache.cachedBytes.store(0, std::memory_order_relaxed);
+		cache.lock.unlock();
+
+		for (size_t index = 0; index < LARGE_CLASS_NUM; ++index) {
+			void* span = spans[index];
+			while (span) {
+				void* next = *(reinterpret_cast<void**>(span));
+				PageCache::getInstance().deallocateSpan(span, LargeSizeClass::getBytes(index) / PAGE_SIZE);
+				span = next;
+			}
+		}
+	}
+	return releasedBytes;
+}
+
+size_t LargeObjectCache::getCachedBytes() const {
+	size_t cachedBytes = 0;
+	for (const LargeCpuCache& cache : m_cpuCaches) {
+		cachedBytes += cache.cachedBytes.load(std::memory_order_relaxed);
+	}
+	return cachedBytes;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "Common.h"
+#include "SpinLock.h"
+#include <array>
+#include <atomic>
+
+// 大对象缓存：(MAX_BYTES, LARGE_MAX_BYTES]的分配按LargeSizeClass取整后整块占一个span
+// 释放的span放进当前CPU的缓存，同一CPU上再次分配同一大小类时直接取回，
+// 热循环中反复分配释放的大缓冲区不用再进PageCache的全局锁，也不会落到malloc的mmap阈值上
+// 每个CPU缓存一把自旋锁，线程被迁移到其他CPU只会换一个缓存，结果仍然正确
+// 超过软上限时释放的span不再缓存，PageCache向系统申请时发现接近软上限会先把缓存整体归还
+
+//单个CPU的缓存，缓存的span用首个字串成栈
+struct alignas(CACHE_LINE_SIZE) LargeCpuCache
+{
+	SpinLock lock;
+	std::array<void*, LARGE_CLASS_NUM> spans{};
+	std::atomic<size_t> cachedBytes{ 0 }; //只在持锁时写，读时不加锁
+};
+
+class LargeObjectCache
+{
+public:
+	static LargeObjectCache& getInstance();
+
+	//size在(MAX_BYTES, LARGE_MAX_BYTES]之间，失败返回nullptr
+	void* allocate(size_t size);
+
+	//size必须和分配时相同
+	void deallocate(void* ptr, size_t size);
+
+	//把所有CPU缓存的span还给PageCache，返回归还的字节数
+	size_t flush();
+
+	//所有CPU缓存中的字节数（近似值）
+	size_t getCachedBytes() const;
+
+private:
+	LargeObjectCache() = default;
+
+	//当前线程所在CPU的缓存
+	LargeCpuCache& currentCpuCache();
+
+private:
+	std::array<LargeCpuCache, LARGE_CACHE_CPU_NUM> m_cpuCaches;
+};
@@ -1,15 +1,217 @@
 #pragma once
 #include "ThreadCache.h"
+#include "Arena.h"
+#include "ObjectPool.h"
+#include "PageCache.h"
+#include "Instrument.h"
+#include "CentralCache.h"
+#include "TraceRecorder.h"
+#include "SharedMemoryPool.h"
+#include "Epoch.h"
+#include "Heap.h"
+#include "LargeCache.h"
+//预热配置中的一项：大小为size的内存块预留count个
+struct PrewarmEntry
+{
+	size_t size;
+	size_t count;
+};
+
 class MemoryPool
 {
 public:
+	//区域分配器，见Arena.h
+	using Arena = ::Arena;
+
+	//按类型分配，见ObjectPool.h
+	template<typename T>
+	using ObjectPool = ::ObjectPool<T>;
+
+	//纪元回收的临界区，见Epoch.h
+	using EpochGuard = ::EpochGuard;
+
+	//可整体销毁的私有堆，见Heap.h
+	using Heap = ::Heap;
+
 	static void* allocate(size_t size)
 	{
-		return ThreadCache::getInstance()->allocate(size);
+		void* ptr = ThreadCache::getInstance()->allocate(size);
+		MP_RECORD_TRACE(TraceOp::Allocate, ptr, size);
+		return ptr;
 	}
 
 	static void deallocate(void* ptr, size_t size)
 	{
+		MP_RECORD_TRACE(TraceOp::Deallocate, ptr, size);
 		ThreadCache::getInstance()->deallocate(ptr, size);
 	}
+
+	//退休一个从无锁数据结构中摘下的块，所有线程离开当前临界区后才真正释放
+	static void retire(void* ptr, size_t size)
+	{
+		EpochReclaimer::retire(ptr, size);
+	}
+
+	//等待宽限期过去，释放本线程之前退休的所有块
+	static void synchronizeRetired()
+	{
+		EpochReclaimer::synchronize();
+	}
+
+	//按提示分配：Cold/LongLived的块来自单独的span，不经过线程缓存，每次分配要加大小类的锁
+	static void* allocate(size_t size, AllocHint hint)
+	{
+		if (hint == AllocHint::Hot || size > MAX_BYTES) {
+			return allocate(size);
+		}
+		void* ptr = nullptr;
+		void* end = nullptr;
+		CentralCache::getInstance().fetchRange(SizeClass::getFreeListIndex(size == 0 ? ALIGNMENT : size), 1,
+			ptr, end, nullptr, hint);
+		MP_RECORD_TRACE(TraceOp::Allocate, ptr, size);
+		return ptr;
+	}
+
+	//释放按提示分配的块，直接还给所属span，不进线程缓存，免得被热数据的分配取走
+	//用不带提示的deallocate释放也是正确的，只是块会进入线程缓存被热数据复用
+	static void deallocate(void* ptr, size_t size, AllocHint hint)
+	{
+		if (hint == AllocHint::Hot || size > MAX_BYTES) {
+			deallocate(ptr, size);
+			return;
+		}
+		MP_RECORD_TRACE(TraceOp::Deallocate, ptr, size);
+		CentralCache::getInstance().returnRange(ptr, 1, SizeClass::getFreeListIndex(size == 0 ? ALIGNMENT : size));
+	}
+
+	//批量申请n个size大小的内存块，返回实际申请到的个数
+	static size_t allocateBatch(size_t size, size_t n, void** out)
+	{
+		size_t count = ThreadCache::getInstance()->allocateBatch(size, n, out);
+#ifdef MEMORYPOOL_TRACE
+		for (size_t i = 0; i < count; ++i) {
+			MP_RECORD_TRACE(TraceOp::Allocate, out[i], size);
+		}
+#endif
+		return count;
+	}
+
+	//批量释放n个size大小的内存块
+	static void deallocateBatch(void** ptrs, size_t n, size_t size)
+	{
+#ifdef MEMORYPOOL_TRACE
+		for (size_t i = 0; i < n; ++i) {
+			MP_RECORD_TRACE(TraceOp::Deallocate, ptrs[i], size);
+		}
+#endif
+		ThreadCache::getInstance()->deallocateBatch(ptrs, n, size);
+	}
+
+	//启动时预留count个size大小的内存块，内存预先缺页，之后的分配不用再走到系统调用
+	//中心缓存对所有线程有效，线程缓存只填调用线程的，需要时在各工作线程上分别调用
+	//返回不用再向系统申请就能分配的块数
+	static size_t reserve(size_t size, size_t count)
+	{
+		return ThreadCache::getInstance()->reserve(size, count);
+	}
+
+	//按配置逐项预留，返回各项就绪块数之和
+	static size_t prewarm(const std::vector<PrewarmEntry>& profile)
+	{
+		size_t readyNum = 0;
+		for (const PrewarmEntry& entry : profile) {
+			readyNum += reserve(entry.size, entry.count);
+		}
+		return readyNum;
+	}
+
+	//本线程开启/关闭异步释放：线程缓存溢出时把多出来的块交给后台回收线程归还，
+	//释放路径上不再加锁或进入系统调用，适合对延迟敏感的线程
+	static void setOffloadFree(bool enable)
+	{
+		ThreadCache::getInstance()->setOffloadFree(enable);
+	}
+
+	//已交给回收线程、还没归还的块数
+	static size_t getOffloadBacklog()
+	{
+		return ThreadCache::getOffloadBacklog();
+	}
+
+	//按名字读写运行时参数，见Tuning.h；启动时已从环境变量MEMORYPOOL_CONF读取初值
+	static bool setTuning(const char* name, size_t value)
+	{
+		return ::setTuning(name, value);
+	}
+
+	static bool getTuning(const char* name, size_t& value)
+	{
+		return ::getTuning(name, value);
+	}
+
+	static std::vector<const char*> getTuningNames()
+	{
+		return ::getTuningNames();
+	}
+
+	//设置内存池从系统申请内存的软/硬上限（字节，0表示不限制）
+	static void setMemoryLimit(size_t softLimit, size_t hardLimit)
+	{
+		PageCache::getInstance().setMemoryLimit(softLimit, hardLimit);
+	}
+
+	//超过硬上限时的回调，返回true表示已释放内存可以重试
+	static void setOutOfMemoryHandler(OutOfMemoryHandler handler)
+	{
+		PageCache::getInstance().setOutOfMemoryHandler(handler);
+	}
+
+	//清空本线程缓存、已退出线程积压的远程释放块和大对象缓存，并把所有空闲span归还给操作系统，返回归还的字节数
+	static size_t releaseFreeMemory()
+	{
+		ThreadCache::getInstance()->flush();
+		ThreadCache::drainIdleRemoteQueues();
+		LargeObjectCache::getInstance().flush();
+		return PageCache::getInstance().releaseFreeSpans();
+	}
+
+	//内存池当前从系统申请的字节数
+	static size_t getSystemBytes()
+	{
+		return PageCache::getInstance().getSystemBytes();
+	}
+
+	//各层慢路径的延迟直方图快照，需要定义MEMORYPOOL_INSTRUMENT编译，否则全为0
+	static LatencySnapshot getLatencySnapshot()
+	{
+		return ::getLatencySnapshot();
+	}
+
+	static void resetLatencyStats()
+	{
+		::resetLatencyStats();
+	}
+
+	//CentralCache中发生过锁竞争的大小类，按等锁时间从高到低排列
+	static std::vector<CentralLockStats> getCentralLockStats()
+	{
+		return CentralCache::getInstance().getContendedClasses();
+	}
+
+	static void resetCentralLockStats()
+	{
+		CentralCache::getInstance().resetLockStats();
+	}
+
+	//开始把每次分配/释放记录到轨迹文件，需要定义MEMORYPOOL_TRACE编译，否则返回false
+	static bool startTrace(const char* path)
+	{
+		return ::startTrace(path);
+	}
+
+	//停止记录，返回写入和丢弃的记录数
+	static TraceStats stopTrace()
+	{
+		return ::stopTrace();
+	}
 };
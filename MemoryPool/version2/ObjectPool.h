@@ -0,0 +1,137 @@
+#pragma once
+#include "Common.h"
+#include "ThreadCache.h"
+#include "TraceRecorder.h"
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+
+// 按类型使用内存池：大小类下标在编译期算好，分配/释放直接走ThreadCache的内联快路径
+//   auto p = make_pooled<Foo>(args...);         // std::unique_ptr<Foo, ObjectPool<Foo>::Deleter>
+//   auto s = make_pooled_shared<Foo>(args...);  // 控制块和对象在同一个内存块中
+// 对齐要求大于8的类型把块大小向上取整到对齐的倍数，span按页对齐，因此块也满足对齐
+
+//大小为Size、对齐为Align的对象所在的大小类
+template<size_t Size, size_t Align>
+struct PooledClass
+{
+	static_assert(Align <= PAGE_SIZE, "pooled objects cannot be aligned beyond a page");
+
+	static constexpr size_t BLOCK_SIZE = SizeClass::roundUp((Size + Align - 1) / Align * Align);
+	static constexpr size_t INDEX = SizeClass::getFreeListIndex(BLOCK_SIZE);
+	static constexpr bool IS_POOLED = BLOCK_SIZE <= MAX_BYTES;
+
+	static_assert(IS_POOLED || Align <= alignof(std::max_align_t), "large over-aligned objects are not supported");
+
+	static void* allocate() {
+		if (!IS_POOLED) {
+			return ThreadCache::getInstance()->allocate(Size);
+		}
+		void* ptr = ThreadCache::getInstance()->allocateByIndex(INDEX);
+		MP_RECORD_TRACE(TraceOp::Allocate, ptr, BLOCK_SIZE);
+		return ptr;
+	}
+
+	static void deallocate(void* ptr) {
+		if (!IS_POOLED) {
+			ThreadCache::getInstance()->deallocate(ptr, Size);
+			return;
+		}
+		MP_RECORD_TRACE(TraceOp::Deallocate, ptr, BLOCK_SIZE);
+		ThreadCache::getInstance()->deallocateByIndex(ptr, INDEX);
+	}
+};
+
+template<typename T>
+class ObjectPool
+{
+public:
+	using Class = PooledClass<sizeof(T), alignof(T)>;
+
+	//编译期确定的大小类下标
+	static constexpr size_t INDEX = Class::INDEX;
+
+	//只分配不构造，失败返回nullptr
+	static void* allocate() { return Class::allocate(); }
+
+	static void deallocate(void* ptr) { Class::deallocate(ptr); }
+
+	//分配并构造，分配失败抛出std::bad_alloc，构造抛出异常时归还内存
+	template<typename... Args>
+	static T* create(Args&&... args) {
+		void* mem = allocate();
+		if (!mem) {
+			throw std::bad_alloc();
+		}
+		try {
+			return new(mem) T(std::forward<Args>(args)...);
+		}
+		catch (...) {
+			deallocate(mem);
+			throw;
+		}
+	}
+
+	static void destroy(T* ptr) {
+		if (ptr) {
+			ptr->~T();
+			deallocate(ptr);
+		}
+	}
+
+	//无状态删除器，unique_ptr不因此变大
+	struct Deleter
+	{
+		void operator()(T* ptr) const { ObjectPool<T>::destroy(ptr); }
+	};
+
+	using UniquePtr = std::unique_ptr<T, Deleter>;
+};
+
+template<typename T, typename... Args>
+typename ObjectPool<T>::UniquePtr make_pooled(Args&&... args) {
+	return typename ObjectPool<T>::UniquePtr(ObjectPool<T>::create(std::forward<Args>(args)...));
+}
+
+//符合标准库要求的分配器，单个对象走编译期确定的大小类，数组退回按大小分配
+//std::allocate_shared会把它rebind到控制块类型，控制块和对象因此在同一个池化块中
+template<typename T>
+class PoolAllocator
+{
+public:
+	using value_type = T;
+
+	PoolAllocator() noexcept = default;
+
+	template<typename U>
+	PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+	T* allocate(size_t n) {
+		void* ptr = n == 1 ? ObjectPool<T>::allocate() : ThreadCache::getInstance()->allocate(n * sizeof(T));
+		if (!ptr) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(ptr);
+	}
+
+	void deallocate(T* ptr, size_t n) noexcept {
+		if (n == 1) {
+			ObjectPool<T>::deallocate(ptr);
+		}
+		else {
+			ThreadCache::getInstance()->deallocate(ptr, n * sizeof(T));
+		}
+	}
+
+	template<typename U>
+	bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+
+	template<typename U>
+	bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+template<typename T, typename... Args>
+std::shared_ptr<T> make_pooled_shared(Args&&... args) {
+	return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
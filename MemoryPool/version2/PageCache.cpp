@@ -1,12 +1,128 @@
 #include "PageCache.h"
+#include "LargeCache.h"
+#include "Instrument.h"
+#include "Tuning.h"
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 PageCache& PageCache::getInstance() {
 	static PageCache instance;
 	return instance;
 }
 
-void* PageCache::allocateSpan(size_t pageNum) {
+void* PageCache::operator new(size_t size) {
+	//Ƭж룬C++14new֤ʵʱԼ
+#ifdef _WIN32
+	void* ptr = _aligned_malloc(size, alignof(PageCache));
+#else
+	void* ptr = nullptr;
+	if (posix_memalign(&ptr, alignof(PageCache), size) != 0) {
+		ptr = nullptr;
+	}
+#endif
+	if (!ptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void PageCache::operator delete(void* ptr) {
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+PageShard& PageCache::currentShard() {
+	//߳ηֵƬ֮һֱʹͬһ
+	static std::atomic<size_t> nextShard{ 0 };
+	thread_local size_t shardIndex = nextShard.fetch_add(1, std::memory_order_relaxed) % PAGE_SHARD_NUM;
+	return m_shards[shardIndex];
+}
+
+void* PageCache::allocateSpan(size_t pageNum, AllocHint hint) {
+	if (pageNum > SMALL_SPAN_MAX_PAGES) {
+		return allocateSpanGlobal(pageNum);
+	}
+
+	//Сspanȴӱ̵߳ķƬȡȫ
+	PageShard& shard = hint == AllocHint::Hot ? currentShard() : m_coldShard;
+	shard.lock.lock();
+	void* span = shard.spans[pageNum];
+	if (span) {
+		shard.spans[pageNum] = *(reinterpret_cast<void**>(span));
+		shard.cachedPages -= pageNum;
+		shard.lock.unlock();
+		return span;
+	}
+	shard.lock.unlock();
+
+	return refillShard(shard, pageNum);
+}
+
+void* PageCache::refillShard(PageShard& shard, size_t pageNum) {
+	size_t count = std::max<size_t>(1, PAGE_SHARD_REFILL_PAGES / pageNum);
+	void* start = allocateSpanGlobal(pageNum * count);
+	if (!start && count > 1) {
+		//ǽӽڴޣ˻ֻȡһ
+		count = 1;
+		start = allocateSpanGlobal(pageNum);
+	}
+	if (!start || count == 1) {
+		return start;
+	}
+
+	//гcountspanֱǼǣ֮ÿܵ黹ͺϲ
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pageAddrToSpanMap[start]->pageNum = pageNum;
+		for (size_t i = 1; i < count; ++i) {
+			Span* span = new Span;
+			span->pageAddr = static_cast<char*>(start) + i * pageNum * PAGE_SIZE;
+			span->pageNum = pageNum;
+			span->next = nullptr;
+			span->decommitted = false;
+			m_pageAddrToSpanMap[span->pageAddr] = span;
+		}
+	}
+
+	//һأŽƬ
+	shard.lock.lock();
+	for (size_t i = 1; i < count; ++i) {
+		void* span = static_cast<char*>(start) + i * pageNum * PAGE_SIZE;
+		*(reinterpret_cast<void**>(span)) = shard.spans[pageNum];
+		shard.spans[pageNum] = span;
+	}
+	shard.cachedPages += (count - 1) * pageNum;
+	shard.lock.unlock();
+	return start;
+}
+
+void PageCache::flushShard(PageShard& shard) {
+	std::array<void*, SMALL_SPAN_MAX_PAGES + 1> spans;
+	shard.lock.lock();
+	spans = shard.spans;
+	shard.spans.fill(nullptr);
+	shard.cachedPages = 0;
+	shard.lock.unlock();
+
 	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t pageNum = 1; pageNum <= SMALL_SPAN_MAX_PAGES; ++pageNum) {
+		void* span = spans[pageNum];
+		while (span) {
+			void* next = *(reinterpret_cast<void**>(span));
+			deallocateSpanLocked(span, pageNum);
+			span = next;
+		}
+	}
+}
+
+void* PageCache::allocateSpanGlobal(size_t pageNum) {
+	std::unique_lock<std::mutex> lock(m_mutex);
 
 	// ҺʵĿspan
 	// lower_boundصһڵnumPagesԪصĵ
@@ -29,24 +145,47 @@ void* PageCache::allocateSpan(size_t pageNum) {
 			newSpan->pageAddr = static_cast<char*>(span->pageAddr) + pageNum * PAGE_SIZE;
 			newSpan->pageNum = span->pageNum - pageNum;
 			newSpan->next = nullptr;
+			newSpan->decommitted = span->decommitted;
 
 			// ַŻؿSpan*бͷ
 			auto& spanList = m_freeSpansMap[newSpan->pageNum];
 			newSpan->next = spanList;
 			spanList = newSpan;
+			//ʣಿҲҪǼǣͷǰһspanʱϲ
+			m_pageAddrToSpanMap[newSpan->pageAddr] = newSpan;
 
 			//ԭspanҳΪһڴҳһµspan
 			span->pageNum = pageNum;
 		}
 		// ¼spanϢڻ
 		m_pageAddrToSpanMap[span->pageAddr] = span;
-		return span->pageAddr;
+		if (!span->decommitted) {
+			return span->pageAddr;
+		}
+
+		//ҳѶspanҪռöȺύʱܻڴ棬ܳ
+		span->decommitted = false;
+		void* ptr = span->pageAddr;
+		lock.unlock();
+		return recommitSpan(ptr, pageNum) ? ptr : nullptr;
 	}
 	//ûкʵspanϵͳڴ,õһڴ
+	//޺ϵͳöҪصҲٴͷڴ
+	lock.unlock();
+	size_t bytes = pageNum * PAGE_SIZE;
+	if (!reserveSystemBytes(bytes)) {
+		return nullptr; //ڴ
+	}
 	void* memory = systemAlloc(pageNum);
 	if(!memory) {
+		m_systemBytes.fetch_sub(bytes, std::memory_order_relaxed);
+		//ҳԴڴʱѻĿspanϲҪҳһ
+		if (releaseFreeSpans() > 0) {
+			return allocateSpanGlobal(pageNum);
+		}
 		return nullptr; //ϵͳڴʧ
 	}
+	lock.lock();
 
 	//һSpanеڴҳ
 	//µspan
@@ -54,6 +193,7 @@ void* PageCache::allocateSpan(size_t pageNum) {
 	memNewSpan->pageAddr = memory;
 	memNewSpan->pageNum = pageNum;
 	memNewSpan->next = nullptr;
+	memNewSpan->decommitted = false;
 
 	// ¼spanϢڻ
 	m_pageAddrToSpanMap[memNewSpan->pageAddr] = memNewSpan;
@@ -61,37 +201,259 @@ void* PageCache::allocateSpan(size_t pageNum) {
 }
 
 
-void* PageCache::systemAlloc(size_t numPages) {
-	size_t size = numPages * PAGE_SIZE;
-	void* ptr = malloc(size);
+void* PageCache::systemAlloc(size_t numPages, bool populate) {
+	MP_LATENCY_SCOPE(LatencyTier::SystemAlloc);
+	//spanҪҳ룬CentralCacheҳҵڴspanԲmallocҳԴ֤ҳ
+	void* ptr = m_provider->allocate(numPages);
+	if (ptr && populate) {
+		m_provider->commit(ptr, numPages);
+	}
+	MP_TRACE(system_alloc, numPages, ptr);
 	return ptr;
 }
 
+void PageCache::systemFree(void* ptr, size_t numPages) {
+	m_provider->release(ptr, numPages);
+	m_systemBytes.fetch_sub(numPages * PAGE_SIZE, std::memory_order_relaxed);
+}
+
+void PageCache::setMemoryLimit(size_t softLimit, size_t hardLimit) {
+	m_softLimit.store(softLimit, std::memory_order_relaxed);
+	m_hardLimit.store(hardLimit, std::memory_order_relaxed);
+}
+
+void PageCache::setOutOfMemoryHandler(OutOfMemoryHandler handler) {
+	m_outOfMemoryHandler.store(handler, std::memory_order_relaxed);
+}
+
+bool PageCache::reserveSystemBytes(size_t bytes) {
+	//صԵĴصһֱtrueȴͷŲڴ
+	constexpr int MAX_HANDLER_RETRY = 3;
+	int retry = 0;
+
+	size_t used = m_systemBytes.load(std::memory_order_relaxed);
+	while (true) {
+		size_t softLimit = m_softLimit.load(std::memory_order_relaxed);
+		size_t hardLimit = m_hardLimit.load(std::memory_order_relaxed);
+
+		//ӽޣȶspanҳ֪ͨ߳ջ
+		//󻺴spanȡȫʵȻһflushٽdeallocateSpanﲻܳm_mutex
+		if (softLimit && used + bytes > softLimit) {
+			m_pressureEpoch.fetch_add(1, std::memory_order_relaxed);
+			if (this == &getInstance()) {
+				LargeObjectCache::getInstance().flush();
+			}
+			trimFreeSpans();
+			used = m_systemBytes.load(std::memory_order_relaxed);
+		}
+
+		if (hardLimit && used + bytes > hardLimit) {
+			OutOfMemoryHandler handler = m_outOfMemoryHandler.load(std::memory_order_relaxed);
+			if (handler && retry < MAX_HANDLER_RETRY && handler(bytes)) {
+				++retry;
+				used = m_systemBytes.load(std::memory_order_relaxed);
+				continue;
+			}
+			return false;
+		}
+
+		//CASռöȣʱһԽӲ
+		if (m_systemBytes.compare_exchange_weak(used, used + bytes, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+}
+
+size_t PageCache::releaseFreeSpans() {
+	//ƬлspanȻȫ֣ȫֿspanһͷ
+	for (auto& shard : m_shards) {
+		flushShard(shard);
+	}
+	flushShard(m_coldShard);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	size_t releasedBytes = 0;
+	for (auto& entry : m_freeSpansMap) {
+		Span* span = entry.second;
+		while (span) {
+			Span* next = span->next;
+			releasedBytes += span->pageNum * PAGE_SIZE;
+			releaseSpanLocked(span);
+			span = next;
+		}
+	}
+	m_freeSpansMap.clear();
+	return releasedBytes;
+}
+
+bool PageCache::reserveSpans(size_t spanPages, size_t spanNum) {
+	//СspanɷƬȫȡȡһҲܴԤڴг
+	size_t pageNum = spanPages * spanNum;
+	if (spanPages <= SMALL_SPAN_MAX_PAGES) {
+		size_t refillPages = std::max<size_t>(1, PAGE_SHARD_REFILL_PAGES / spanPages) * spanPages;
+		pageNum = (pageNum + refillPages - 1) / refillPages * refillPages;
+	}
+	size_t bytes = pageNum * PAGE_SIZE;
+	if (pageNum == 0 || !reserveSystemBytes(bytes)) {
+		return false;
+	}
+	void* memory = systemAlloc(pageNum, true);
+	if (!memory) {
+		m_systemBytes.fetch_sub(bytes, std::memory_order_relaxed);
+		return false;
+	}
+
+	//ȵǼǳѷspanٰͷ̷Ž
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Span* span = new Span;
+	span->pageAddr = memory;
+	span->pageNum = pageNum;
+	span->next = nullptr;
+	span->decommitted = false;
+	m_pageAddrToSpanMap[memory] = span;
+	deallocateSpanLocked(memory, pageNum);
+	return true;
+}
+
+void PageCache::releaseSpanLocked(Span* span) {
+	m_pageAddrToSpanMap.erase(span->pageAddr);
+	if (span->decommitted) {
+		//ҳʱѾȥֽ
+		m_provider->release(span->pageAddr, span->pageNum);
+	}
+	else {
+		systemFree(span->pageAddr, span->pageNum);
+	}
+	delete span;
+}
+
+bool PageCache::decommitSpanLocked(Span* span) {
+	if (span->decommitted) {
+		return true;
+	}
+	if (!m_provider->decommit(span->pageAddr, span->pageNum)) {
+		return false;
+	}
+	span->decommitted = true;
+	m_systemBytes.fetch_sub(span->pageNum * PAGE_SIZE, std::memory_order_relaxed);
+	return true;
+}
+
+size_t PageCache::trimFreeSpans() {
+	for (auto& shard : m_shards) {
+		flushShard(shard);
+	}
+	flushShard(m_coldShard);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	//ַΧţ֮䲻ҳԴ룻ҳԴֶ֧ι黹
+	size_t trimmedBytes = 0;
+	for (auto it = m_freeSpansMap.begin(); it != m_freeSpansMap.end(); ) {
+		Span* kept = nullptr;
+		Span* span = it->second;
+		while (span) {
+			Span* next = span->next;
+			if (!span->decommitted) {
+				trimmedBytes += span->pageNum * PAGE_SIZE;
+			}
+			if (decommitSpanLocked(span)) {
+				span->next = kept;
+				kept = span;
+			}
+			else {
+				releaseSpanLocked(span);
+			}
+			span = next;
+		}
+		if (kept) {
+			it->second = kept;
+			++it;
+		}
+		else {
+			it = m_freeSpansMap.erase(it);
+		}
+	}
+	return trimmedBytes;
+}
+
+bool PageCache::recommitSpan(void* ptr, size_t pageNum) {
+	size_t bytes = pageNum * PAGE_SIZE;
+	if (reserveSystemBytes(bytes)) {
+		if (m_provider->commit(ptr, pageNum)) {
+			return true;
+		}
+		m_systemBytes.fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	//޻ύʧܣҳ״̬Żؿ
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_pageAddrToSpanMap.find(ptr);
+	assert(it != m_pageAddrToSpanMap.end());
+	it->second->decommitted = true;
+	deallocateSpanLocked(ptr, pageNum);
+	return false;
+}
+
 
 // ͷspan
 void PageCache::deallocateSpan(void* ptr, size_t pageNum) {
+	// ʱٻ棬ֱӽȫ·ϵͳ
+	if (pageNum <= SMALL_SPAN_MAX_PAGES && !isOverSoftLimit()) {
+		PageShard& shard = currentShard();
+		shard.lock.lock();
+		if (shard.cachedPages + pageNum <= g_tuning.pageShardMaxPages.load(std::memory_order_relaxed)) {
+			*(reinterpret_cast<void**>(ptr)) = shard.spans[pageNum];
+			shard.spans[pageNum] = ptr;
+			shard.cachedPages += pageNum;
+			shard.lock.unlock();
+			return;
+		}
+		shard.lock.unlock();
+
+		//Ƭˣ廹ȫ֣лϲ
+		flushShard(shard);
+	}
+
 	std::lock_guard<std::mutex> lock(m_mutex);
+	deallocateSpanLocked(ptr, pageNum);
+}
 
+void PageCache::deallocateSpanLocked(void* ptr, size_t pageNum) {
 	// ҶӦspanûҵPageCacheڴ棬ֱӷ
 	auto it = m_pageAddrToSpanMap.find(ptr);
 	if (it == m_pageAddrToSpanMap.end())
 		return;
 	Span* span = it->second;
 
-	//Ժϲڵspan
+	// ʱٻҳȶٺͬѶspanϲ
+	bool overSoftLimit = isOverSoftLimit();
+	if (overSoftLimit) {
+		decommitSpanLocked(span);
+	}
+
+	//Ժϲڵspanҳ״̬ͬĲϲ
 	void* nextAddr = static_cast<char*>(ptr) + pageNum * PAGE_SIZE;
 	auto nextIt = m_pageAddrToSpanMap.find(nextAddr);
 
-	if (nextIt != m_pageAddrToSpanMap.end()) {
+	if (nextIt != m_pageAddrToSpanMap.end() && nextIt->second->decommitted == span->decommitted) {
 		Span* nextSpan = nextIt->second;
 
 		// 1. ȼnextSpanǷڿ
 		bool found = false;
-		auto& nextList = m_freeSpansMap[nextSpan->pageNum];
+		auto listIt = m_freeSpansMap.find(nextSpan->pageNum);
+		Span* nextList = (listIt != m_freeSpansMap.end()) ? listIt->second : nullptr;
 
 		//Ƿͷڵ
 		if (nextList == nextSpan) {
-			nextList = nextSpan->next;
+			//˾ʹmapƳallocateSpanȡ
+			if (nextSpan->next) {
+				listIt->second = nextSpan->next;
+			}
+			else {
+				m_freeSpansMap.erase(listIt);
+			}
 			found = true;
 		}else if (nextList)
 		{
@@ -115,6 +477,12 @@ void PageCache::deallocateSpan(void* ptr, size_t pageNum) {
 			delete nextSpan;
 		}
 	}
+	// ҳԴֶ֧ʱλϵͳ
+	if (overSoftLimit && !span->decommitted) {
+		releaseSpanLocked(span);
+		return;
+	}
+
 	// ϲspanͨͷ巨б
 	auto& list = m_freeSpansMap[span->pageNum];
 	span->next = list;
@@ -1,14 +1,32 @@
 #pragma once
 #include "Common.h"
+#include "SpinLock.h"
+#include "PageProvider.h"
 #include <map>
 #include <mutex>
+#include <atomic>
+#include <array>
+
+// ӲʱõûصΪҪֽ
+// trueʾصͷڴ棬PageCacheһΣfalseʧ
+using OutOfMemoryHandler = bool (*)(size_t bytes);
 
 struct Span
 {
 	void* pageAddr; //spanʼҳַ
 	size_t pageNum; //spanռҳ
 	Span* next;     //ָһspan
+	bool decommitted; //ʱҳѶַֻΧٷȥǰҪύ
+
+};
 
+//СspanķƬ棬ÿ̶̹߳ʹһ
+//spanȫֿѷģֻspan׸ִnextָ봮ջҪSpan
+struct alignas(CACHE_LINE_SIZE) PageShard
+{
+	SpinLock lock;
+	std::array<void*, SMALL_SPAN_MAX_PAGES + 1> spans{}; //±Ϊҳ
+	size_t cachedPages{ 0 };
 };
 
 class PageCache
@@ -16,25 +34,110 @@ class PageCache
 public:
 	static PageCache& getInstance();
 
+	//ȫʵʹĬϵӳ䣻ҲҳԴϵһ˽жʹ
+	explicit PageCache(PageProvider& provider = PageProvider::system()) : m_provider(&provider) {}
+
+	PageCache(const PageCache&) = delete;
+	PageCache& operator=(const PageCache&) = delete;
+
+	//Ƭж룬ϽʵʱҪ
+	static void* operator new(size_t size);
+	static void operator delete(void* ptr);
+
 	//CentralCacheṩspanӿ
-	void* allocateSpan(size_t pageNum);
+	//Cold/LongLivedСspanͬһƬȡڵַϾһ𣬲ݵspan֮
+	void* allocateSpan(size_t pageNum, AllocHint hint = AllocHint::Hot);
 
 	// ͷspan
 	void deallocateSpan(void* ptr, size_t pageNum);
-	
+
+	//ڴޣֽڣ0ʾƣ
+	//ʱspanҳҳԴ֧ʱ黹֪̻ͨ߳գӲʱʧ
+	void setMemoryLimit(size_t softLimit, size_t hardLimit);
+
+	void setOutOfMemoryHandler(OutOfMemoryHandler handler);
+
+	//пspanѶҳģ黹ҳԴع黹ֽ
+	size_t releaseFreeSpans();
+
+	//Ϊ֮spanNumspanPagesҳspanԤϵͳڴ棬ϵͳҳԤȱҳ
+	//ڴŽȫֿspan֮ЩspanҪϵͳ
+	bool reserveSpans(size_t spanPages, size_t spanNum);
+
+	//ǰӲϵͳȡõֽѶҳĿspan
+	size_t getSystemBytes() const { return m_systemBytes.load(std::memory_order_relaxed); }
+
+	//ѴϵͳȡõֽǷ񳬹ޣʱ㻺治ڴ
+	bool isOverSoftLimit() const {
+		size_t softLimit = m_softLimit.load(std::memory_order_relaxed);
+		return softLimit && m_systemBytes.load(std::memory_order_relaxed) > softLimit;
+	}
+
+	//ڴѹÿγ޼һThreadCacheֱ仯Լ
+	size_t getPressureEpoch() const { return m_pressureEpoch.load(std::memory_order_relaxed); }
 
 private:
-	// ϵͳڴ
-	void* systemAlloc(size_t numPages);
+	//ȫֿspanвһϵͳ룬m_mutexɷָ͵Ǽ
+	void* allocateSpanGlobal(size_t pageNum);
+
+	//黹ȫֿspanspanϲ÷m_mutex
+	void deallocateSpanLocked(void* ptr, size_t pageNum);
+
+	//ƬΪʱȫȡһҳгcountpageNumҳspanصһƬ
+	void* refillShard(PageShard& shard, size_t pageNum);
+
+	//ѷƬлspanȫȫ
+	void flushShard(PageShard& shard);
+
+	//ǰ߳ʹõķƬ
+	PageShard& currentShard();
+
+	// ҳԴڴ棬populateΪtrueʱҳ֮һηʲȱҳ
+	void* systemAlloc(size_t numPages, bool populate = false);
+
+	// 黹ڴҳԴ
+	void systemFree(void* ptr, size_t numPages);
+
+	//ϵͳbytesֽǰޣҪʱڴûص
+	bool reserveSystemBytes(size_t bytes);
+
+	//spanӿ͵ַӳƳ黹ϵͳ÷m_mutex
+	void releaseSpanLocked(Span* span);
+
+	//ڴʱspanҳַΧڿиãҳԴ֧ʱfalse
+	//÷m_mutex
+	bool decommitSpanLocked(Span* span);
+
+	//пspanҳҳԴֵ֧Ĺ黹ؼٵֽ
+	size_t trimFreeSpans();
+
+	//ȥspanѶҳʱռöȲύʧʱŻؿ
+	bool recommitSpan(void* ptr, size_t pageNum);
 
 private:
+	//ҳԴ͹黹ҳڴ涼
+	PageProvider* m_provider;
 
 	// ҳspanͬҳӦͬSpan
 	std::map<size_t, Span*> m_freeSpansMap;
 
 	// ҳŵspanӳ䣬ڻ
 	std::map<void*, Span*> m_pageAddrToSpanMap;
-	std::mutex m_mutex; 
+	std::mutex m_mutex; //ֻڷָϲϵͳǰĵǼʱ
+
+	//СspanķƬ
+	std::array<PageShard, PAGE_SHARD_NUM> m_shards;
+
+	//Cold/LongLivedСspanרõķƬ
+	PageShard m_coldShard;
+
+	//ϵͳֽ
+	std::atomic<size_t> m_systemBytes{ 0 };
+
+	std::atomic<size_t> m_softLimit{ 0 };
+	std::atomic<size_t> m_hardLimit{ 0 };
+	std::atomic<OutOfMemoryHandler> m_outOfMemoryHandler{ nullptr };
+	std::atomic<size_t> m_pressureEpoch{ 0 };
 
 };
 
@@ -0,0 +1,113 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <array>
+#include <mutex>
+#include <cstdint>
+
+// 页号到元数据的映射（三层基数树），用于由内存块地址 O(1) 找到所属 span
+// 读操作无锁，只有创建中间节点时才加锁
+template<typename T>
+class PageMap
+{
+public:
+	//页号，即地址除以PAGE_SIZE
+	static uintptr_t pageIdOf(const void* addr) {
+		return reinterpret_cast<uintptr_t>(addr) / PAGE_SIZE;
+	}
+
+	//查找页号对应的元数据，不存在返回nullptr
+	T* get(uintptr_t pageId) const {
+		if ((pageId >> TOTAL_BITS) != 0) {
+			return nullptr;
+		}
+		Mid* mid = m_root[rootIndex(pageId)].load(std::memory_order_acquire);
+		if (!mid) {
+			return nullptr;
+		}
+		Leaf* leaf = mid->children[midIndex(pageId)].load(std::memory_order_acquire);
+		if (!leaf) {
+			return nullptr;
+		}
+		return leaf->values[leafIndex(pageId)].load(std::memory_order_acquire);
+	}
+
+	T* get(const void* addr) const {
+		return get(pageIdOf(addr));
+	}
+
+	//把从 startPageId 开始的 pageNum 个页都映射到 value（value为nullptr即清除）
+	void set(uintptr_t startPageId, size_t pageNum, T* value) {
+		for (size_t i = 0; i < pageNum; ++i) {
+			uintptr_t pageId = startPageId + i;
+			Leaf* leaf = ensureLeaf(pageId);
+			leaf->values[leafIndex(pageId)].store(value, std::memory_order_release);
+		}
+	}
+
+	//删除所有节点，映射变为空；调用方保证此时没有并发的读写
+	//不在析构函数中调用：全局单例析构后，其他线程的退出流程可能仍在查询
+	void clear() {
+		for (auto& midSlot : m_root) {
+			Mid* mid = midSlot.load(std::memory_order_relaxed);
+			if (!mid) {
+				continue;
+			}
+			for (auto& leafSlot : mid->children) {
+				delete leafSlot.load(std::memory_order_relaxed);
+			}
+			delete mid;
+			midSlot.store(nullptr, std::memory_order_relaxed);
+		}
+	}
+
+private:
+	//48位虚拟地址，去掉12位页内偏移后剩36位页号，三层各12位
+	static constexpr size_t LEVEL_BITS = 12;
+	static constexpr size_t TOTAL_BITS = LEVEL_BITS * 3;
+	static constexpr size_t LEVEL_SIZE = size_t(1) << LEVEL_BITS;
+
+	struct Leaf {
+		std::array<std::atomic<T*>, LEVEL_SIZE> values{};
+	};
+
+	struct Mid {
+		std::array<std::atomic<Leaf*>, LEVEL_SIZE> children{};
+	};
+
+	static size_t rootIndex(uintptr_t pageId) { return (pageId >> (LEVEL_BITS * 2)) & (LEVEL_SIZE - 1); }
+	static size_t midIndex(uintptr_t pageId) { return (pageId >> LEVEL_BITS) & (LEVEL_SIZE - 1); }
+	static size_t leafIndex(uintptr_t pageId) { return pageId & (LEVEL_SIZE - 1); }
+
+	//确保页号所在的叶子节点存在，中间节点只增不删
+	Leaf* ensureLeaf(uintptr_t pageId) {
+		assert((pageId >> TOTAL_BITS) == 0);
+
+		auto& midSlot = m_root[rootIndex(pageId)];
+		Mid* mid = midSlot.load(std::memory_order_acquire);
+		if (!mid) {
+			std::lock_guard<std::mutex> lock(m_growMutex);
+			mid = midSlot.load(std::memory_order_relaxed);
+			if (!mid) {
+				mid = new Mid;
+				midSlot.store(mid, std::memory_order_release);
+			}
+		}
+
+		auto& leafSlot = mid->children[midIndex(pageId)];
+		Leaf* leaf = leafSlot.load(std::memory_order_acquire);
+		if (!leaf) {
+			std::lock_guard<std::mutex> lock(m_growMutex);
+			leaf = leafSlot.load(std::memory_order_relaxed);
+			if (!leaf) {
+				leaf = new Leaf;
+				leafSlot.store(leaf, std::memory_order_release);
+			}
+		}
+		return leaf;
+	}
+
+private:
+	std::array<std::atomic<Mid*>, LEVEL_SIZE> m_root{};
+	std::mutex m_growMutex;
+};
@@ -0,0 +1,321 @@
+#include "PageProvider.h"
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+#endif
+
+bool PageProvider::commit(void* ptr, size_t numPages) {
+	//读出再写回，不改变内容，只让系统为每一页建立可写的物理页
+	volatile char* p = static_cast<volatile char*>(ptr);
+	for (size_t i = 0; i < numPages; ++i) {
+		p[i * PAGE_SIZE] = p[i * PAGE_SIZE];
+	}
+	return true;
+}
+
+PageProvider& PageProvider::system() {
+	//故意不析构，线程退出晚于静态对象析构时仍然可用
+	static PageProvider* instance = new MmapPageProvider;
+	return *instance;
+}
+
+void* MmapPageProvider::allocate(size_t numPages) {
+	size_t size = numPages * PAGE_SIZE;
+#ifdef _WIN32
+	std::lock_guard<std::mutex> lock(m_mutex);
+	//先重新提交之前归还的地址，首次适应，不再占用新的地址空间
+	for (auto it = m_decommitted.begin(); it != m_decommitted.end(); ++it) {
+		if (it->second < numPages) {
+			continue;
+		}
+		char* ptr = it->first;
+		if (!VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE)) {
+			return nullptr; //提交失败说明系统内存不足，新保留也提交不了
+		}
+		size_t rest = it->second - numPages;
+		m_decommitted.erase(it);
+		if (rest > 0) {
+			m_decommitted[ptr + size] = rest;
+		}
+		return ptr;
+	}
+
+	void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	if (ptr) {
+		m_reservations[static_cast<char*>(ptr)] = numPages;
+	}
+	return ptr;
+#else
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+}
+
+void MmapPageProvider::release(void* ptr, size_t numPages) {
+#ifdef _WIN32
+	std::lock_guard<std::mutex> lock(m_mutex);
+	//合并后的span可能跨越多次VirtualAlloc，按保留的边界切开分别归还
+	char* start = static_cast<char*>(ptr);
+	char* end = start + numPages * PAGE_SIZE;
+	while (start < end) {
+		auto reservation = m_reservations.upper_bound(start);
+		assert(reservation != m_reservations.begin() && "range was not allocated by this provider");
+		--reservation;
+		char* reservationEnd = reservation->first + reservation->second * PAGE_SIZE;
+		char* pieceEnd = std::min(end, reservationEnd);
+		releaseInReservation(reservation, start, pieceEnd);
+		start = pieceEnd;
+	}
+#else
+	munmap(ptr, numPages * PAGE_SIZE);
+#endif
+}
+
+#ifdef _WIN32
+void MmapPageProvider::releaseInReservation(std::map<char*, size_t>::iterator reservation, char* start, char* end) {
+	VirtualFree(start, end - start, MEM_DECOMMIT);
+
+	char* reservationBase = reservation->first;
+	char* reservationEnd = reservationBase + reservation->second * PAGE_SIZE;
+	size_t pageNum = (end - start) / PAGE_SIZE;
+
+	//与同一次保留内相邻的已归还区间合并
+	auto next = m_decommitted.lower_bound(start);
+	if (next != m_decommitted.end() && next->first == end && end < reservationEnd) {
+		pageNum += next->second;
+		next = m_decommitted.erase(next);
+	}
+	if (next != m_decommitted.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first >= reservationBase && prev->first + prev->second * PAGE_SIZE == start) {
+			start = prev->first;
+			pageNum += prev->second;
+			m_decommitted.erase(prev);
+		}
+	}
+
+	//整次保留都归还了，地址空间还给系统
+	if (start == reservationBase && pageNum == reservation->second) {
+		VirtualFree(reservationBase, 0, MEM_RELEASE);
+		m_reservations.erase(reservation);
+		return;
+	}
+	m_decommitted[start] = pageNum;
+}
+#endif
+
+bool MmapPageProvider::commit(void* ptr, size_t numPages) {
+#ifdef MADV_POPULATE_WRITE
+	//一次系统调用建立所有页表，旧内核不支持时退回逐页访问
+	if (madvise(ptr, numPages * PAGE_SIZE, MADV_POPULATE_WRITE) == 0) {
+		return true;
+	}
+#endif
+	return PageProvider::commit(ptr, numPages);
+}
+
+bool MmapPageProvider::decommit(void* ptr, size_t numPages) {
+#ifdef _WIN32
+	//解除提交后再访问会出错，要先commit；归还走release，由它记下地址以便重新提交
+	return VirtualFree(ptr, numPages * PAGE_SIZE, MEM_DECOMMIT) != 0;
+#else
+	return madvise(ptr, numPages * PAGE_SIZE, MADV_DONTNEED) == 0;
+#endif
+}
+
+StaticBufferPageProvider::StaticBufferPageProvider(void* buffer, size_t bytes, bool lockPages) {
+	initRegion(buffer, bytes, lockPages);
+}
+
+StaticBufferPageProvider::~StaticBufferPageProvider() {
+	if (m_locked) {
+#ifdef _WIN32
+		VirtualUnlock(m_base, m_pageNum * PAGE_SIZE);
+#else
+		munlock(m_base, m_pageNum * PAGE_SIZE);
+#endif
+	}
+}
+
+bool StaticBufferPageProvider::initRegion(void* buffer, size_t bytes, bool lockPages) {
+	//只使用缓冲区中完整的页
+	uintptr_t begin = (reinterpret_cast<uintptr_t>(buffer) + PAGE_SIZE - 1) & ~(uintptr_t(PAGE_SIZE) - 1);
+	uintptr_t end = (reinterpret_cast<uintptr_t>(buffer) + bytes) & ~(uintptr_t(PAGE_SIZE) - 1);
+	if (!buffer || end <= begin) {
+		return false;
+	}
+	char* base = reinterpret_cast<char*>(begin);
+	size_t pageNum = (end - begin) / PAGE_SIZE;
+
+	if (lockPages) {
+#ifdef _WIN32
+		bool locked = VirtualLock(base, pageNum * PAGE_SIZE) != 0;
+#else
+		bool locked = mlock(base, pageNum * PAGE_SIZE) == 0;
+#endif
+		if (!locked) {
+			return false;
+		}
+		//锁定不一定建立可写的页（写时复制的零页），这里一次做完
+		PageProvider::commit(base, pageNum);
+		m_locked = true;
+	}
+
+	m_base = base;
+	m_pageNum = pageNum;
+	m_freeRuns[base] = pageNum;
+	m_freePageNum = pageNum;
+	return true;
+}
+
+size_t StaticBufferPageProvider::freePageCount() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_freePageNum;
+}
+
+void* StaticBufferPageProvider::allocate(size_t numPages) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	//首次适应，从区间开头切
+	for (auto it = m_freeRuns.begin(); it != m_freeRuns.end(); ++it) {
+		if (it->second < numPages) {
+			continue;
+		}
+		char* ptr = it->first;
+		size_t rest = it->second - numPages;
+		m_freeRuns.erase(it);
+		if (rest > 0) {
+			m_freeRuns[ptr + numPages * PAGE_SIZE] = rest;
+		}
+		m_freePageNum -= numPages;
+		return ptr;
+	}
+	return nullptr;
+}
+
+void StaticBufferPageProvider::release(void* ptr, size_t numPages) {
+	assert(static_cast<char*>(ptr) >= m_base && static_cast<char*>(ptr) + numPages * PAGE_SIZE <= m_base + m_pageNum * PAGE_SIZE);
+	decommit(ptr, numPages);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	char* start = static_cast<char*>(ptr);
+	size_t pageNum = numPages;
+	m_freePageNum += numPages;
+
+	//与后一个空闲区间合并
+	auto next = m_freeRuns.lower_bound(start);
+	if (next != m_freeRuns.end() && next->first == start + pageNum * PAGE_SIZE) {
+		pageNum += next->second;
+		next = m_freeRuns.erase(next);
+	}
+	//与前一个空闲区间合并
+	if (next != m_freeRuns.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second * PAGE_SIZE == start) {
+			prev->second += pageNum;
+			return;
+		}
+	}
+	m_freeRuns.emplace_hint(next, start, pageNum);
+}
+
+bool StaticBufferPageProvider::decommit(void* ptr, size_t numPages) {
+	if (m_locked) {
+		return false;
+	}
+#ifdef _WIN32
+	//内容可以丢弃，物理页在内存紧张时优先回收，再次访问不会出错
+	return VirtualAlloc(ptr, numPages * PAGE_SIZE, MEM_RESET, PAGE_READWRITE) != nullptr;
+#else
+	return madvise(ptr, numPages * PAGE_SIZE, MADV_DONTNEED) == 0;
+#endif
+}
+
+#ifdef __linux__
+
+HugePageFileProvider::HugePageFileProvider(const char* path, size_t bytes, bool lockPages) {
+	m_fd = ::open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if (m_fd < 0) {
+		return;
+	}
+	::unlink(path);
+
+	struct statfs fs;
+	if (fstatfs(m_fd, &fs) == 0 && fs.f_bsize > 0) {
+		m_hugePageSize = std::max<size_t>(PAGE_SIZE, static_cast<size_t>(fs.f_bsize));
+	}
+	m_mappingBytes = (bytes + m_hugePageSize - 1) / m_hugePageSize * m_hugePageSize;
+	if (ftruncate(m_fd, static_cast<off_t>(m_mappingBytes)) != 0) {
+		return;
+	}
+
+	void* mapping = mmap(nullptr, m_mappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (mapping == MAP_FAILED) {
+		return;
+	}
+	m_mapping = static_cast<char*>(mapping);
+	initRegion(m_mapping, m_mappingBytes, lockPages);
+}
+
+HugePageFileProvider::~HugePageFileProvider() {
+	//先解锁，基类析构时映射已经不在了
+	if (m_locked) {
+		munlock(m_base, m_pageNum * PAGE_SIZE);
+		m_locked = false;
+	}
+	if (m_mapping) {
+		munmap(m_mapping, m_mappingBytes);
+	}
+	if (m_fd >= 0) {
+		::close(m_fd);
+	}
+}
+
+bool HugePageFileProvider::decommit(void* ptr, size_t numPages) {
+	if (m_locked) {
+		return false;
+	}
+	//共享映射上MADV_DONTNEED不释放文件页，只能打洞；只打完整落在范围内的大页
+	size_t begin = static_cast<size_t>(static_cast<char*>(ptr) - m_mapping);
+	size_t end = begin + numPages * PAGE_SIZE;
+	begin = (begin + m_hugePageSize - 1) / m_hugePageSize * m_hugePageSize;
+	end = end / m_hugePageSize * m_hugePageSize;
+	if (end <= begin) {
+		return false;
+	}
+	return fallocate(m_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, static_cast<off_t>(begin),
+		static_cast<off_t>(end - begin)) == 0;
+}
+
+#else
+
+HugePageFileProvider::HugePageFileProvider(const char* path, size_t bytes, bool lockPages) {
+	//没有hugetlbfs，保持无效状态
+	(void)path;
+	(void)bytes;
+	(void)lockPages;
+}
+
+HugePageFileProvider::~HugePageFileProvider() = default;
+
+bool HugePageFileProvider::decommit(void* ptr, size_t numPages) {
+	(void)ptr;
+	(void)numPages;
+	return false;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+#include "Common.h"
+#include <map>
+#include <mutex>
+
+// 页来源：PageCache通过它向下申请和归还整页内存，可以换成任意后端
+// PageCache只保证传入的范围按页对齐，且都在之前allocate得到的内存中；
+// 相邻的两次allocate可能被合并成一个span，release的范围因此可能跨越多次allocate
+// 实现需要线程安全，生命周期要长于使用它的PageCache
+class PageProvider
+{
+public:
+	virtual ~PageProvider() = default;
+
+	//申请numPages页按页对齐、可读写的内存，失败返回nullptr
+	virtual void* allocate(size_t numPages) = 0;
+
+	//归还内存，之后这段范围可能再次由allocate返回
+	virtual void release(void* ptr, size_t numPages) = 0;
+
+	//立即为这段内存建立物理页，之后第一次访问不再缺页；默认逐页读写一次
+	virtual bool commit(void* ptr, size_t numPages);
+
+	//丢弃物理页但保留地址范围，内容变为未定义；不支持时返回false
+	virtual bool decommit(void* ptr, size_t numPages) { (void)ptr; (void)numPages; return false; }
+
+	//默认的匿名映射来源，PageCache未指定来源时使用
+	static PageProvider& system();
+};
+
+//匿名映射：POSIX上mmap/munmap，Windows上VirtualAlloc
+//Windows上释放的范围可能跨越多次保留，不能直接MEM_RELEASE：归还时先解除提交并记下地址，
+//之后allocate优先重新提交这些地址；一次保留的范围全部归还后再整体MEM_RELEASE
+class MmapPageProvider : public PageProvider
+{
+public:
+	void* allocate(size_t numPages) override;
+	void release(void* ptr, size_t numPages) override;
+	bool commit(void* ptr, size_t numPages) override;
+	bool decommit(void* ptr, size_t numPages) override;
+
+#ifdef _WIN32
+private:
+	//归还[start, end)，范围落在reservation这一次保留之内，调用方持有m_mutex
+	void releaseInReservation(std::map<char*, size_t>::iterator reservation, char* start, char* end);
+
+	std::mutex m_mutex;
+	std::map<char*, size_t> m_reservations; //每次VirtualAlloc保留的起址 -> 页数
+	std::map<char*, size_t> m_decommitted;  //已解除提交的区间起址 -> 页数，只在同一次保留内合并
+#endif
+};
+
+//调用方提供的一块固定内存，按页首次适应分配，用完即失败，不会再向系统申请
+//lockPages为true时一开始就锁定并预先缺页整块内存，之后分配和释放都不会缺页或进入系统调用
+class StaticBufferPageProvider : public PageProvider
+{
+public:
+	StaticBufferPageProvider(void* buffer, size_t bytes, bool lockPages = false);
+	~StaticBufferPageProvider() override;
+
+	StaticBufferPageProvider(const StaticBufferPageProvider&) = delete;
+	StaticBufferPageProvider& operator=(const StaticBufferPageProvider&) = delete;
+
+	//内存可用（锁定成功、映射成功）
+	bool valid() const { return m_base != nullptr; }
+
+	//可用总页数和空闲页数
+	size_t pageCount() const { return m_pageNum; }
+	size_t freePageCount() const;
+
+	void* allocate(size_t numPages) override;
+	void release(void* ptr, size_t numPages) override;
+
+	//锁定的内存不丢弃物理页
+	bool decommit(void* ptr, size_t numPages) override;
+
+protected:
+	StaticBufferPageProvider() = default;
+
+	//按页对齐后开始管理[buffer, buffer + bytes)
+	bool initRegion(void* buffer, size_t bytes, bool lockPages);
+
+	char* m_base{ nullptr };
+	size_t m_pageNum{ 0 };
+	bool m_locked{ false };
+
+private:
+	mutable std::mutex m_mutex;
+	std::map<char*, size_t> m_freeRuns; //空闲区间起址 -> 页数，相邻区间总是合并
+	size_t m_freePageNum{ 0 };
+};
+
+//大页文件：在hugetlbfs（或任意文件系统）上建一个bytes大小的文件整体共享映射，按固定内存的方式分配
+//文件打开后立即删除名字，进程退出时自动回收；decommit在文件上打洞，把整块大页还给系统
+//只在Linux上可用，其他平台valid()为false
+class HugePageFileProvider : public StaticBufferPageProvider
+{
+public:
+	HugePageFileProvider(const char* path, size_t bytes, bool lockPages = false);
+	~HugePageFileProvider() override;
+
+	bool decommit(void* ptr, size_t numPages) override;
+
+	//文件系统的块大小，hugetlbfs上就是大页大小
+	size_t hugePageSize() const { return m_hugePageSize; }
+
+private:
+	int m_fd{ -1 };
+	char* m_mapping{ nullptr };
+	size_t m_mappingBytes{ 0 };
+	size_t m_hugePageSize{ PAGE_SIZE };
+};
@@ -0,0 +1,716 @@
+#include "SharedMemoryPool.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr uint64_t SHARED_POOL_MAGIC = 0x4445524148535053ull; //"SPSHARED"
+	constexpr uint32_t SHARED_POOL_VERSION = 2;
+	constexpr uint32_t NIL_PAGE = UINT32_MAX;
+
+	//页的状态，只有span首页的有意义
+	enum PageState : uint32_t
+	{
+		PAGE_INTERIOR = 0, //不是span首页
+		PAGE_FREE = 1,     //空闲页段的首页
+		PAGE_SMALL = 2,    //小块span的首页
+		PAGE_LARGE = 3,    //大于MAX_BYTES的整块分配
+	};
+
+	size_t roundUpToPage(size_t bytes) {
+		return (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+	}
+
+	//共享池的大小类比主内存池粗：SHARED_SMALL_BYTES以内按ALIGNMENT取整，
+	//更大的(2^p, 2^(p+1)]按2^(p-2)取整，尾部浪费不超过1/4；大小类少，段头只占一页
+	constexpr size_t SHARED_SMALL_BYTES = 128;
+	constexpr size_t SHARED_SMALL_CLASS_NUM = SHARED_SMALL_BYTES / ALIGNMENT;
+	constexpr size_t SHARED_CLASSES_PER_DOUBLING = 4;
+
+	constexpr size_t sharedClassIndex(size_t size) {
+		if (size <= SHARED_SMALL_BYTES) {
+			return (size + ALIGNMENT - 1) / ALIGNMENT - 1;
+		}
+		size_t doubling = 0;
+		while ((SHARED_SMALL_BYTES << (doubling + 1)) < size) {
+			++doubling;
+		}
+		size_t step = (SHARED_SMALL_BYTES << doubling) / SHARED_CLASSES_PER_DOUBLING;
+		size_t steps = (size + step - 1) / step;
+		return SHARED_SMALL_CLASS_NUM + doubling * SHARED_CLASSES_PER_DOUBLING + steps - SHARED_CLASSES_PER_DOUBLING - 1;
+	}
+
+	constexpr size_t sharedClassBytes(size_t index) {
+		if (index < SHARED_SMALL_CLASS_NUM) {
+			return (index + 1) * ALIGNMENT;
+		}
+		index -= SHARED_SMALL_CLASS_NUM;
+		size_t doubling = index / SHARED_CLASSES_PER_DOUBLING;
+		size_t step = (SHARED_SMALL_BYTES << doubling) / SHARED_CLASSES_PER_DOUBLING;
+		return (index % SHARED_CLASSES_PER_DOUBLING + SHARED_CLASSES_PER_DOUBLING + 1) * step;
+	}
+
+	constexpr size_t SHARED_CLASS_NUM = sharedClassIndex(MAX_BYTES) + 1;
+
+	static_assert(sharedClassBytes(sharedClassIndex(SHARED_SMALL_BYTES)) == SHARED_SMALL_BYTES, "last exact class");
+	static_assert(sharedClassBytes(sharedClassIndex(SHARED_SMALL_BYTES + 1)) == SHARED_SMALL_BYTES * 5 / 4, "first coarse class");
+	static_assert(sharedClassBytes(sharedClassIndex(4096)) == 4096, "4KB fits exactly");
+	static_assert(sharedClassBytes(SHARED_CLASS_NUM - 1) == MAX_BYTES, "last shared class");
+}
+
+//每页一个，放在段头之后
+//已分配span的每一页head都指向首页；空闲页段只维护首尾两页的head，合并时据此找到前一段
+struct SharedMemoryPool::SpanMeta
+{
+	uint32_t head;
+	uint32_t state;
+	uint32_t pageNum;
+	uint32_t index;      //大小类下标
+	uint32_t blockCount;
+	uint32_t useCount;
+	uint32_t prev;       //所在链表（大小类的部分空闲span或空闲页段）中的前一个，页号
+	uint32_t next;
+	uint64_t freeList;   //已归还块的链表，块内存下一个块的偏移，0表示空
+	uint64_t bumpCursor; //未切分区域的偏移
+	uint64_t bumpEnd;
+};
+
+//大小类的部分空闲span链表，每个占一个缓存行
+struct alignas(CACHE_LINE_SIZE) SharedClass
+{
+	SharedSpinLock lock;
+	uint32_t partialSpans;
+};
+
+struct SharedMemoryPool::Header
+{
+	uint64_t magic;
+	uint32_t version;
+	std::atomic<uint32_t> ready; //创建方初始化完成后置1
+	uint64_t segmentBytes;
+	uint64_t spansOffset;
+	uint64_t dataOffset;
+	uint32_t pageNum;
+
+	SharedSpinLock pageLock;
+	uint32_t freeRuns;     //空闲页段链表
+	uint32_t freePageNum;
+
+	//文件堆使用的字段
+	std::atomic<uint64_t> rootOffset; //根对象偏移，0表示没有
+	uint64_t lastBase;                //上次映射的基址
+	uint32_t dirty;                   //打开期间为1，正常关闭时清零
+
+	SharedClass classes[SHARED_CLASS_NUM];
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "shared memory needs address-free atomics");
+
+SharedMemoryPool::SharedMemoryPool(char* base, size_t size, int fd, void* handle)
+	: m_base(base), m_size(size), m_fd(fd), m_handle(handle), m_file(nullptr), m_persistent(false), m_relocated(false) {
+}
+
+SharedMemoryPool::~SharedMemoryPool() {
+	if (m_persistent) {
+		header()->dirty = 0;
+		flush();
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(m_base);
+	CloseHandle(static_cast<HANDLE>(m_handle));
+	if (m_file) {
+		CloseHandle(static_cast<HANDLE>(m_file));
+	}
+#else
+	munmap(m_base, m_size);
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+#endif
+}
+
+SharedMemoryPool::SpanMeta* SharedMemoryPool::spans() const {
+	return reinterpret_cast<SpanMeta*>(m_base + header()->spansOffset);
+}
+
+char* SharedMemoryPool::pageAddress(uint32_t page) const {
+	return m_base + header()->dataOffset + static_cast<uint64_t>(page) * PAGE_SIZE;
+}
+
+uint32_t SharedMemoryPool::pageOf(const void* ptr) const {
+	return static_cast<uint32_t>((toOffset(ptr) - header()->dataOffset) / PAGE_SIZE);
+}
+
+void SharedMemoryPool::setRoot(void* ptr) {
+	header()->rootOffset.store(ptr ? toOffset(ptr) : 0, std::memory_order_release);
+}
+
+void* SharedMemoryPool::getRoot() const {
+	uint64_t offset = header()->rootOffset.load(std::memory_order_acquire);
+	return offset ? fromOffset(offset) : nullptr;
+}
+
+bool SharedMemoryPool::flush() {
+	if (!m_persistent) {
+		return true;
+	}
+#ifdef _WIN32
+	return FlushViewOfFile(m_base, 0) && FlushFileBuffers(static_cast<HANDLE>(m_file));
+#else
+	return msync(m_base, m_size, MS_SYNC) == 0;
+#endif
+}
+
+size_t SharedMemoryPool::pageCount() const {
+	return header()->pageNum;
+}
+
+size_t SharedMemoryPool::freePageCount() const {
+	Header* h = header();
+	h->pageLock.lock();
+	size_t num = h->freePageNum;
+	h->pageLock.unlock();
+	return num;
+}
+
+// ---------------------------------------------------------------------------
+// 段的创建和映射
+// ---------------------------------------------------------------------------
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::initialize(char* base, size_t size, int fd, void* handle) {
+	std::unique_ptr<SharedMemoryPool> pool(new SharedMemoryPool(base, size, fd, handle));
+
+	//布局：段头 | 每页一个SpanMeta | 数据页
+	static_assert(sizeof(Header) <= PAGE_SIZE, "segment header fits in one page");
+	size_t spansOffset = roundUpToPage(sizeof(Header));
+	if (size < spansOffset + PAGE_SIZE + sizeof(SpanMeta)) {
+		return nullptr;
+	}
+	size_t pageNum = (size - spansOffset) / (PAGE_SIZE + sizeof(SpanMeta));
+	size_t dataOffset = roundUpToPage(spansOffset + pageNum * sizeof(SpanMeta));
+	while (pageNum > 0 && dataOffset + pageNum * PAGE_SIZE > size) {
+		--pageNum;
+		dataOffset = roundUpToPage(spansOffset + pageNum * sizeof(SpanMeta));
+	}
+	if (pageNum == 0 || pageNum >= NIL_PAGE) {
+		return nullptr;
+	}
+
+	//新建的共享内存已全部清零，只写非零字段
+	Header* h = new(base) Header;
+	h->magic = SHARED_POOL_MAGIC;
+	h->version = SHARED_POOL_VERSION;
+	h->segmentBytes = size;
+	h->spansOffset = spansOffset;
+	h->dataOffset = dataOffset;
+	h->pageNum = static_cast<uint32_t>(pageNum);
+	h->freeRuns = NIL_PAGE;
+	h->freePageNum = 0;
+	for (auto& cls : h->classes) {
+		cls.partialSpans = NIL_PAGE;
+	}
+
+	//整个数据区是一个空闲页段
+	SpanMeta& first = pool->spans()[0];
+	first.head = 0;
+	first.pageNum = static_cast<uint32_t>(pageNum);
+	pool->spans()[pageNum - 1].head = 0;
+	pool->pushFreeRun(0);
+
+	h->ready.store(1, std::memory_order_release);
+	return pool;
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::validate(char* base, size_t size, int fd, void* handle) {
+	std::unique_ptr<SharedMemoryPool> pool(new SharedMemoryPool(base, size, fd, handle));
+	if (size < sizeof(Header)) {
+		return nullptr;
+	}
+
+	//创建方可能还在初始化，稍等片刻
+	Header* h = pool->header();
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+	while (!h->ready.load(std::memory_order_acquire)) {
+		if (std::chrono::steady_clock::now() > deadline) {
+			return nullptr;
+		}
+		std::this_thread::yield();
+	}
+
+	if (h->magic != SHARED_POOL_MAGIC || h->version != SHARED_POOL_VERSION || h->segmentBytes != size) {
+		return nullptr;
+	}
+	return pool;
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::persist(std::unique_ptr<SharedMemoryPool> pool) {
+	if (!pool) {
+		return nullptr;
+	}
+	//上次打开后没有正常关闭，元数据可能只改了一半
+	Header* h = pool->header();
+	if (h->dirty) {
+		return nullptr;
+	}
+	uint64_t base = reinterpret_cast<uint64_t>(pool->m_base);
+	pool->m_relocated = h->lastBase != 0 && h->lastBase != base;
+	h->lastBase = base;
+	h->dirty = 1;
+	pool->m_persistent = true;
+	return pool;
+}
+
+void* SharedMemoryPool::lastBaseOf(const char* base, size_t size) {
+	if (size < sizeof(Header)) {
+		return nullptr;
+	}
+	return reinterpret_cast<void*>(reinterpret_cast<const Header*>(base)->lastBase);
+}
+
+#ifdef _WIN32
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::create(const char* name, size_t bytes) {
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(static_cast<uint64_t>(bytes) >> 32), static_cast<DWORD>(bytes), name);
+	if (!mapping) {
+		return nullptr;
+	}
+	if (GetLastError() == ERROR_ALREADY_EXISTS) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	char* base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes));
+	if (!base) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	//失败时unique_ptr析构会解除映射并关闭句柄
+	return initialize(base, bytes, -1, mapping);
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::open(const char* name) {
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (!mapping) {
+		return nullptr;
+	}
+	char* base = static_cast<char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0));
+	if (!base) {
+		CloseHandle(mapping);
+		return nullptr;
+	}
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(base, &info, sizeof(info));
+	return validate(base, info.RegionSize, -1, mapping);
+}
+
+bool SharedMemoryPool::remove(const char*) {
+	return true;
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::openFile(const char* path, size_t bytes, void* baseHint) {
+	//不共享打开，同一时间只有一个进程使用文件堆
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	bool fresh = fileSize.QuadPart == 0;
+	uint64_t size = fresh ? bytes : static_cast<uint64_t>(fileSize.QuadPart);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+		static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	char* base = static_cast<char*>(MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, baseHint));
+	if (!base && baseHint) {
+		base = static_cast<char*>(MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, nullptr));
+	}
+	//没有指定基址时尝试映射回上次的地址
+	void* lastBase = base && !fresh && !baseHint ? lastBaseOf(base, size) : nullptr;
+	if (lastBase && lastBase != base) {
+		UnmapViewOfFile(base);
+		base = static_cast<char*>(MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, lastBase));
+		if (!base) {
+			base = static_cast<char*>(MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size, nullptr));
+		}
+	}
+	if (!base) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	auto pool = fresh ? initialize(base, size, -1, mapping) : validate(base, size, -1, mapping);
+	if (!pool) {
+		CloseHandle(file);
+		return nullptr;
+	}
+	pool->m_file = file;
+	return persist(std::move(pool));
+}
+
+#else
+
+namespace {
+	char* mapSegment(int fd, size_t size, void* hint = nullptr) {
+		void* base = mmap(hint, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		return base == MAP_FAILED ? nullptr : static_cast<char*>(base);
+	}
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::create(const char* name, size_t bytes) {
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0) {
+		return nullptr;
+	}
+	char* base = nullptr;
+	if (ftruncate(fd, static_cast<off_t>(bytes)) != 0 || !(base = mapSegment(fd, bytes))) {
+		close(fd);
+		shm_unlink(name);
+		return nullptr;
+	}
+	//映射建立后不再需要fd
+	close(fd);
+	auto pool = initialize(base, bytes, -1, nullptr);
+	if (!pool) {
+		shm_unlink(name);
+	}
+	return pool;
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::open(const char* name) {
+	int fd = shm_open(name, O_RDWR, 0600);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	char* base = nullptr;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || !(base = mapSegment(fd, static_cast<size_t>(st.st_size)))) {
+		close(fd);
+		return nullptr;
+	}
+	close(fd);
+	return validate(base, static_cast<size_t>(st.st_size), -1, nullptr);
+}
+
+bool SharedMemoryPool::remove(const char* name) {
+	return shm_unlink(name) == 0;
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::openFile(const char* path, size_t bytes, void* baseHint) {
+	int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return nullptr;
+	}
+	//文件锁保证同一时间只有一个进程使用文件堆，进程退出（包括崩溃）时自动释放
+	struct stat st;
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+		close(fd);
+		return nullptr;
+	}
+	bool fresh = st.st_size == 0;
+	size_t size = fresh ? bytes : static_cast<size_t>(st.st_size);
+	if (fresh && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	//基址只是提示，被占用时内核另选地址
+	char* base = mapSegment(fd, size, baseHint);
+	//没有指定基址时尝试映射回上次的地址
+	void* lastBase = base && !fresh && !baseHint ? lastBaseOf(base, size) : nullptr;
+	if (lastBase && lastBase != base) {
+		munmap(base, size);
+		base = mapSegment(fd, size, lastBase);
+	}
+	if (!base) {
+		close(fd);
+		return nullptr;
+	}
+
+	//fd由pool持有，文件锁一直保持到析构
+	auto pool = fresh ? initialize(base, size, fd, nullptr) : validate(base, size, fd, nullptr);
+	return persist(std::move(pool));
+}
+
+#ifdef __linux__
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::createAnonymous(size_t bytes) {
+	int fd = memfd_create("memorypool", MFD_CLOEXEC);
+	if (fd < 0) {
+		return nullptr;
+	}
+	char* base = nullptr;
+	if (ftruncate(fd, static_cast<off_t>(bytes)) != 0 || !(base = mapSegment(fd, bytes))) {
+		close(fd);
+		return nullptr;
+	}
+	return initialize(base, bytes, fd, nullptr);
+}
+
+std::unique_ptr<SharedMemoryPool> SharedMemoryPool::attach(int fd) {
+	struct stat st;
+	char* base = nullptr;
+	int ownFd = dup(fd);
+	if (ownFd < 0) {
+		return nullptr;
+	}
+	if (fstat(ownFd, &st) != 0 || st.st_size <= 0 || !(base = mapSegment(ownFd, static_cast<size_t>(st.st_size)))) {
+		close(ownFd);
+		return nullptr;
+	}
+	return validate(base, static_cast<size_t>(st.st_size), ownFd, nullptr);
+}
+
+#endif
+
+#endif
+
+// ---------------------------------------------------------------------------
+// 页管理，调用方持有pageLock
+// ---------------------------------------------------------------------------
+
+void SharedMemoryPool::pushFreeRun(uint32_t page) {
+	Header* h = header();
+	SpanMeta* meta = spans();
+	meta[page].state = PAGE_FREE;
+	meta[page].prev = NIL_PAGE;
+	meta[page].next = h->freeRuns;
+	if (h->freeRuns != NIL_PAGE) {
+		meta[h->freeRuns].prev = page;
+	}
+	h->freeRuns = page;
+	h->freePageNum += meta[page].pageNum;
+}
+
+void SharedMemoryPool::removeFreeRun(uint32_t page) {
+	Header* h = header();
+	SpanMeta* meta = spans();
+	if (meta[page].prev != NIL_PAGE) {
+		meta[meta[page].prev].next = meta[page].next;
+	}
+	else {
+		h->freeRuns = meta[page].next;
+	}
+	if (meta[page].next != NIL_PAGE) {
+		meta[meta[page].next].prev = meta[page].prev;
+	}
+	h->freePageNum -= meta[page].pageNum;
+}
+
+uint32_t SharedMemoryPool::allocatePages(uint32_t pageNum, uint32_t state) {
+	Header* h = header();
+	SpanMeta* meta = spans();
+
+	h->pageLock.lock();
+	uint32_t page = h->freeRuns;
+	while (page != NIL_PAGE && meta[page].pageNum < pageNum) {
+		page = meta[page].next;
+	}
+	if (page == NIL_PAGE) {
+		h->pageLock.unlock();
+		return NIL_PAGE;
+	}
+
+	removeFreeRun(page);
+	if (meta[page].pageNum > pageNum) {
+		//剩余部分作为新的空闲页段，维护首尾两页的head
+		uint32_t rest = page + pageNum;
+		meta[rest].pageNum = meta[page].pageNum - pageNum;
+		meta[rest].head = rest;
+		meta[rest + meta[rest].pageNum - 1].head = rest;
+		pushFreeRun(rest);
+	}
+
+	//相邻页段释放时会持锁读取边界页的head和首页的state，所以也要在锁内登记
+	meta[page].state = state;
+	meta[page].pageNum = pageNum;
+	for (uint32_t i = 0; i < pageNum; ++i) {
+		meta[page + i].head = page;
+	}
+	h->pageLock.unlock();
+	return page;
+}
+
+void SharedMemoryPool::deallocatePages(uint32_t page) {
+	Header* h = header();
+	SpanMeta* meta = spans();
+
+	h->pageLock.lock();
+	uint32_t pageNum = meta[page].pageNum;
+
+	//和后一段合并
+	uint32_t next = page + pageNum;
+	if (next < h->pageNum && meta[next].state == PAGE_FREE) {
+		removeFreeRun(next);
+		pageNum += meta[next].pageNum;
+		meta[next].state = PAGE_INTERIOR;
+	}
+
+	//和前一段合并，前一页是空闲页段的尾页时head指向该段首页
+	if (page > 0) {
+		uint32_t prev = meta[page - 1].head;
+		if (meta[prev].state == PAGE_FREE) {
+			removeFreeRun(prev);
+			pageNum += meta[prev].pageNum;
+			meta[page].state = PAGE_INTERIOR;
+			page = prev;
+		}
+	}
+
+	meta[page].pageNum = pageNum;
+	meta[page].head = page;
+	meta[page + pageNum - 1].head = page;
+	pushFreeRun(page);
+	h->pageLock.unlock();
+}
+
+// ---------------------------------------------------------------------------
+// 分配和释放
+// ---------------------------------------------------------------------------
+
+void* SharedMemoryPool::allocate(size_t size) {
+	size = size == 0 ? ALIGNMENT : size;
+	SpanMeta* meta = spans();
+
+	if (size > MAX_BYTES) {
+		size_t pageNum = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+		if (pageNum >= NIL_PAGE) {
+			return nullptr;
+		}
+		uint32_t page = allocatePages(static_cast<uint32_t>(pageNum), PAGE_LARGE);
+		if (page == NIL_PAGE) {
+			return nullptr;
+		}
+		return pageAddress(page);
+	}
+
+	size_t index = sharedClassIndex(size);
+	size_t blockSize = sharedClassBytes(index);
+	SharedClass& cls = header()->classes[index];
+
+	cls.lock.lock();
+	if (cls.partialSpans == NIL_PAGE) {
+		//申请新span时不持有大小类的锁
+		cls.lock.unlock();
+		uint32_t spanPages = static_cast<uint32_t>(SizeClass::getSpanPages(blockSize));
+		uint32_t page = allocatePages(spanPages, PAGE_SMALL);
+		if (page == NIL_PAGE) {
+			return nullptr;
+		}
+		SpanMeta& span = meta[page];
+		span.index = static_cast<uint32_t>(index);
+		span.blockCount = static_cast<uint32_t>(spanPages * PAGE_SIZE / blockSize);
+		span.useCount = 0;
+		span.freeList = 0;
+		span.bumpCursor = toOffset(pageAddress(page));
+		span.bumpEnd = span.bumpCursor + static_cast<uint64_t>(span.blockCount) * blockSize;
+
+		cls.lock.lock();
+		span.prev = NIL_PAGE;
+		span.next = cls.partialSpans;
+		if (cls.partialSpans != NIL_PAGE) {
+			meta[cls.partialSpans].prev = page;
+		}
+		cls.partialSpans = page;
+	}
+
+	uint32_t page = cls.partialSpans;
+	SpanMeta& span = meta[page];
+	uint64_t offset;
+	if (span.freeList) {
+		offset = span.freeList;
+		span.freeList = *reinterpret_cast<uint64_t*>(fromOffset(offset));
+	}
+	else {
+		offset = span.bumpCursor;
+		span.bumpCursor += blockSize;
+	}
+
+	//span已满，移出部分空闲链表，有块归还时再挂回来
+	if (++span.useCount == span.blockCount) {
+		cls.partialSpans = span.next;
+		if (span.next != NIL_PAGE) {
+			meta[span.next].prev = NIL_PAGE;
+		}
+		span.prev = span.next = NIL_PAGE;
+	}
+	cls.lock.unlock();
+	return fromOffset(offset);
+}
+
+void SharedMemoryPool::deallocate(void* ptr) {
+	if (!ptr) {
+		return;
+	}
+	assert(contains(ptr));
+
+	//块还没归还，所属span一定存在，不持锁读取首页信息是安全的
+	SpanMeta* meta = spans();
+	uint32_t page = meta[pageOf(ptr)].head;
+	SpanMeta& span = meta[page];
+
+	if (span.state == PAGE_LARGE) {
+		deallocatePages(page);
+		return;
+	}
+	assert(span.state == PAGE_SMALL);
+
+	SharedClass& cls = header()->classes[span.index];
+	cls.lock.lock();
+
+	bool wasFull = span.useCount == span.blockCount;
+	*reinterpret_cast<uint64_t*>(ptr) = span.freeList;
+	span.freeList = toOffset(ptr);
+	--span.useCount;
+
+	if (span.useCount == 0) {
+		//span完全空闲，从链表中摘下还给页管理（满span本来就不在链表中）
+		if (!wasFull) {
+			if (span.prev != NIL_PAGE) {
+				meta[span.prev].next = span.next;
+			}
+			else {
+				cls.partialSpans = span.next;
+			}
+			if (span.next != NIL_PAGE) {
+				meta[span.next].prev = span.prev;
+			}
+		}
+		cls.lock.unlock();
+		deallocatePages(page);
+		return;
+	}
+
+	if (wasFull) {
+		span.prev = NIL_PAGE;
+		span.next = cls.partialSpans;
+		if (cls.partialSpans != NIL_PAGE) {
+			meta[cls.partialSpans].prev = page;
+		}
+		cls.partialSpans = page;
+	}
+	cls.lock.unlock();
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "Common.h"
+#include "SpinLock.h"
+#include <cstdint>
+#include <memory>
+
+// 多进程共享内存池：整个池放在一段共享内存（shm_open / memfd / Windows命名文件映射）里，
+// 映射到多个进程后，任何进程分配的块都可以由另一个进程释放，用于零拷贝进程间通信
+// 大小类比主内存池粗（128字节以内按8字节，更大的每次翻倍分4个），span大小同样按SizeClass::getSpanPages计算，
+// 没有线程缓存，每次分配直接在大小类的锁下进行
+// 段内所有元数据（空闲链表、span链表、页到span的映射）都用相对段起点的偏移或页号表示，
+// 每个进程的映射地址可以不同；在进程之间传递块时用toOffset/fromOffset转换
+// 同样的布局也可以放在普通文件里（openFile），进程重启后重新映射即可接着使用原有的对象和空闲链表，
+// 不必重建内存中的数据；通过setRoot/getRoot找回数据的入口
+// 段的布局：一页段头 | 每页56字节的页元数据（按页取整） | 数据页
+// 最小段为3页（12KB），只有一个数据页；小块的span至少SPAN_PAGES页，要分配小块段至少需要SPAN_PAGES + 2页
+// 限制：持锁进程崩溃会使对应的锁一直处于加锁状态
+
+class SharedMemoryPool
+{
+public:
+	//创建名为name的共享内存段并初始化，bytes为段的总大小；已存在或失败时返回nullptr
+	static std::unique_ptr<SharedMemoryPool> create(const char* name, size_t bytes);
+
+	//打开其他进程创建的段
+	static std::unique_ptr<SharedMemoryPool> open(const char* name);
+
+	//删除段的名字，已经映射的进程不受影响（Windows上最后一个句柄关闭时自动删除）
+	static bool remove(const char* name);
+
+	//打开文件堆：文件不存在或为空时按bytes创建并初始化，否则映射已有的堆，对象和空闲链表都保持原样
+	//baseHint为空时尽量映射回上次的基址，成功时对象中保存的裸指针仍然有效，可以用relocated()确认
+	//同一时间只能有一个进程打开；上次没有正常关闭（进程崩溃）的文件返回nullptr，需要删除后重建
+	static std::unique_ptr<SharedMemoryPool> openFile(const char* path, size_t bytes, void* baseHint = nullptr);
+
+#ifdef __linux__
+	//用memfd创建匿名段，通过fork继承或unix socket传递fd()给其他进程，再用attach映射
+	static std::unique_ptr<SharedMemoryPool> createAnonymous(size_t bytes);
+	static std::unique_ptr<SharedMemoryPool> attach(int fd);
+	int fd() const { return m_fd; }
+#endif
+
+	~SharedMemoryPool();
+
+	SharedMemoryPool(const SharedMemoryPool&) = delete;
+	SharedMemoryPool& operator=(const SharedMemoryPool&) = delete;
+
+	//分配size字节，段内空间不足时返回nullptr
+	void* allocate(size_t size);
+
+	//释放本段中的块，可以是任何进程分配的
+	void deallocate(void* ptr);
+
+	//块在段内的偏移，可以放进消息里传给其他进程
+	uint64_t toOffset(const void* ptr) const {
+		return static_cast<uint64_t>(static_cast<const char*>(ptr) - m_base);
+	}
+
+	void* fromOffset(uint64_t offset) const { return m_base + offset; }
+
+	bool contains(const void* ptr) const {
+		const char* p = static_cast<const char*>(ptr);
+		return p >= m_base && p < m_base + m_size;
+	}
+
+	//根对象：重新打开文件堆后从这里找回所有数据，保存的是偏移，基址变化也不受影响
+	void setRoot(void* ptr);
+	void* getRoot() const;
+
+	//文件堆本次映射的基址和上次不同，对象中保存的裸指针已经失效
+	bool relocated() const { return m_relocated; }
+
+	//把文件堆的修改写回磁盘，共享内存段上调用无效果
+	bool flush();
+
+	//段中可分配的页数和空闲页数
+	size_t pageCount() const;
+	size_t freePageCount() const;
+
+private:
+	struct Header;
+	struct SpanMeta;
+
+	SharedMemoryPool(char* base, size_t size, int fd, void* handle);
+
+	//映射完成后初始化（创建方）或校验（打开方）段头
+	static std::unique_ptr<SharedMemoryPool> initialize(char* base, size_t size, int fd, void* handle);
+	static std::unique_ptr<SharedMemoryPool> validate(char* base, size_t size, int fd, void* handle);
+
+	//文件堆打开后检查上次是否正常关闭，并记下本次的基址
+	static std::unique_ptr<SharedMemoryPool> persist(std::unique_ptr<SharedMemoryPool> pool);
+	static void* lastBaseOf(const char* base, size_t size);
+
+	//在页锁下按首次适应取pageNum页并标记为state，返回首页页号，失败返回NIL_PAGE
+	uint32_t allocatePages(uint32_t pageNum, uint32_t state);
+	void deallocatePages(uint32_t page);
+
+	void removeFreeRun(uint32_t page);
+	void pushFreeRun(uint32_t page);
+
+	Header* header() const { return reinterpret_cast<Header*>(m_base); }
+	SpanMeta* spans() const;
+	char* pageAddress(uint32_t page) const;
+	uint32_t pageOf(const void* ptr) const;
+
+private:
+	char* m_base;
+	size_t m_size;
+	int m_fd;       //POSIX下的文件描述符，-1表示没有
+	void* m_handle; //Windows下的文件映射句柄
+	void* m_file;   //Windows下文件堆的文件句柄
+	bool m_persistent;
+	bool m_relocated;
+};
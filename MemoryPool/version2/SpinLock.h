@@ -0,0 +1,119 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#endif
+
+// 自旋锁：先只读自旋（test-and-test-and-set）并指数退避，自旋一定次数仍拿不到就睡眠在futex上
+// 状态：0 未加锁，1 已加锁，2 已加锁且可能有线程在睡眠等待
+// ProcessShared为true时锁可以放在多个进程共享的内存中：Linux用非PRIVATE的futex，
+// Windows的WaitOnAddress只在进程内有效，改为让出时间片后重试
+template<bool ProcessShared>
+class BasicSpinLock
+{
+public:
+	bool try_lock() {
+		uint32_t expected = 0;
+		return m_state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+	}
+
+	void lock() {
+		if (!try_lock()) {
+			lockSlow();
+		}
+	}
+
+	void unlock() {
+		if (m_state.exchange(0, std::memory_order_release) == 2) {
+			wakeOne();
+		}
+	}
+
+private:
+	//退避多少轮后改为睡眠，每轮pause次数翻倍
+	static constexpr int MAX_SPIN_ROUNDS = 6;
+
+	static void cpuRelax() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		_mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+	void lockSlow() {
+		//先自旋：只读等待，锁看起来空闲时才尝试CAS，避免所有等待者反复写同一缓存行
+		int pauses = 1;
+		for (int round = 0; round < MAX_SPIN_ROUNDS; ++round) {
+			for (int i = 0; i < pauses; ++i) {
+				cpuRelax();
+			}
+			pauses <<= 1;
+			if (m_state.load(std::memory_order_relaxed) == 0 && try_lock()) {
+				return;
+			}
+		}
+
+		//再睡眠：把状态标成2，解锁方看到2才去唤醒
+		uint32_t state = m_state.exchange(2, std::memory_order_acquire);
+		while (state != 0) {
+			waitWhile(2);
+			state = m_state.exchange(2, std::memory_order_acquire);
+		}
+	}
+
+	void waitWhile(uint32_t value) {
+#ifdef _WIN32
+		if (ProcessShared) {
+			std::this_thread::yield();
+			return;
+		}
+		WaitOnAddress(&m_state, &value, sizeof(value), INFINITE);
+#elif defined(__linux__)
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state), ProcessShared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE,
+			value, nullptr, nullptr, 0);
+#else
+		if (m_state.load(std::memory_order_relaxed) == value) {
+			std::this_thread::yield();
+		}
+#endif
+	}
+
+	void wakeOne() {
+#ifdef _WIN32
+		if (!ProcessShared) {
+			WakeByAddressSingle(&m_state);
+		}
+#elif defined(__linux__)
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state), ProcessShared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE,
+			1, nullptr, nullptr, 0);
+#endif
+	}
+
+private:
+	std::atomic<uint32_t> m_state{ 0 };
+	static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+};
+
+using SpinLock = BasicSpinLock<false>;
+
+//放在共享内存中、多个进程一起使用的锁
+using SharedSpinLock = BasicSpinLock<true>;
@@ -1,7 +1,69 @@
 #include "ThreadCache.h"
 #include "CentralCache.h"
+#include "PageCache.h"
+#include "LargeCache.h"
+#include "Instrument.h"
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+namespace {
+	//˳߳µԶͷŶУжӲͷţ߳̿ʱȫط
+	std::mutex g_idleRemoteQueueMutex;
+	RemoteFreeQueue* g_idleRemoteQueues = nullptr;
+
+	//̻߳ȣѷ̵ָ߳ܶȣԼ͵ʱõ̻߳תλ
+	std::atomic<size_t> g_claimedBytes{ 0 };
+	std::mutex g_budgetMutex;
+	ThreadCache* g_threadCaches = nullptr;
+	ThreadCache* g_nextVictim = nullptr;
+
+	//̵߳ԶͷŶУ첽ͷŵ̰߳ѶĿƵֹ߳ͣΪ
+	std::atomic<RemoteFreeQueue*> g_offloadQueue{ nullptr };
+
+	//߳̿첽ͷź󣬻̵̰߳ļѯ
+	std::atomic<bool> g_offloadEnabled{ false };
+
+	//̣߳һ߳̿첽ͷŻȱ͵ʱ̬ʱֹͣ
+	struct OffloadReclaimer
+	{
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stop{ false };
+		std::thread thread;
+
+		~OffloadReclaimer() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stop = true;
+			}
+			wake.notify_all();
+			if (thread.joinable()) {
+				thread.join();
+			}
+		}
+	};
+
+	OffloadReclaimer& offloadReclaimer() {
+		//ĻPageCacheȹ죬֮߳ǰֹͣ
+		CentralCache::getInstance();
+		PageCache::getInstance();
+		static OffloadReclaimer reclaimer;
+		return reclaimer;
+	}
+
+	//̣߳ʲôʱ̲߳һѾǼǺö
+	OffloadReclaimer& startOffloadReclaimer(void (*run)()) {
+		OffloadReclaimer& reclaimer = offloadReclaimer();
+		std::lock_guard<std::mutex> lock(reclaimer.mutex);
+		if (!reclaimer.thread.joinable() && !reclaimer.stop) {
+			reclaimer.thread = std::thread(run);
+		}
+		return reclaimer;
+	}
+}
 
 ThreadCache* ThreadCache::getInstance() {
 	//ʾÿһ̶߳ӵinstanceһʵ
@@ -13,6 +75,369 @@ ThreadCache* ThreadCache::getInstance() {
 ThreadCache::ThreadCache() {
 	m_freeList.fill(nullptr);
 	m_freeListBlockNumArray.fill(0);
+	m_remoteFreeQueue = acquireRemoteFreeQueue();
+	m_offloadFree = false;
+	m_pressureEpoch = PageCache::getInstance().getPressureEpoch();
+	m_cachedBytes.store(0, std::memory_order_relaxed);
+	m_maxBytes.store(0, std::memory_order_relaxed);
+	m_scavengeState.store(SCAVENGE_NONE, std::memory_order_relaxed);
+	m_operationDepth.store(0, std::memory_order_relaxed);
+	//ȷϷʽ߳̽ʱͻ̰߳ͬһַʽ
+	EpochReclaimer::asymmetricFenceAvailable();
+	{
+		std::lock_guard<std::mutex> lock(g_budgetMutex);
+		m_prevCache = nullptr;
+		m_nextCache = g_threadCaches;
+		if (g_threadCaches) {
+			g_threadCaches->m_prevCache = this;
+		}
+		g_threadCaches = this;
+	}
+
+	//ͶҲҪܶãʹ߳͵ѷֳܶȲᳬthread_cache.total_bytes
+	//̶߳ѽͶʱ͵ֻ߳ԽСĶȿʼ
+	while (m_maxBytes.load(std::memory_order_relaxed) < THREAD_CACHE_MIN_BYTES) {
+		size_t maxBytes = m_maxBytes.load(std::memory_order_relaxed);
+		growBudget();
+		if (m_maxBytes.load(std::memory_order_relaxed) == maxBytes) {
+			break;
+		}
+	}
+}
+
+ThreadCache::~ThreadCache() {
+	//ȴժ²ضȣ̲֮߳汾߳С
+	{
+		std::lock_guard<std::mutex> lock(g_budgetMutex);
+		g_claimedBytes.fetch_sub(m_maxBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		if (g_nextVictim == this) {
+			g_nextVictim = m_nextCache;
+		}
+		if (m_prevCache) {
+			m_prevCache->m_nextCache = m_nextCache;
+		}
+		else {
+			g_threadCaches = m_nextCache;
+		}
+		if (m_nextCache) {
+			m_nextCache->m_prevCache = m_prevCache;
+		}
+	}
+
+	//ֹͣԶͷţٰѾƹĿջرһ黹
+	m_remoteFreeQueue->active.store(false, std::memory_order_release);
+	drainRemoteFreeQueue();
+	flush();
+
+	releaseRemoteFreeQueue(m_remoteFreeQueue);
+	m_remoteFreeQueue = nullptr;
+}
+
+void ThreadCache::flush() {
+	OperationScope scope(this);
+	for (size_t index = 0; index < FREE_LIST_NUM; ++index) {
+		if (m_freeList[index]) {
+			CentralCache::getInstance().returnRange(m_freeList[index], m_freeListBlockNumArray[index], index);
+			m_freeList[index] = nullptr;
+			m_freeListBlockNumArray[index] = 0;
+		}
+	}
+	m_cachedBytes.store(0, std::memory_order_relaxed);
+}
+
+size_t ThreadCache::reserve(size_t size, size_t count) {
+	size = size == 0 ? ALIGNMENT : size;
+	if (size > MAX_BYTES || count == 0) {
+		return 0; //鲻Ļ棬޷Ԥ
+	}
+	size_t index = SizeClass::getFreeListIndex(size);
+	OperationScope scope(this);
+
+	size_t readyNum = CentralCache::getInstance().reserve(index, count) + m_freeListBlockNumArray[index];
+
+	//̻߳黹ֵ˵һͷʱͻᱻĻ
+	size_t localNum = std::min(count, g_tuning.threadCacheMaxBlocks.load(std::memory_order_relaxed));
+	while (m_freeListBlockNumArray[index] < localNum) {
+		void* start = nullptr;
+		void* end = nullptr;
+		size_t fetched = CentralCache::getInstance().fetchRange(index, localNum - m_freeListBlockNumArray[index],
+			start, end, m_remoteFreeQueue);
+		if (fetched == 0) {
+			break;
+		}
+		*(reinterpret_cast<void**>(end)) = m_freeList[index];
+		m_freeList[index] = start;
+		m_freeListBlockNumArray[index] += fetched;
+		addCachedBytes(fetched * (index + 1) * ALIGNMENT);
+	}
+	return readyNum;
+}
+
+void ThreadCache::checkMemoryPressure() {
+	size_t epoch = PageCache::getInstance().getPressureEpoch();
+	if (epoch != m_pressureEpoch) {
+		m_pressureEpoch = epoch;
+		releaseAll();
+	}
+	//ȱ߳͵ߺ·ϰѻض
+	else if (getCachedBytes() > m_maxBytes.load(std::memory_order_relaxed)) {
+		scavenge();
+	}
+}
+
+void ThreadCache::handleBudgetOverflow() {
+	growBudget();
+	if (getCachedBytes() > m_maxBytes.load(std::memory_order_relaxed)) {
+		scavenge();
+	}
+}
+
+void ThreadCache::growBudget() {
+	if (m_maxBytes.load(std::memory_order_relaxed) + THREAD_CACHE_STEAL_BYTES > THREAD_CACHE_MAX_BYTES) {
+		return;
+	}
+
+	//ܶȻʣֱ࣬
+	size_t totalBytes = g_tuning.threadCacheTotalBytes.load(std::memory_order_relaxed);
+	size_t claimed = g_claimedBytes.load(std::memory_order_relaxed);
+	while (claimed + THREAD_CACHE_STEAL_BYTES <= totalBytes) {
+		if (g_claimedBytes.compare_exchange_weak(claimed, claimed + THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed)) {
+			m_maxBytes.fetch_add(THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	//ܶ꣬߳͵͵߳´νʱС棬һֱеɻ߳С
+	//õ̶߳Ȼᱻһ͵ͣæ̶߳ȱ
+	{
+		std::lock_guard<std::mutex> lock(g_budgetMutex);
+		for (ThreadCache* first = nullptr; ; ) {
+			ThreadCache* victim = g_nextVictim ? g_nextVictim : g_threadCaches;
+			if (!victim || victim == first) {
+				return; //תһȦ͵
+			}
+			if (!first) {
+				first = victim;
+			}
+			g_nextVictim = victim->m_nextCache;
+
+			if (victim != this && victim->m_maxBytes.load(std::memory_order_relaxed) >= THREAD_CACHE_MIN_BYTES + THREAD_CACHE_STEAL_BYTES) {
+				victim->m_maxBytes.fetch_sub(THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+				//ڼ̲߳ᴦRUNNINGֱӸ
+				victim->m_scavengeState.store(SCAVENGE_REQUESTED, std::memory_order_relaxed);
+				m_maxBytes.fetch_add(THREAD_CACHE_STEAL_BYTES, std::memory_order_relaxed);
+				break;
+			}
+		}
+	}
+	//ڳжʱ̹߳Լ̻߳ʱҲҪ
+	startOffloadReclaimer(runOffloadReclaimer);
+}
+
+void ThreadCache::scavenge() {
+	size_t targetBytes = m_maxBytes.load(std::memory_order_relaxed) / 2;
+	//ȱ͵ߺܶʱһּ벻һֱתĿΪֹ
+	while (getCachedBytes() > targetBytes) {
+		for (size_t index = FREE_LIST_NUM; index-- > 0 && getCachedBytes() > targetBytes; ) {
+			size_t blockNum = m_freeListBlockNumArray[index];
+			if (blockNum == 0) {
+				continue;
+			}
+			//ͷȵһ
+			releaseListTail(index, blockNum / 2);
+		}
+	}
+}
+
+void ThreadCache::handleScavengeRequest() {
+	int state = m_scavengeState.load(std::memory_order_acquire);
+	while (state != SCAVENGE_NONE) {
+		if (state == SCAVENGE_RUNNING) {
+			//߳汾߳С棬
+			std::this_thread::yield();
+			state = m_scavengeState.load(std::memory_order_acquire);
+		}
+		else if (m_scavengeState.compare_exchange_weak(state, SCAVENGE_NONE, std::memory_order_acquire, std::memory_order_acquire)) {
+			if (getCachedBytes() > m_maxBytes.load(std::memory_order_relaxed)) {
+				scavenge();
+			}
+			return;
+		}
+	}
+}
+
+void ThreadCache::scavengeIdleCaches() {
+	ThreadCache* self = getInstance();
+	std::lock_guard<std::mutex> lock(g_budgetMutex);
+
+	//ȰĶRUNNINGһ֮߳ҪôѱڲҪôʱһRUNNING
+	bool anyRunning = false;
+	for (ThreadCache* cache = g_threadCaches; cache; cache = cache->m_nextCache) {
+		int expected = SCAVENGE_REQUESTED;
+		if (cache != self && cache->m_scavengeState.compare_exchange_strong(expected, SCAVENGE_RUNNING, std::memory_order_relaxed)) {
+			anyRunning = true;
+		}
+	}
+	if (!anyRunning) {
+		return;
+	}
+	EpochReclaimer::asymmetricHeavyFence();
+
+	for (ThreadCache* cache = g_threadCaches; cache; cache = cache->m_nextCache) {
+		if (cache->m_scavengeState.load(std::memory_order_relaxed) != SCAVENGE_RUNNING) {
+			continue;
+		}
+		if (cache->m_operationDepth.load(std::memory_order_acquire) != 0) {
+			//߳ڲԼ
+			cache->m_scavengeState.store(SCAVENGE_REQUESTED, std::memory_order_release);
+			continue;
+		}
+		if (cache->getCachedBytes() > cache->m_maxBytes.load(std::memory_order_relaxed)) {
+			cache->scavenge();
+		}
+		cache->m_scavengeState.store(SCAVENGE_NONE, std::memory_order_release);
+	}
+}
+
+void ThreadCache::releaseAll() {
+	drainIdleRemoteQueues();
+	if (!m_offloadFree) {
+		flush();
+		return;
+	}
+	for (size_t index = 0; index < FREE_LIST_NUM; ++index) {
+		if (m_freeList[index]) {
+			m_freeList[index] = releaseBlocks(m_freeList[index], m_freeListBlockNumArray[index], index);
+			m_freeListBlockNumArray[index] = 0;
+		}
+	}
+	m_cachedBytes.store(0, std::memory_order_relaxed);
+}
+
+void ThreadCache::setOffloadFree(bool enable) {
+	if (enable) {
+		g_offloadEnabled.store(true, std::memory_order_relaxed);
+	}
+	if (enable && !g_offloadQueue.load(std::memory_order_acquire)) {
+		OffloadReclaimer& reclaimer = startOffloadReclaimer(runOffloadReclaimer);
+		std::unique_lock<std::mutex> lock(reclaimer.mutex);
+		//Ȼ̵߳ǼǺԼĶУ֮ƹȥĿ鲻ᶪ
+		reclaimer.wake.wait(lock, [&reclaimer] {
+			return reclaimer.stop || g_offloadQueue.load(std::memory_order_acquire) != nullptr;
+		});
+	}
+	//߳汾߳Сʱ־
+	OperationScope scope(this);
+	m_offloadFree = enable;
+}
+
+size_t ThreadCache::getOffloadBacklog() {
+	RemoteFreeQueue* queue = g_offloadQueue.load(std::memory_order_acquire);
+	return queue ? queue->blockNum.load(std::memory_order_relaxed) : 0;
+}
+
+void ThreadCache::runOffloadReclaimer() {
+	ThreadCache* cache = getInstance();
+	OffloadReclaimer& reclaimer = offloadReclaimer();
+
+	std::unique_lock<std::mutex> lock(reclaimer.mutex);
+	g_offloadQueue.store(cache->m_remoteFreeQueue, std::memory_order_release);
+	reclaimer.wake.notify_all();
+
+	//ͷ̴߳Ӳѻ̶̣߳ѯֻΪС̻߳ʱ
+	auto lastScavenge = std::chrono::steady_clock::now();
+	while (!reclaimer.stop) {
+		size_t intervalUs = g_offloadEnabled.load(std::memory_order_relaxed) ? OFFLOAD_RECLAIM_INTERVAL_US : THREAD_CACHE_SCAVENGE_INTERVAL_US;
+		reclaimer.wake.wait_for(lock, std::chrono::microseconds(intervalUs));
+		lock.unlock();
+		//spanӴСѿspanPageCache
+		cache->drainRemoteFreeQueue();
+		cache->flush();
+		drainIdleRemoteQueues();
+
+		auto now = std::chrono::steady_clock::now();
+		if (now - lastScavenge >= std::chrono::microseconds(THREAD_CACHE_SCAVENGE_INTERVAL_US)) {
+			lastScavenge = now;
+			scavengeIdleCaches();
+		}
+		lock.lock();
+	}
+
+	//֮첽ͷŵ߳˻ͬ黹ʣµĿڱ̻߳ʱ黹
+	g_offloadQueue.store(nullptr, std::memory_order_release);
+}
+
+RemoteFreeQueue* ThreadCache::acquireRemoteFreeQueue() {
+	RemoteFreeQueue* queue = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(g_idleRemoteQueueMutex);
+		if (g_idleRemoteQueues) {
+			queue = g_idleRemoteQueues;
+			g_idleRemoteQueues = queue->nextIdle;
+		}
+	}
+	if (!queue) {
+		queue = new RemoteFreeQueue;
+	}
+	queue->nextIdle = nullptr;
+	//õĶܻ߳˳ƹĿ飬´δʱһ
+	queue->active.store(true, std::memory_order_release);
+	return queue;
+}
+
+void ThreadCache::releaseRemoteFreeQueue(RemoteFreeQueue* queue) {
+	std::lock_guard<std::mutex> lock(g_idleRemoteQueueMutex);
+	queue->nextIdle = g_idleRemoteQueues;
+	g_idleRemoteQueues = queue;
+}
+
+size_t ThreadCache::drainIdleRemoteQueues() {
+	CentralCache& centralCache = CentralCache::getInstance();
+	size_t drainedNum = 0;
+
+	//ڼû߳ȡ߶Уֻ߳̾
+	std::lock_guard<std::mutex> lock(g_idleRemoteQueueMutex);
+	for (RemoteFreeQueue* queue = g_idleRemoteQueues; queue; queue = queue->nextIdle) {
+		if (!queue->head.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		void* current = queue->head.exchange(nullptr, std::memory_order_acquire);
+		size_t queueNum = 0;
+
+		//вͬСĿ飬ͬһСܳһι黹
+		void* runHead = nullptr;
+		void* runTail = nullptr;
+		size_t runNum = 0;
+		size_t runIndex = 0;
+		while (current) {
+			void* next = *(reinterpret_cast<void**>(current));
+			SpanTracker* span = centralCache.getSpanTracker(current);
+			assert(span);
+			if (runHead && span->index != runIndex) {
+				centralCache.returnRange(runHead, runNum, runIndex);
+				runHead = nullptr;
+				runNum = 0;
+			}
+			*(reinterpret_cast<void**>(current)) = nullptr;
+			if (runHead) {
+				*(reinterpret_cast<void**>(runTail)) = current;
+			}
+			else {
+				runHead = current;
+				runIndex = span->index;
+			}
+			runTail = current;
+			++runNum;
+			++queueNum;
+			current = next;
+		}
+		if (runHead) {
+			centralCache.returnRange(runHead, runNum, runIndex);
+		}
+		queue->blockNum.fetch_sub(queueNum, std::memory_order_relaxed);
+		drainedNum += queueNum;
+	}
+	return drainedNum;
 }
 
 void* ThreadCache::allocate(size_t size) {
@@ -21,79 +446,61 @@ void* ThreadCache::allocate(size_t size) {
 	size = size == 0 ? ALIGNMENT : size;
 
 	if(size>MAX_BYTES) {
-		//256KBֱϵͳ
-		return malloc(size);
+		//256KBLARGE_MAX_BYTESİСCPUȡspanֱmalloc
+		return size <= LARGE_MAX_BYTES ? LargeObjectCache::getInstance().allocate(size) : malloc(size);
 	}
 	size_t index = SizeClass::getFreeListIndex(size);
-	//std::cout << "allocate::index="<< index <<std::endl;
-	void* ret = m_freeList[index];
-	if (ret) {
-		//̱߳
-		//ͷ㡰ջ
-		// ѵǰ ret ָһȡΪµͷ m_freeList[index]
-		m_freeList[index] = *(reinterpret_cast<void**>(ret));
-
-		//Сͳ
-		--m_freeListBlockNumArray[index];
-		return ret;
-	} else {
-		//̱߳δУCentralCacheȡ
-		return fetchFromCentralCache(index);
-	}
+	return allocateByIndex(index);
 }
 
 void* ThreadCache::fetchFromCentralCache(size_t index) {
-
+	MP_LATENCY_SCOPE(LatencyTier::FetchFromCentralCache);
+	checkMemoryPressure();
+
+	//̻߳Ŀ飬оͲȥĻ
+	if (m_remoteFreeQueue->head.load(std::memory_order_relaxed)) {
+		drainRemoteFreeQueue();
+
+		void* ret = m_freeList[index];
+		if (ret) {
+			m_freeList[index] = *(reinterpret_cast<void**>(ret));
+			--m_freeListBlockNumArray[index];
+			subCachedBytes((index + 1) * ALIGNMENT);
+			return ret;
+		}
+	}
 
 	size_t batchNum = getBatchBlockNum((index + 1) * ALIGNMENT);
+	MP_TRACE(fetch_from_central, index, batchNum);
 	
-	//Ļȡڴ
-	void* ret = CentralCache::getInstance().fetchRange(index, batchNum);
-
+	//Ļȡڴ飬βָһٱ
+	void* start = nullptr;
+	void* end = nullptr;
+	size_t blockNum = CentralCache::getInstance().fetchRange(index, batchNum, start, end, m_remoteFreeQueue);
 
 	//ȡʧ
-	if(!ret) {
+	if (blockNum == 0) {
 		return nullptr;
 	}
 
-	//һڴ鷵ظߣʣĲ뵽̱߳
-	void* current = *(reinterpret_cast<void**>(ret));
-	
-	*(reinterpret_cast<void**>(ret)) = nullptr;
-
-	//ͷ
-	m_freeList[index] = current;
-
-	//std::cout << "current=0x" << std::hex << reinterpret_cast<uintptr_t>(current) << std::dec << std::endl;
-	//㵱ǰиôСڴж
-	size_t blockNum = 0;
-	while (current) {
-		//std::cout << "" << std::this_thread::get_id() << " ThreadCache fetchFromCentralCache index=" << index << " current=0x" << std::hex << reinterpret_cast<uintptr_t>(current) << std::dec << std::endl;
-		++blockNum;
-		current = *(reinterpret_cast<void**>(current));
+	//һڴ鷵ظߣʣνӵͷ
+	//ڴ޻صڼп鱻ͷŻֱӸǣ
+	if (blockNum > 1) {
+		*(reinterpret_cast<void**>(end)) = m_freeList[index];
+		m_freeList[index] = *(reinterpret_cast<void**>(start));
+		m_freeListBlockNumArray[index] += blockNum - 1;
+		addCachedBytes((blockNum - 1) * (index + 1) * ALIGNMENT);
 	}
 
-	//Сͳ
-	m_freeListBlockNumArray[index] += blockNum;
-
-	return ret; 
+	return start;
 }
 
 size_t ThreadCache::getBatchBlockNum(size_t size) {
-	// ׼ÿȡ4KBڴ
-	constexpr size_t MAX_BATCH_BLOCK_SIZE = 4*1024; //4KB
-
-	size_t baseNum;
-	if (size <= 32) baseNum = 64;   //64*32=2048B  2KB
-	else if (size <= 64) baseNum = 32;  //32*64=2048B 2KB
-	else if (size <= 128) baseNum = 16; //16*128=2048B  2KB
-	else if (size <= 256) baseNum = 8;  //8*256=2048B  2KB
-	else if (size <= 512) baseNum = 4;  //4*512=2048B   2KB
-	else if (size <= 1024) baseNum = 2; //2*1KB=2048B  2KB
-	else baseNum = 1;
-
-	return baseNum;
-	
+	// ׼ÿȡԼthread_cache.batch_bytesĬ2KBڴ棬С641
+	constexpr size_t MAX_BATCH_BLOCK_NUM = 64;
+
+	size_t batchBytes = g_tuning.threadCacheBatchBytes.load(std::memory_order_relaxed);
+	return std::min(MAX_BATCH_BLOCK_NUM, std::max<size_t>(1, batchBytes / size));
 
 }
 
@@ -101,75 +508,286 @@ void ThreadCache::deallocate(void* ptr, size_t size) {
 	assert(ptr != nullptr && size >= 0);
 
 	if (size > MAX_BYTES) {
-		free(ptr);
+		if (size <= LARGE_MAX_BYTES) {
+			LargeObjectCache::getInstance().deallocate(ptr, size);
+		}
+		else {
+			free(ptr);
+		}
 		return;
 	}
 
 	size_t index = SizeClass::getFreeListIndex(size);
-	//ڴ뵽̱߳ͷ
-	*(reinterpret_cast<void**>(ptr)) = m_freeList[index];
-	m_freeList[index] = ptr;
-	//Сͳ
-	++m_freeListBlockNumArray[index];
-	if(shouldReturnToCentralCache(index)) {
-		returnToCentralCache(m_freeList[index], size);
+	deallocateByIndex(ptr, index);
+}
+
+size_t ThreadCache::allocateBatch(size_t size, size_t n, void** out) {
+	assert(out != nullptr || n == 0);
+
+	size = size == 0 ? ALIGNMENT : size;
+
+	if (size > MAX_BYTES) {
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = allocate(size);
+			if (!out[i]) {
+				return i;
+			}
+		}
+		return n;
 	}
 
+	//ֻһ±
+	size_t index = SizeClass::getFreeListIndex(size);
+	size_t count = 0;
+	OperationScope scope(this);
 
+	//ȴ̱߳ȡ
+	void* current = m_freeList[index];
+	while (current && count < n) {
+		out[count++] = current;
+		current = *(reinterpret_cast<void**>(current));
+	}
+	m_freeList[index] = current;
+	m_freeListBlockNumArray[index] -= count;
+	subCachedBytes(count * (index + 1) * ALIGNMENT);
+
+	if (count < n && m_remoteFreeQueue->head.load(std::memory_order_relaxed)) {
+		drainRemoteFreeQueue();
+
+		current = m_freeList[index];
+		size_t taken = 0;
+		while (current && count < n) {
+			out[count++] = current;
+			current = *(reinterpret_cast<void**>(current));
+			++taken;
+		}
+		m_freeList[index] = current;
+		m_freeListBlockNumArray[index] -= taken;
+		subCachedBytes(taken * (index + 1) * ALIGNMENT);
+	}
+
+	//ĲֱĻҪ̱߳
+	while (count < n) {
+		void* start = nullptr;
+		void* end = nullptr;
+		size_t fetched = CentralCache::getInstance().fetchRange(index, n - count, start, end, m_remoteFreeQueue);
+		if (fetched == 0) {
+			break;
+		}
+		for (size_t i = 0; i < fetched; ++i) {
+			out[count++] = start;
+			start = *(reinterpret_cast<void**>(start));
+		}
+	}
+	return count;
 }
 
-bool ThreadCache::shouldReturnToCentralCache(size_t index) {
+void ThreadCache::deallocateBatch(void** ptrs, size_t n, size_t size) {
+	assert(ptrs != nullptr || n == 0);
+	if (n == 0) {
+		return;
+	}
+
+	if (size > MAX_BYTES) {
+		for (size_t i = 0; i < n; ++i) {
+			deallocate(ptrs[i], size);
+		}
+		return;
+	}
+
+	size = size == 0 ? ALIGNMENT : size;
+	size_t index = SizeClass::getFreeListIndex(size);
+	OperationScope scope(this);
 
-	//򵥲ԣĳеڴ40ʱ黹һĻ
-	return m_freeListBlockNumArray[index] > THREAD_FREE_BLOCK_THRESHOLD;
+	//Ȱ鴮ӵͷ
+	for (size_t i = 0; i + 1 < n; ++i) {
+		*(reinterpret_cast<void**>(ptrs[i])) = ptrs[i + 1];
+	}
+	*(reinterpret_cast<void**>(ptrs[n - 1])) = m_freeList[index];
+	m_freeList[index] = ptrs[0];
+	m_freeListBlockNumArray[index] += n;
+	addCachedBytes(n * (index + 1) * ALIGNMENT);
+
+	if (shouldReturnToCentralCache(index)) {
+		returnToCentralCache(m_freeList[index], size);
+	}
+	//keep_percentӽ100ʱ黹ú٣黹֮Ҫȣֻͷŵ̻߳һֱ
+	if (getCachedBytes() > m_maxBytes.load(std::memory_order_relaxed)) {
+		handleBudgetOverflow();
+	}
 }
 
 void ThreadCache::returnToCentralCache(void* start, size_t size) {
+	MP_LATENCY_SCOPE(LatencyTier::ReturnToCentralCache);
+
 	//ݴС±
 	size_t index = SizeClass::getFreeListIndex(size);
 
-	//ڴʵʴС
-	size_t alignedSize = SizeClass::roundUp(size);
-
 	//Ҫ黹ڴ
 	size_t totalBlockNum = m_freeListBlockNumArray[index];
 
 	if (totalBlockNum <= 1) {
 		return; //ٱһڴ
 	}
+	MP_TRACE(return_to_central, index, totalBlockNum);
 
-	//1/4ڴThreadCache
-	size_t blocksToKeep = totalBlockNum / 4;
-	size_t blocksToReturn = totalBlockNum - blocksToKeep;
+	//ڴʱһ黹
+	size_t epoch = PageCache::getInstance().getPressureEpoch();
+	if (epoch != m_pressureEpoch) {
+		m_pressureEpoch = epoch;
+		releaseAll();
+		return;
+	}
 
-	//ڴ鴮                             
-	char* splitNode = static_cast<char*>(start);
-	//һҪڴ                                                                                   
-	for (size_t i = 0; i < blocksToReturn - 1; ++i) {
-		splitNode = static_cast<char*>(*(reinterpret_cast<void**>(splitNode)));
+	//һ֣Ĭ1/4ڴThreadCacheУ黹
+	size_t blocksToKeep = totalBlockNum * g_tuning.threadCacheKeepPercent.load(std::memory_order_relaxed) / 100;
+	if (blocksToKeep == 0) {
+		blocksToKeep = 1;
+	}
+	assert(start == m_freeList[index]);
+	(void)start;
+	releaseListTail(index, blocksToKeep);
+}
 
-		//ǰʵʵķ
-		if (splitNode == nullptr) {
-			blocksToKeep = i + 1;
-			blocksToReturn = totalBlockNum - blocksToKeep;
-			break;
+void ThreadCache::releaseListTail(size_t index, size_t keepNum) {
+	size_t blockNum = m_freeListBlockNumArray[index];
+	if (keepNum >= blockNum) {
+		return;
+	}
+	size_t releaseNum = blockNum - keepNum;
+
+	//ͷͷŵĿ飬CPUֻ̣߳߹ļ飬黹β
+	if (keepNum == 0) {
+		m_freeList[index] = releaseBlocks(m_freeList[index], releaseNum, index);
+	}
+	else {
+		void* keepTail = m_freeList[index];
+		for (size_t i = 1; i < keepNum; ++i) {
+			keepTail = *(reinterpret_cast<void**>(keepTail));
+		}
+		void* releaseStart = *(reinterpret_cast<void**>(keepTail));
+		*(reinterpret_cast<void**>(keepTail)) = releaseBlocks(releaseStart, releaseNum, index);
+	}
+	m_freeListBlockNumArray[index] = keepNum;
+	subCachedBytes(releaseNum * (index + 1) * ALIGNMENT);
+}
+
+void* ThreadCache::releaseBlocks(void* start, size_t blockNum, size_t index) {
+	//첽ͷţƸֻ̣߳ҵβspanҲ
+	RemoteFreeQueue* offloadQueue = m_offloadFree ? g_offloadQueue.load(std::memory_order_acquire) : nullptr;
+	if (offloadQueue && blockNum > 0) {
+		void* tail = start;
+		for (size_t i = 1; i < blockNum; ++i) {
+			tail = *(reinterpret_cast<void**>(tail));
 		}
+		void* rest = *(reinterpret_cast<void**>(tail));
+
+		void* oldHead = offloadQueue->head.load(std::memory_order_relaxed);
+		do {
+			*(reinterpret_cast<void**>(tail)) = oldHead;
+		} while (!offloadQueue->head.compare_exchange_weak(oldHead, start,
+			std::memory_order_release, std::memory_order_relaxed));
+		offloadQueue->blockNum.fetch_add(blockNum, std::memory_order_relaxed);
+		return rest;
 	}
 
-	if (splitNode) {
-		//ҪĲֺҪ黹ĲֶϿ
-		void* returnStart = *(reinterpret_cast<void**>(splitNode));
+	CentralCache& centralCache = CentralCache::getInstance();
 
-		*(reinterpret_cast<void**>(splitNode)) = nullptr;
+	//ҪĻĿ
+	void* centralHead = nullptr;
+	void* centralTail = nullptr;
+	size_t centralNum = 0;
 
-		//ThreadCacheеͷ
-		m_freeList[index] = start;
-		//ThreadCacheеͳ
-		m_freeListBlockNumArray[index] = blocksToKeep;
-		
-		//黹ڴĻ
-		if (blocksToKeep > 0 && returnStart != nullptr) {
-			CentralCache::getInstance().returnRange(returnStart,alignedSize*blocksToReturn,index);
+	//ͬһ̵߳ĿܳһΣһCASԶͷŶ
+	RemoteFreeQueue* runOwner = nullptr;
+	void* runHead = nullptr;
+	void* runTail = nullptr;
+	size_t runNum = 0;
+
+	auto flushRun = [&]() {
+		if (!runHead) {
+			return;
+		}
+		void* oldHead = runOwner->head.load(std::memory_order_relaxed);
+		do {
+			*(reinterpret_cast<void**>(runTail)) = oldHead;
+		} while (!runOwner->head.compare_exchange_weak(oldHead, runHead,
+			std::memory_order_release, std::memory_order_relaxed));
+		runOwner->blockNum.fetch_add(runNum, std::memory_order_relaxed);
+		runHead = runTail = nullptr;
+		runNum = 0;
+	};
+
+	size_t remoteQueueLimit = g_tuning.remoteFreeQueueLimit.load(std::memory_order_relaxed);
+	void* current = start;
+	for (size_t i = 0; i < blockNum; ++i) {
+		void* next = *(reinterpret_cast<void**>(current));
+
+		//黹û黹spanһ
+		SpanTracker* span = centralCache.getSpanTracker(current);
+		RemoteFreeQueue* owner = span ? span->owner.load(std::memory_order_relaxed) : nullptr;
+
+		//ԼĿ顢߳˳лѹ̫Ŀ飬Ļ
+		if (owner == m_remoteFreeQueue || (owner && (!owner->active.load(std::memory_order_acquire)
+			|| owner->blockNum.load(std::memory_order_relaxed) >= remoteQueueLimit))) {
+			owner = nullptr;
 		}
+
+		if (!owner) {
+			*(reinterpret_cast<void**>(current)) = nullptr;
+			if (centralTail) {
+				*(reinterpret_cast<void**>(centralTail)) = current;
+			}
+			else {
+				centralHead = current;
+			}
+			centralTail = current;
+			++centralNum;
+		}
+		else {
+			if (owner != runOwner) {
+				flushRun();
+				runOwner = owner;
+			}
+			*(reinterpret_cast<void**>(current)) = runHead;
+			if (!runHead) {
+				runTail = current;
+			}
+			runHead = current;
+			++runNum;
+		}
+		current = next;
+	}
+	flushRun();
+
+	if (centralHead) {
+		centralCache.returnRange(centralHead, centralNum, index);
+	}
+	return current;
+}
+
+void ThreadCache::drainRemoteFreeQueue() {
+	void* current = m_remoteFreeQueue->head.exchange(nullptr, std::memory_order_acquire);
+	size_t drainedNum = 0;
+	CentralCache& centralCache = CentralCache::getInstance();
+
+	//вͬСĿ飬ͨspanҵС
+	while (current) {
+		void* next = *(reinterpret_cast<void**>(current));
+		SpanTracker* span = centralCache.getSpanTracker(current);
+		assert(span);
+		size_t index = span->index;
+
+		*(reinterpret_cast<void**>(current)) = m_freeList[index];
+		m_freeList[index] = current;
+		++m_freeListBlockNumArray[index];
+		addCachedBytes((index + 1) * ALIGNMENT);
+
+		++drainedNum;
+		current = next;
+	}
+
+	if (drainedNum > 0) {
+		m_remoteFreeQueue->blockNum.fetch_sub(drainedNum, std::memory_order_relaxed);
 	}
 }
@@ -1,6 +1,19 @@
 ﻿#pragma once
 #include "Common.h"
+#include "Tuning.h"
+#include "Epoch.h"
 #include <array>
+#include <atomic>
+
+//远程释放队列：其他线程释放的、属于本线程所取span的内存块先挂在这里
+//多生产者push，只有所属线程整体取走，因此没有ABA问题
+struct RemoteFreeQueue
+{
+	std::atomic<void*> head{ nullptr };
+	std::atomic<size_t> blockNum{ 0 };    //积压的块数（近似值）
+	std::atomic<bool> active{ false };    //所属线程是否还在运行
+	RemoteFreeQueue* nextIdle{ nullptr }; //线程退出后挂到全局空闲链表，供新线程复用
+};
 
 class ThreadCache
 {
@@ -9,8 +22,44 @@ public:
 	void* allocate(size_t size);
 	void deallocate(void* ptr, size_t size);
 
+	//按大小类下标分配/释放，ObjectPool在编译期算好下标后直接走这里，不再计算大小
+	void* allocateByIndex(size_t index);
+	void deallocateByIndex(void* ptr, size_t index);
+
+	//一次申请n个同样大小的内存块写入out，返回实际申请到的个数
+	size_t allocateBatch(size_t size, size_t n, void** out);
+
+	//一次释放n个同样大小的内存块
+	void deallocateBatch(void** ptrs, size_t n, size_t size);
+
+	//把本线程缓存的内存块全部归还给中心缓存
+	void flush();
+
+	//本线程缓存中的字节数和当前额度，其他线程也可以读（近似值）
+	size_t getCachedBytes() const { return m_cachedBytes.load(std::memory_order_relaxed); }
+	size_t getMaxCachedBytes() const { return m_maxBytes.load(std::memory_order_relaxed); }
+
+	//异步释放：开启后本线程缓存溢出时，多出来的块整段推给后台回收线程，由它归还中心缓存和PageCache
+	//释放路径上只剩走链表和一次CAS，不加锁也不进入系统调用；第一次开启时启动回收线程
+	void setOffloadFree(bool enable);
+	bool getOffloadFree() const { return m_offloadFree; }
+
+	//已推给回收线程、还没归还的块数（近似值）
+	static size_t getOffloadBacklog();
+
+	//把已退出线程的队列中积压的块还给中心缓存，返回归还的块数
+	//其他线程判断所属线程仍在运行后才推入，这些块可能落在刚退出线程的队列里，没有新线程复用队列就一直无人收下
+	static size_t drainIdleRemoteQueues();
+
+	//预留count个size大小的内存块：中心缓存备好预先缺页的span，本线程缓存填到阈值为止
+	//返回不用再向系统申请就能分配的块数
+	size_t reserve(size_t size, size_t count);
+
 private:
 	ThreadCache();
+
+	//线程退出时把缓存的内存块全部归还给中心缓存，否则span永远无法完全空闲
+	~ThreadCache();
 	void* fetchFromCentralCache(size_t index);
 
 	//批量获取内存块的数量
@@ -22,6 +71,68 @@ private:
 	// 归还内存到中心缓存
 	void returnToCentralCache(void* start, size_t size);
 
+	//保留自由链表头部的keepNum个块，其余归还（见releaseBlocks）
+	void releaseListTail(size_t index, size_t keepNum);
+
+	//把从start开始的blockNum个块按span所属线程分发：属于其他线程的推入其远程释放队列，其余归还中心缓存
+	//返回第blockNum个块之后的链表
+	void* releaseBlocks(void* start, size_t blockNum, size_t index);
+
+	//把其他线程还回来的块收进本地自由链表
+	void drainRemoteFreeQueue();
+
+	//PageCache超过软上限后，各线程在慢路径上发现并清空自己的缓存
+	void checkMemoryPressure();
+
+	//内存紧张时清空缓存：异步释放模式下推给回收线程，否则直接归还中心缓存
+	void releaseAll();
+
+	//回收线程：定期把推过来的块收进自己的缓存再整体归还
+	static void runOffloadReclaimer();
+
+	//缓存字节数超过额度：先扩大额度，仍然超出就缩小缓存
+	void handleBudgetOverflow();
+
+	//从未分配的总额度或其他线程的额度中拿THREAD_CACHE_STEAL_BYTES
+	void growBudget();
+
+	//从大块开始把各自由链表归还一半给中心缓存，直到缓存降到额度的一半
+	void scavenge();
+
+	//回收线程定期调用：替额度被偷走、一直没有操作的线程缩小缓存
+	//所属线程正在操作自由链表的跳过，留给它下次进入时自己缩小
+	static void scavengeIdleCaches();
+
+	//所属线程进入/离开操作自由链表的公有函数，可以嵌套
+	//最外层进入时若有缩小请求，等回收线程做完或者自己缩小
+	void beginOperation();
+	void endOperation();
+	void handleScavengeRequest();
+
+	//作用域内所属线程在操作自由链表
+	class OperationScope
+	{
+	public:
+		explicit OperationScope(ThreadCache* cache) : m_cache(cache) { m_cache->beginOperation(); }
+		~OperationScope() { m_cache->endOperation(); }
+
+		OperationScope(const OperationScope&) = delete;
+		OperationScope& operator=(const OperationScope&) = delete;
+
+	private:
+		ThreadCache* m_cache;
+	};
+
+	//只有所属线程修改，修改时不和其他线程竞争，不需要原子读改写
+	void addCachedBytes(size_t bytes) {
+		m_cachedBytes.store(m_cachedBytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+	}
+	void subCachedBytes(size_t bytes) {
+		m_cachedBytes.store(m_cachedBytes.load(std::memory_order_relaxed) - bytes, std::memory_order_relaxed);
+	}
+
+	static RemoteFreeQueue* acquireRemoteFreeQueue();
+	static void releaseRemoteFreeQueue(RemoteFreeQueue* queue);
 
 
 private:
@@ -30,5 +141,84 @@ private:
 
 	//自由链表中空闲内存块统计，当超过阈值时归还给中心缓存
 	std::array<size_t, FREE_LIST_NUM> m_freeListBlockNumArray;  
+
+	//本线程的远程释放队列
+	RemoteFreeQueue* m_remoteFreeQueue;
+
+	//是否把多出来的块交给回收线程归还
+	bool m_offloadFree;
+
+	//上次看到的PageCache内存压力计数
+	size_t m_pressureEpoch;
+
+	//自由链表中所有块的总字节数，只有本线程（或替它缩小缓存的回收线程）修改
+	std::atomic<size_t> m_cachedBytes;
+
+	//本线程的额度，其他线程偷额度时会减小它，本线程下次进入或回收线程定期检查时缩小缓存
+	std::atomic<size_t> m_maxBytes;
+
+	//缩小请求：额度被偷后置为REQUESTED；回收线程替本线程缩小期间为RUNNING，本线程此时不能碰自由链表
+	enum ScavengeState : int
+	{
+		SCAVENGE_NONE,
+		SCAVENGE_REQUESTED,
+		SCAVENGE_RUNNING,
+	};
+	std::atomic<int> m_scavengeState;
+
+	//本线程正在执行的公有操作层数，只有本线程修改，回收线程据此判断能否替它缩小
+	std::atomic<size_t> m_operationDepth;
+
+	//所有线程缓存串成的链表，偷额度时轮流挑选，受全局额度锁保护
+	ThreadCache* m_prevCache;
+	ThreadCache* m_nextCache;
 };
 
+inline bool ThreadCache::shouldReturnToCentralCache(size_t index) {
+	//简单策略：当某个自由链表中的内存块数量超过阈值时，归还大部分给中心缓存
+	return m_freeListBlockNumArray[index] > g_tuning.threadCacheMaxBlocks.load(std::memory_order_relaxed);
+}
+
+inline void ThreadCache::beginOperation() {
+	size_t depth = m_operationDepth.load(std::memory_order_relaxed);
+	m_operationDepth.store(depth + 1, std::memory_order_relaxed);
+	//层数的写必须先于读缩小状态和自由链表，和回收线程的重屏障配对
+	EpochReclaimer::asymmetricLightFence();
+	if (depth == 0 && m_scavengeState.load(std::memory_order_acquire) != SCAVENGE_NONE) {
+		handleScavengeRequest();
+	}
+}
+
+inline void ThreadCache::endOperation() {
+	m_operationDepth.store(m_operationDepth.load(std::memory_order_relaxed) - 1, std::memory_order_release);
+}
+
+inline void* ThreadCache::allocateByIndex(size_t index) {
+	OperationScope scope(this);
+	void* ret = m_freeList[index];
+	if (ret) {
+		//线程本地自由链表命中，头结点出栈
+		m_freeList[index] = *(reinterpret_cast<void**>(ret));
+		--m_freeListBlockNumArray[index];
+		subCachedBytes((index + 1) * ALIGNMENT);
+		return ret;
+	}
+	//线程本地自由链表未命中，从CentralCache获取
+	return fetchFromCentralCache(index);
+}
+
+inline void ThreadCache::deallocateByIndex(void* ptr, size_t index) {
+	OperationScope scope(this);
+	//将内存块插入到线程本地自由链表头部
+	*(reinterpret_cast<void**>(ptr)) = m_freeList[index];
+	m_freeList[index] = ptr;
+	++m_freeListBlockNumArray[index];
+	addCachedBytes((index + 1) * ALIGNMENT);
+	if (shouldReturnToCentralCache(index)) {
+		returnToCentralCache(m_freeList[index], (index + 1) * ALIGNMENT);
+	}
+	//keep_percent接近100时归还得很少，归还之后仍要检查额度，否则只释放的线程缓存会一直增长
+	if (getCachedBytes() > m_maxBytes.load(std::memory_order_relaxed)) {
+		handleBudgetOverflow();
+	}
+}
@@ -0,0 +1,228 @@
+#include "TraceRecorder.h"
+
+#ifdef MEMORYPOOL_TRACE
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+std::atomic<bool> g_traceEnabled{ false };
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	//单个线程的环形缓冲区：本线程只写head，刷写线程只写tail
+	struct TraceBuffer
+	{
+		std::array<TraceRecord, TRACE_BUFFER_RECORDS> records;
+		std::atomic<size_t> head{ 0 };
+		std::atomic<size_t> tail{ 0 };
+		uint16_t thread{ 0 };
+		bool retired{ false }; //线程已退出，写完剩余记录后释放；受registry的锁保护
+		TraceBuffer* next{ nullptr };
+	};
+
+	struct TraceRegistry
+	{
+		std::mutex mutex;
+		TraceBuffer* buffers{ nullptr };
+		uint16_t nextThread{ 0 };
+
+		std::FILE* file{ nullptr };
+		std::thread flusher;
+		std::condition_variable wakeFlusher;
+		bool stopFlusher{ false };
+
+		std::atomic<int64_t> startNs{ 0 };
+		uint64_t written{ 0 };
+		std::atomic<uint64_t> dropped{ 0 };
+	};
+
+	TraceRegistry& registry() {
+		//故意不析构，线程退出晚于静态对象析构时仍然可用
+		static TraceRegistry* instance = new TraceRegistry;
+		return *instance;
+	}
+
+	int64_t nowNs() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+	}
+
+	//把缓冲区中的记录写入文件，并释放已退出线程的缓冲区；调用方持有锁
+	void drainLocked(TraceRegistry& reg) {
+		TraceBuffer** link = &reg.buffers;
+		while (TraceBuffer* buffer = *link) {
+			size_t tail = buffer->tail.load(std::memory_order_relaxed);
+			size_t head = buffer->head.load(std::memory_order_acquire);
+			while (tail != head) {
+				//环形缓冲区回绕时分两次写
+				size_t begin = tail & (TRACE_BUFFER_RECORDS - 1);
+				size_t count = std::min(head - tail, TRACE_BUFFER_RECORDS - begin);
+				if (reg.file) {
+					std::fwrite(&buffer->records[begin], sizeof(TraceRecord), count, reg.file);
+					reg.written += count;
+				}
+				tail += count;
+			}
+			buffer->tail.store(tail, std::memory_order_release);
+
+			if (buffer->retired) {
+				*link = buffer->next;
+				delete buffer;
+			}
+			else {
+				link = &buffer->next;
+			}
+		}
+	}
+
+	void flusherLoop() {
+		TraceRegistry& reg = registry();
+		std::unique_lock<std::mutex> lock(reg.mutex);
+		while (!reg.stopFlusher) {
+			reg.wakeFlusher.wait_for(lock, std::chrono::milliseconds(10));
+			drainLocked(reg);
+		}
+	}
+
+	TraceBuffer* registerBuffer() {
+		TraceRegistry& reg = registry();
+		TraceBuffer* buffer = new TraceBuffer;
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		buffer->thread = reg.nextThread++;
+		buffer->next = reg.buffers;
+		reg.buffers = buffer;
+		return buffer;
+	}
+
+	void retireBuffer(TraceBuffer* buffer) {
+		TraceRegistry& reg = registry();
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		buffer->retired = true;
+		if (!reg.file) {
+			drainLocked(reg);
+		}
+	}
+
+	//和Instrument.cpp一样，线程退出后（包括其他thread_local析构中）的记录直接丢弃
+	thread_local TraceBuffer* t_buffer = nullptr;
+	thread_local bool t_bufferExited = false;
+
+	struct TraceBufferOwner
+	{
+		~TraceBufferOwner() {
+			if (t_buffer) {
+				retireBuffer(t_buffer);
+			}
+			t_buffer = nullptr;
+			t_bufferExited = true;
+		}
+	};
+	thread_local TraceBufferOwner t_bufferOwner;
+
+	TraceBuffer* currentBuffer() {
+		if (!t_buffer && !t_bufferExited) {
+			(void)&t_bufferOwner;
+			t_buffer = registerBuffer();
+		}
+		return t_buffer;
+	}
+}
+
+void recordTraceSlow(TraceOp op, void* ptr, size_t size) {
+	TraceBuffer* buffer = currentBuffer();
+	if (!buffer) {
+		return;
+	}
+
+	TraceRegistry& reg = registry();
+	size_t head = buffer->head.load(std::memory_order_relaxed);
+	size_t used = head - buffer->tail.load(std::memory_order_acquire);
+	if (used >= TRACE_BUFFER_RECORDS) {
+		reg.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if (used == TRACE_BUFFER_RECORDS / 2) {
+		//缓冲区过半时提前叫醒刷写线程，不用持锁，错过一次也只是等到下个周期
+		reg.wakeFlusher.notify_one();
+	}
+
+	TraceRecord& record = buffer->records[head & (TRACE_BUFFER_RECORDS - 1)];
+	record.timestampNs = static_cast<uint64_t>(nowNs() - reg.startNs.load(std::memory_order_relaxed));
+	record.address = reinterpret_cast<uintptr_t>(ptr);
+	record.size = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+	record.thread = buffer->thread;
+	record.op = static_cast<uint8_t>(op);
+	record.reserved = 0;
+	buffer->head.store(head + 1, std::memory_order_release);
+}
+
+bool startTrace(const char* path) {
+	TraceRegistry& reg = registry();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	if (reg.file) {
+		return false;
+	}
+
+	reg.file = std::fopen(path, "wb");
+	if (!reg.file) {
+		return false;
+	}
+
+	TraceFileHeader header{};
+	memcpy(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_FILE_VERSION;
+	header.recordSize = sizeof(TraceRecord);
+	std::fwrite(&header, sizeof(header), 1, reg.file);
+
+	//丢弃上次停止之后才写进缓冲区的记录
+	for (TraceBuffer* buffer = reg.buffers; buffer; buffer = buffer->next) {
+		buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+	reg.written = 0;
+	reg.dropped.store(0, std::memory_order_relaxed);
+	reg.startNs.store(nowNs(), std::memory_order_relaxed);
+	reg.stopFlusher = false;
+	reg.flusher = std::thread(flusherLoop);
+	g_traceEnabled.store(true, std::memory_order_release);
+	return true;
+}
+
+TraceStats stopTrace() {
+	TraceRegistry& reg = registry();
+	g_traceEnabled.store(false, std::memory_order_release);
+
+	std::thread flusher;
+	{
+		std::lock_guard<std::mutex> lock(reg.mutex);
+		if (!reg.file) {
+			return TraceStats{ 0, 0 };
+		}
+		reg.stopFlusher = true;
+		reg.wakeFlusher.notify_one();
+		flusher = std::move(reg.flusher);
+	}
+	flusher.join();
+
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	drainLocked(reg);
+	std::fclose(reg.file);
+	reg.file = nullptr;
+	return TraceStats{ reg.written, reg.dropped.load(std::memory_order_relaxed) };
+}
+
+#else
+
+bool startTrace(const char*) {
+	return false;
+}
+
+TraceStats stopTrace() {
+	return TraceStats{ 0, 0 };
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+#include "Common.h"
+#include <cstdint>
+
+// 分配轨迹记录
+// 默认不编译进来，定义 MEMORYPOOL_TRACE 后 MemoryPool 门面的每次分配/释放都会记录
+// (线程, 操作, 大小, 地址, 时间戳)，写入本线程的无锁环形缓冲区，由后台线程批量写入二进制轨迹文件
+// 轨迹文件可以用 TraceReplay.cpp 在任意后端上重放
+// 环形缓冲区写满时记录被丢弃并计数，不会阻塞分配线程
+
+enum class TraceOp : uint8_t
+{
+	Allocate = 0,
+	Deallocate = 1,
+};
+
+//轨迹文件中的一条记录，文件头之后紧跟若干条记录，每个线程内按时间顺序，线程之间不保证顺序
+struct TraceRecord
+{
+	uint64_t timestampNs; //距离startTrace的纳秒数；分配在返回后取，释放在调用前取
+	uint64_t address;     //块地址，重放时用来把释放和对应的分配配对
+	uint32_t size;        //申请的字节数
+	uint16_t thread;      //记录线程的编号，按首次记录的顺序分配
+	uint8_t op;           //TraceOp
+	uint8_t reserved;
+};
+
+static_assert(sizeof(TraceRecord) == 24, "trace record layout is part of the file format");
+
+struct TraceFileHeader
+{
+	char magic[8];       //"MPTRACE\0"
+	uint32_t version;    //TRACE_FILE_VERSION
+	uint32_t recordSize; //sizeof(TraceRecord)
+};
+
+constexpr uint32_t TRACE_FILE_VERSION = 1;
+constexpr char TRACE_FILE_MAGIC[8] = { 'M', 'P', 'T', 'R', 'A', 'C', 'E', '\0' };
+
+//每个线程环形缓冲区的记录数，必须是2的幂
+constexpr size_t TRACE_BUFFER_RECORDS = 16384;
+
+struct TraceStats
+{
+	uint64_t written; //已写入文件的记录数
+	uint64_t dropped; //缓冲区写满被丢弃的记录数
+};
+
+//开始记录到path，已经在记录时返回false；未定义MEMORYPOOL_TRACE时总是返回false
+bool startTrace(const char* path);
+
+//停止记录，把剩余记录写入文件并关闭
+TraceStats stopTrace();
+
+#ifdef MEMORYPOOL_TRACE
+#include <atomic>
+
+extern std::atomic<bool> g_traceEnabled;
+
+void recordTraceSlow(TraceOp op, void* ptr, size_t size);
+
+inline void recordTrace(TraceOp op, void* ptr, size_t size) {
+	if (g_traceEnabled.load(std::memory_order_relaxed) && ptr) {
+		recordTraceSlow(op, ptr, size);
+	}
+}
+
+#define MP_RECORD_TRACE(op, ptr, size) recordTrace(op, ptr, size)
+
+#else
+
+#define MP_RECORD_TRACE(op, ptr, size) ((void)0)
+
+#endif
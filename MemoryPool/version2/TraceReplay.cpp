@@ -0,0 +1,347 @@
+// 轨迹重放：把 MEMORYPOOL_TRACE 记录下的分配轨迹在不同后端上重放，对比耗时、RSS和碎片率
+// 独立的可执行程序（和Benchmark.cpp一样不在工程里），例如：
+//   g++ -std=c++17 -O2 -pthread TraceReplay.cpp ThreadCache.cpp CentralCache.cpp PageCache.cpp Arena.cpp Instrument.cpp TraceRecorder.cpp Tuning.cpp PageProvider.cpp LargeCache.cpp -o replay
+//   ./replay service.trace --backends=system,version2 --threads=8
+// 参数：
+//   <trace文件>
+//   --backends=a,b      system, version1, version2
+//   --threads=N         重放线程数，记录中的线程按编号取模分配到重放线程，默认等于记录的线程数（最多64）
+//   --format=table|csv
+// 重放是确定的：每个重放线程按时间顺序执行自己的操作，释放别的线程分配的块时等待那次分配完成
+// 记录开始前分配的块的释放会被跳过，到结尾仍未释放的块在计时结束后统一释放
+
+#include "BenchmarkCommon.h"
+#include "TraceRecorder.h"
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// ---------------------------------------------------------------------------
+// 轨迹文件
+// ---------------------------------------------------------------------------
+
+// 以只读方式映射整个轨迹文件
+class MappedTrace
+{
+public:
+	explicit MappedTrace(const char* path) {
+#ifdef _WIN32
+		m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (m_file == INVALID_HANDLE_VALUE) {
+			return;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) {
+			return;
+		}
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_mapping) {
+			return;
+		}
+		m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		m_size = m_data ? static_cast<size_t>(size.QuadPart) : 0;
+#else
+		int fd = open(path, O_RDONLY);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				m_data = p;
+				m_size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	~MappedTrace() {
+#ifdef _WIN32
+		if (m_data) {
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping) {
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE) {
+			CloseHandle(m_file);
+		}
+#else
+		if (m_data) {
+			munmap(m_data, m_size);
+		}
+#endif
+	}
+
+	MappedTrace(const MappedTrace&) = delete;
+	MappedTrace& operator=(const MappedTrace&) = delete;
+
+	//文件头合法时返回记录数组，否则返回nullptr
+	const TraceRecord* records(size_t& count) const {
+		count = 0;
+		if (!m_data || m_size < sizeof(TraceFileHeader)) {
+			return nullptr;
+		}
+		const TraceFileHeader* header = static_cast<const TraceFileHeader*>(m_data);
+		if (memcmp(header->magic, TRACE_FILE_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != TRACE_FILE_VERSION || header->recordSize != sizeof(TraceRecord)) {
+			return nullptr;
+		}
+		count = (m_size - sizeof(TraceFileHeader)) / sizeof(TraceRecord);
+		return reinterpret_cast<const TraceRecord*>(static_cast<const char*>(m_data) + sizeof(TraceFileHeader));
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE m_file{ INVALID_HANDLE_VALUE };
+	HANDLE m_mapping{ nullptr };
+#endif
+	void* m_data{ nullptr };
+	size_t m_size{ 0 };
+};
+
+// 预处理后的一次操作：地址换成从0开始的对象编号，重放时用编号找到本次重放分配的指针
+struct ReplayOp
+{
+	uint32_t object;
+	uint32_t size;
+	TraceOp op;
+};
+
+struct ReplayPlan
+{
+	std::vector<std::vector<ReplayOp>> threads; //每个重放线程按时间顺序的操作
+	size_t objectNum{ 0 };
+	size_t opNum{ 0 };
+	size_t recordedThreads{ 0 };
+	size_t skippedFrees{ 0 }; //记录开始前分配的块的释放
+	size_t peakLiveBytes{ 0 }; //按时间顺序统计的存活字节峰值，只取决于轨迹本身
+};
+
+ReplayPlan buildPlan(const TraceRecord* records, size_t count, size_t replayThreads) {
+	std::vector<TraceRecord> sorted(records, records + count);
+	std::stable_sort(sorted.begin(), sorted.end(), [](const TraceRecord& a, const TraceRecord& b) {
+		return a.timestampNs < b.timestampNs;
+	});
+
+	ReplayPlan plan;
+	std::vector<bool> seenThreads(65536, false);
+	for (const auto& record : sorted) {
+		if (!seenThreads[record.thread]) {
+			seenThreads[record.thread] = true;
+			++plan.recordedThreads;
+		}
+	}
+	if (replayThreads == 0) {
+		replayThreads = std::max<size_t>(1, std::min<size_t>(plan.recordedThreads, 64));
+	}
+	plan.threads.resize(replayThreads);
+
+	//地址会被复用，只记录当前存活的那个对象
+	std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> live; //地址 -> (对象编号, 大小)
+	size_t liveBytes = 0;
+	for (const auto& record : sorted) {
+		auto& ops = plan.threads[record.thread % replayThreads];
+		if (record.op == static_cast<uint8_t>(TraceOp::Allocate)) {
+			uint32_t object = static_cast<uint32_t>(plan.objectNum++);
+			auto it = live.find(record.address);
+			if (it != live.end()) {
+				//丢掉了这个地址的释放记录，旧对象视为一直存活
+				it->second = { object, record.size };
+			}
+			else {
+				live.emplace(record.address, std::make_pair(object, record.size));
+			}
+			ops.push_back(ReplayOp{ object, record.size, TraceOp::Allocate });
+			liveBytes += record.size;
+			plan.peakLiveBytes = std::max(plan.peakLiveBytes, liveBytes);
+		}
+		else {
+			auto it = live.find(record.address);
+			if (it == live.end()) {
+				++plan.skippedFrees;
+				continue;
+			}
+			ops.push_back(ReplayOp{ it->second.first, record.size, TraceOp::Deallocate });
+			liveBytes -= it->second.second;
+			live.erase(it);
+		}
+		++plan.opNum;
+	}
+	return plan;
+}
+
+// ---------------------------------------------------------------------------
+// 重放
+// ---------------------------------------------------------------------------
+
+struct ReplayResult
+{
+	std::string backend;
+	size_t threads{ 0 };
+	double seconds{ 0 };
+	double opsPerSec{ 0 };
+	size_t peakRss{ 0 };
+	double fragmentation{ 0 }; //峰值RSS / 峰值存活字节
+};
+
+ReplayResult replay(const Backend& backend, const ReplayPlan& plan) {
+	std::vector<std::atomic<void*>> objects(plan.objectNum);
+	for (auto& object : objects) {
+		object.store(nullptr, std::memory_order_relaxed);
+	}
+	std::vector<uint32_t> sizes(plan.objectNum, 0);
+
+	ReplayResult result;
+	result.backend = backend.name;
+	result.threads = plan.threads.size();
+
+	RssMonitor monitor;
+	auto start = Clock::now();
+
+	std::vector<std::thread> threads;
+	for (const auto& ops : plan.threads) {
+		threads.emplace_back([&]() {
+			for (const auto& op : ops) {
+				if (op.op == TraceOp::Allocate) {
+					void* p = backend.allocate(op.size);
+					if (!p) {
+						std::cerr << backend.name << ": allocation of " << op.size << " bytes failed\n";
+						std::abort();
+					}
+					if (op.size > 0) {
+						static_cast<char*>(p)[0] = 0;
+					}
+					sizes[op.object] = op.size;
+					objects[op.object].store(p, std::memory_order_release);
+				}
+				else {
+					//对象可能由另一个重放线程分配，等它完成
+					void* p;
+					while (!(p = objects[op.object].load(std::memory_order_acquire))) {
+						std::this_thread::yield();
+					}
+					backend.deallocate(p, op.size);
+					objects[op.object].store(reinterpret_cast<void*>(uintptr_t(1)), std::memory_order_relaxed);
+				}
+			}
+		});
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	monitor.stop();
+	result.peakRss = monitor.peakDelta();
+	result.opsPerSec = result.seconds > 0 ? static_cast<double>(plan.opNum) / result.seconds : 0;
+	if (plan.peakLiveBytes > 0) {
+		result.fragmentation = static_cast<double>(result.peakRss) / static_cast<double>(plan.peakLiveBytes);
+	}
+
+	//释放到结尾仍存活的对象（已释放的标成1）
+	for (size_t i = 0; i < plan.objectNum; ++i) {
+		void* p = objects[i].load(std::memory_order_relaxed);
+		if (p && p != reinterpret_cast<void*>(uintptr_t(1))) {
+			backend.deallocate(p, sizes[i]);
+		}
+	}
+	return result;
+}
+
+std::vector<std::string> split(const std::string& s) {
+	std::vector<std::string> parts;
+	std::stringstream ss(s);
+	std::string part;
+	while (std::getline(ss, part, ',')) {
+		if (!part.empty()) {
+			parts.push_back(part);
+		}
+	}
+	return parts;
+}
+
+int main(int argc, char** argv) {
+	std::string path;
+	std::vector<std::string> backends{ "system", "version1", "version2" };
+	size_t replayThreads = 0;
+	std::string format = "table";
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 11, "--backends=") == 0) {
+			backends = split(arg.substr(11));
+		}
+		else if (arg.compare(0, 10, "--threads=") == 0) {
+			replayThreads = static_cast<size_t>(std::max(1, atoi(arg.c_str() + 10)));
+		}
+		else if (arg.compare(0, 9, "--format=") == 0) {
+			format = arg.substr(9);
+		}
+		else if (path.empty() && arg.compare(0, 2, "--") != 0) {
+			path = arg;
+		}
+		else {
+			std::cerr << "unknown argument: " << arg << "\n";
+			return 1;
+		}
+	}
+	if (path.empty()) {
+		std::cerr << "usage: " << argv[0] << " <trace> [--backends=a,b] [--threads=N] [--format=table|csv]\n";
+		return 1;
+	}
+
+	ReplayPlan plan;
+	{
+		MappedTrace trace(path.c_str());
+		size_t count = 0;
+		const TraceRecord* records = trace.records(count);
+		if (!records) {
+			std::cerr << "cannot read trace " << path << "\n";
+			return 1;
+		}
+		plan = buildPlan(records, count, replayThreads);
+	}
+	std::cerr << plan.opNum << " ops, " << plan.objectNum << " objects, " << plan.recordedThreads
+		<< " recorded threads, " << plan.skippedFrees << " frees skipped, peak live "
+		<< plan.peakLiveBytes / 1024 << " KB\n";
+
+	v1::initializeMemoryPools();
+
+	std::vector<ReplayResult> results;
+	for (const auto& backend : allBackends()) {
+		if (std::find(backends.begin(), backends.end(), backend.name) == backends.end()) {
+			continue;
+		}
+		results.push_back(replay(backend, plan));
+		if (backend.name == "version2") {
+			MemoryPool::releaseFreeMemory();
+		}
+	}
+
+	if (format == "csv") {
+		std::cout << "backend,threads,seconds,ops_per_sec,peak_rss_bytes,fragmentation\n";
+		for (const auto& r : results) {
+			std::cout << r.backend << ',' << r.threads << ',' << r.seconds << ',' << r.opsPerSec << ','
+				<< r.peakRss << ',' << r.fragmentation << "\n";
+		}
+	}
+	else {
+		std::cout << std::left << std::setw(10) << "backend" << std::right << std::setw(8) << "threads"
+			<< std::setw(12) << "seconds" << std::setw(14) << "ops/s" << std::setw(14) << "peakRSS(KB)"
+			<< std::setw(8) << "frag" << "\n";
+		for (const auto& r : results) {
+			std::cout << std::left << std::setw(10) << r.backend << std::right << std::setw(8) << r.threads
+				<< std::setw(12) << std::fixed << std::setprecision(4) << r.seconds
+				<< std::setw(14) << std::setprecision(0) << r.opsPerSec << std::setw(14) << r.peakRss / 1024
+				<< std::setw(8) << std::setprecision(2) << r.fragmentation << "\n";
+		}
+	}
+	return 0;
+}
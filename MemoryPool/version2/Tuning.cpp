@@ -0,0 +1,100 @@
+#include "Tuning.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+Tuning g_tuning;
+
+namespace {
+	struct TuningEntry
+	{
+		const char* name;
+		std::atomic<size_t> Tuning::* field;
+		size_t minValue;
+		size_t maxValue;
+	};
+
+	const TuningEntry TUNING_ENTRIES[] = {
+		{ "thread_cache.max_blocks", &Tuning::threadCacheMaxBlocks, 1, size_t(1) << 20 },
+		{ "thread_cache.keep_percent", &Tuning::threadCacheKeepPercent, 0, 100 },
+		{ "thread_cache.batch_bytes", &Tuning::threadCacheBatchBytes, ALIGNMENT, MAX_BYTES },
+		{ "thread_cache.total_bytes", &Tuning::threadCacheTotalBytes, THREAD_CACHE_MIN_BYTES, SIZE_MAX },
+		{ "remote_free.queue_limit", &Tuning::remoteFreeQueueLimit, 0, SIZE_MAX },
+		{ "page_cache.shard_max_pages", &Tuning::pageShardMaxPages, 0, size_t(1) << 20 },
+		{ "large_cache.cpu_bytes", &Tuning::largeCacheCpuBytes, 0, SIZE_MAX },
+		{ "epoch.advance_interval", &Tuning::epochAdvanceInterval, 1, size_t(1) << 20 },
+	};
+
+	const TuningEntry* findEntry(const char* name, size_t length) {
+		for (const TuningEntry& entry : TUNING_ENTRIES) {
+			if (strlen(entry.name) == length && strncmp(entry.name, name, length) == 0) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	//启动时读取环境变量
+	struct TuningEnvironmentLoader
+	{
+		TuningEnvironmentLoader() {
+			const char* conf = std::getenv("MEMORYPOOL_CONF");
+			if (conf) {
+				applyTuningString(conf);
+			}
+		}
+	};
+	TuningEnvironmentLoader g_environmentLoader;
+}
+
+bool setTuning(const char* name, size_t value) {
+	const TuningEntry* entry = name ? findEntry(name, strlen(name)) : nullptr;
+	if (!entry || value < entry->minValue || value > entry->maxValue) {
+		return false;
+	}
+	(g_tuning.*(entry->field)).store(value, std::memory_order_relaxed);
+	return true;
+}
+
+bool getTuning(const char* name, size_t& value) {
+	const TuningEntry* entry = name ? findEntry(name, strlen(name)) : nullptr;
+	if (!entry) {
+		return false;
+	}
+	value = (g_tuning.*(entry->field)).load(std::memory_order_relaxed);
+	return true;
+}
+
+std::vector<const char*> getTuningNames() {
+	std::vector<const char*> names;
+	for (const TuningEntry& entry : TUNING_ENTRIES) {
+		names.push_back(entry.name);
+	}
+	return names;
+}
+
+bool applyTuningString(const char* conf) {
+	bool ok = true;
+	while (*conf) {
+		const char* end = strchr(conf, ',');
+		if (!end) {
+			end = conf + strlen(conf);
+		}
+		const char* equal = static_cast<const char*>(memchr(conf, '=', end - conf));
+		if (equal) {
+			std::string name(conf, equal);
+			std::string value(equal + 1, end);
+			char* parsedEnd = nullptr;
+			unsigned long long parsed = std::strtoull(value.c_str(), &parsedEnd, 0);
+			if (value.empty() || *parsedEnd != '\0' || !setTuning(name.c_str(), static_cast<size_t>(parsed))) {
+				ok = false;
+			}
+		}
+		else if (end != conf) {
+			ok = false;
+		}
+		conf = *end ? end + 1 : end;
+	}
+	return ok;
+}
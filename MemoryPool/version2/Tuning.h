@@ -0,0 +1,52 @@
+#pragma once
+#include "Common.h"
+#include <atomic>
+#include <vector>
+
+// 运行时可调参数，默认值取自Common.h中的常量
+// 热路径上只做一次relaxed读，不加锁；修改对其他线程在之后的某个时刻生效
+// 按名字读写（类似jemalloc的mallctl），启动时从环境变量MEMORYPOOL_CONF读取初值，格式为
+//   MEMORYPOOL_CONF="thread_cache.max_blocks=256,thread_cache.keep_percent=50"
+// MAX_BYTES、PAGE_SIZE等决定数组大小和编译期大小类下标的常量不能在运行时修改
+
+struct Tuning
+{
+	//线程缓存单个大小类最多缓存的块数，超过则归还一部分给中心缓存
+	std::atomic<size_t> threadCacheMaxBlocks{ THREAD_FREE_BLOCK_THRESHOLD };
+
+	//超过上限归还时线程缓存保留的百分比
+	std::atomic<size_t> threadCacheKeepPercent{ 25 };
+
+	//线程缓存一次从中心缓存批量获取的字节数，按块大小换算成块数
+	std::atomic<size_t> threadCacheBatchBytes{ 2048 };
+
+	//所有线程缓存的总额度
+	std::atomic<size_t> threadCacheTotalBytes{ THREAD_CACHE_TOTAL_BYTES };
+
+	//远程释放队列积压上限
+	std::atomic<size_t> remoteFreeQueueLimit{ REMOTE_FREE_QUEUE_LIMIT };
+
+	//PageCache单个分片最多缓存的页数
+	std::atomic<size_t> pageShardMaxPages{ PAGE_SHARD_MAX_PAGES };
+
+	//大对象单个CPU缓存最多缓存的字节数
+	std::atomic<size_t> largeCacheCpuBytes{ LARGE_CACHE_CPU_BYTES };
+
+	//每退休多少个块尝试推进一次纪元
+	std::atomic<size_t> epochAdvanceInterval{ EPOCH_ADVANCE_INTERVAL };
+};
+
+//常量初始化，比任何静态构造都早可用
+extern Tuning g_tuning;
+
+//按名字设置参数，名字未知或取值超出范围时返回false
+bool setTuning(const char* name, size_t value);
+
+//按名字读取参数，名字未知时返回false
+bool getTuning(const char* name, size_t& value);
+
+//所有参数名
+std::vector<const char*> getTuningNames();
+
+//解析"name=value,name=value"并逐项设置，返回是否全部成功；出错的项跳过，其余照常生效
+bool applyTuningString(const char* conf);
@@ -4,9 +4,17 @@
 #include <thread>
 #include <cassert>
 #include <cstring>
+#include <cstdio>
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 //std::cout << "" << std::endl;
 
@@ -131,6 +139,1596 @@ void testMultiThreading()
     std::cout << "Multi-threading test passed!" << std::endl;
 }
 
+// 跨线程释放测试：生产者分配，消费者释放
+void testCrossThreadFree() 
+{
+    std::cout << "Running cross-thread free test..." << std::endl;
+
+    const int NUM_ROUNDS = 200;
+    const int BLOCKS_PER_ROUND = 500;
+    const size_t size = 64;
+
+    std::vector<void*> blocks;
+    for (int round = 0; round < NUM_ROUNDS; ++round) 
+    {
+        // 生产者线程分配并写入数据
+        std::thread producer([&]() 
+        {
+            for (int i = 0; i < BLOCKS_PER_ROUND; ++i) 
+            {
+                void* ptr = MemoryPool::allocate(size);
+                assert(ptr != nullptr);
+                memset(ptr, round & 0xff, size);
+                blocks.push_back(ptr);
+            }
+        });
+        producer.join();
+
+        // 消费者线程检查数据后释放
+        std::thread consumer([&]() 
+        {
+            for (void* ptr : blocks) 
+            {
+                assert(static_cast<unsigned char*>(ptr)[size - 1] == (round & 0xff));
+                MemoryPool::deallocate(ptr, size);
+            }
+        });
+        consumer.join();
+        blocks.clear();
+    }
+
+    // 主线程分配释放交替进行，远程释放回来的块可以被复用
+    for (int round = 0; round < NUM_ROUNDS; ++round) 
+    {
+        for (int i = 0; i < BLOCKS_PER_ROUND; ++i) 
+        {
+            void* ptr = MemoryPool::allocate(size);
+            assert(ptr != nullptr);
+            blocks.push_back(ptr);
+        }
+        std::thread consumer([&]() 
+        {
+            for (void* ptr : blocks) 
+            {
+                MemoryPool::deallocate(ptr, size);
+            }
+        });
+        consumer.join();
+        blocks.clear();
+    }
+
+    // 线程都已退出，释放空闲内存时其队列里残留的块也一并归还
+    MemoryPool::releaseFreeMemory();
+    assert(ThreadCache::drainIdleRemoteQueues() == 0);
+
+    std::cout << "Cross-thread free test passed!" << std::endl;
+}
+
+// Arena测试：指针碰撞分配、reset复用、析构函数登记
+void testArena() 
+{
+    std::cout << "Running arena test..." << std::endl;
+
+    static int destroyed = 0;
+    struct Tracked 
+    {
+        int value;
+        explicit Tracked(int v) : value(v) {}
+        ~Tracked() { ++destroyed; }
+    };
+
+    MemoryPool::Arena arena;
+
+    // 分配足够多的对象，跨越多个span
+    const int NUM_OBJECTS = 10000;
+    std::vector<int*> ints;
+    for (int i = 0; i < NUM_OBJECTS; ++i) 
+    {
+        int* p = arena.create<int>(i);
+        assert(p != nullptr);
+        ints.push_back(p);
+    }
+    for (int i = 0; i < NUM_OBJECTS; ++i) 
+    {
+        assert(*ints[i] == i);
+    }
+
+    // 对齐要求
+    void* aligned = arena.allocate(100, 64);
+    assert((reinterpret_cast<uintptr_t>(aligned) & 63) == 0);
+
+    // 超过单个span的分配
+    char* big = static_cast<char*>(arena.allocate(ARENA_CHUNK_PAGES * PAGE_SIZE * 2));
+    assert(big != nullptr);
+    memset(big, 0x5a, ARENA_CHUNK_PAGES * PAGE_SIZE * 2);
+
+    for (int i = 0; i < 100; ++i) 
+    {
+        Tracked* t = arena.create<Tracked>(i);
+        assert(t->value == i);
+    }
+
+    // reset调用析构函数并复用已有span，容量不变
+    size_t capacity = arena.capacity();
+    arena.reset();
+    assert(destroyed == 100);
+    for (int i = 0; i < NUM_OBJECTS; ++i) 
+    {
+        assert(arena.create<int>(i) != nullptr);
+    }
+    assert(arena.capacity() == capacity);
+
+    arena.create<Tracked>(0);
+    arena.release();
+    assert(destroyed == 101);
+    assert(arena.capacity() == 0);
+
+    std::cout << "Arena test passed!" << std::endl;
+}
+
+// 批量分配测试
+void testBatchAllocation() 
+{
+    std::cout << "Running batch allocation test..." << std::endl;
+
+    const size_t NUM_BLOCKS = 5000;
+    std::vector<void*> ptrs(NUM_BLOCKS);
+
+    for (size_t size : {size_t(24), size_t(1000), MAX_BYTES + 1}) 
+    {
+        size_t got = MemoryPool::allocateBatch(size, NUM_BLOCKS, ptrs.data());
+        assert(got == NUM_BLOCKS);
+
+        // 每块写入不同数据，检查块之间没有重叠
+        for (size_t i = 0; i < NUM_BLOCKS; ++i) 
+        {
+            memset(ptrs[i], static_cast<int>(i & 0xff), size);
+        }
+        for (size_t i = 0; i < NUM_BLOCKS; ++i) 
+        {
+            assert(static_cast<unsigned char*>(ptrs[i])[0] == (i & 0xff));
+            assert(static_cast<unsigned char*>(ptrs[i])[size - 1] == (i & 0xff));
+        }
+
+        MemoryPool::deallocateBatch(ptrs.data(), NUM_BLOCKS, size);
+    }
+
+    // 批量释放的块可以被单个分配复用
+    size_t got = MemoryPool::allocateBatch(64, 100, ptrs.data());
+    assert(got == 100);
+    MemoryPool::deallocateBatch(ptrs.data(), got, 64);
+    void* ptr = MemoryPool::allocate(64);
+    assert(ptr != nullptr);
+    MemoryPool::deallocate(ptr, 64);
+
+    // 自由链表溢出时归还较早释放的块，最后释放的块留在本线程，下一次分配直接拿到它
+    size_t maxBlocks = 0;
+    assert(MemoryPool::getTuning("thread_cache.max_blocks", maxBlocks));
+    std::vector<void*> blocks(maxBlocks + 1);
+    for (void*& block : blocks) 
+    {
+        block = MemoryPool::allocate(64);
+        assert(block != nullptr);
+    }
+    // 清空本线程缓存，最后一次释放正好触发归还
+    ThreadCache::getInstance()->flush();
+    for (void* block : blocks) 
+    {
+        MemoryPool::deallocate(block, 64);
+    }
+    ptr = MemoryPool::allocate(64);
+    assert(ptr == blocks.back());
+    MemoryPool::deallocate(ptr, 64);
+
+    std::cout << "Batch allocation test passed!" << std::endl;
+}
+
+// 内存上限测试：超过硬上限时调用回调并分配失败
+static int g_outOfMemoryCalls = 0;
+
+bool onOutOfMemory(size_t /*bytes*/) 
+{
+    ++g_outOfMemoryCalls;
+    return false;
+}
+
+void testMemoryLimit() 
+{
+    std::cout << "Running memory limit test..." << std::endl;
+
+    // 先把空闲span还给系统，之后的分配都要向系统申请
+    MemoryPool::releaseFreeMemory();
+    size_t base = MemoryPool::getSystemBytes();
+
+    const size_t size = 128 * 1024;
+    const size_t LIMIT = 2 * 1024 * 1024;
+    MemoryPool::setMemoryLimit(0, base + LIMIT);
+    MemoryPool::setOutOfMemoryHandler(onOutOfMemory);
+
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 100; ++i) 
+    {
+        void* ptr = MemoryPool::allocate(size);
+        if (!ptr) 
+        {
+            break;
+        }
+        ptrs.push_back(ptr);
+    }
+    assert(!ptrs.empty());
+    assert(ptrs.size() < 100);
+    assert(g_outOfMemoryCalls > 0);
+    assert(MemoryPool::getSystemBytes() <= base + LIMIT);
+
+    for (void* ptr : ptrs) 
+    {
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    // 释放后又可以在上限内分配
+    MemoryPool::releaseFreeMemory();
+    void* ptr = MemoryPool::allocate(size);
+    assert(ptr != nullptr);
+    MemoryPool::deallocate(ptr, size);
+
+    MemoryPool::setMemoryLimit(0, 0);
+    MemoryPool::setOutOfMemoryHandler(nullptr);
+
+    std::cout << "Memory limit test passed!" << std::endl;
+}
+
+// 慢路径延迟统计测试
+void testLatencyStats() 
+{
+    std::cout << "Running latency stats test..." << std::endl;
+
+    // 直方图分桶：下界不超过原值，且单调
+    for (uint64_t ns : {0ull, 7ull, 8ull, 100ull, 4096ull, 123456789ull}) 
+    {
+        size_t index = LatencyHistogram::bucketIndex(ns);
+        assert(LatencyHistogram::bucketLowerBound(index) <= ns);
+        assert(index + 1 == LATENCY_BUCKET_NUM || LatencyHistogram::bucketLowerBound(index + 1) > ns);
+    }
+
+    MemoryPool::resetLatencyStats();
+
+    // 每次都用新的大小类，保证走到CentralCache和PageCache
+    std::vector<std::pair<void*, size_t>> ptrs;
+    for (size_t size = 100 * 1024; size < 100 * 1024 + 64 * 8; size += 8) 
+    {
+        ptrs.push_back({MemoryPool::allocate(size), size});
+    }
+    for (const auto& alloc : ptrs) 
+    {
+        MemoryPool::deallocate(alloc.first, alloc.second);
+    }
+
+    LatencySnapshot snapshot = MemoryPool::getLatencySnapshot();
+#ifdef MEMORYPOOL_INSTRUMENT
+    assert(snapshot[LatencyTier::FetchFromCentralCache].count >= ptrs.size());
+    assert(snapshot[LatencyTier::FetchFromPageCache].count > 0);
+    assert(snapshot[LatencyTier::FetchFromCentralCache].percentile(99) > 0);
+
+    MemoryPool::resetLatencyStats();
+    assert(MemoryPool::getLatencySnapshot()[LatencyTier::FetchFromCentralCache].count == 0);
+#else
+    // 未开启统计时没有任何记录
+    assert(snapshot[LatencyTier::FetchFromCentralCache].count == 0);
+#endif
+
+    std::cout << "Latency stats test passed!" << std::endl;
+}
+
+// 轨迹记录测试：记录的分配/释放能从文件中按线程顺序读回
+void testTrace() 
+{
+    std::cout << "Running trace test..." << std::endl;
+
+    const char* path = "memorypool_test.trace";
+#ifdef MEMORYPOOL_TRACE
+    assert(MemoryPool::startTrace(path));
+    assert(!MemoryPool::startTrace(path));
+
+    std::vector<void*> ptrs;
+    for (size_t i = 1; i <= 100; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(i * 8));
+    }
+    for (size_t i = 0; i < ptrs.size(); ++i) 
+    {
+        MemoryPool::deallocate(ptrs[i], (i + 1) * 8);
+    }
+
+    TraceStats stats = MemoryPool::stopTrace();
+    assert(stats.written + stats.dropped == 200);
+
+    FILE* file = fopen(path, "rb");
+    assert(file);
+    TraceFileHeader header;
+    assert(fread(&header, sizeof(header), 1, file) == 1);
+    assert(memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) == 0);
+    assert(header.recordSize == sizeof(TraceRecord));
+
+    std::vector<TraceRecord> records(stats.written);
+    assert(fread(records.data(), sizeof(TraceRecord), records.size(), file) == records.size());
+    fclose(file);
+
+    // 只有本线程在记录，顺序和调用顺序一致
+    for (size_t i = 0; i < records.size(); ++i) 
+    {
+        size_t k = i % 100;
+        assert(records[i].op == static_cast<uint8_t>(i < 100 ? TraceOp::Allocate : TraceOp::Deallocate));
+        assert(records[i].address == reinterpret_cast<uintptr_t>(ptrs[k]));
+        assert(records[i].size == (k + 1) * 8);
+        assert(i == 0 || records[i].timestampNs >= records[i - 1].timestampNs);
+    }
+    remove(path);
+#else
+    // 未开启记录时不会创建文件
+    assert(!MemoryPool::startTrace(path));
+    assert(MemoryPool::stopTrace().written == 0);
+#endif
+
+    std::cout << "Trace test passed!" << std::endl;
+}
+
+// 类型化对象池测试：编译期下标、unique_ptr/shared_ptr的构造析构、对齐、跨线程释放
+struct PooledCounter 
+{
+    static std::atomic<int> alive;
+    int value;
+    explicit PooledCounter(int v) : value(v) { ++alive; }
+    ~PooledCounter() { --alive; }
+};
+std::atomic<int> PooledCounter::alive{0};
+
+struct alignas(64) PooledAligned 
+{
+    char data[40];
+};
+
+void testObjectPool() 
+{
+    std::cout << "Running object pool test..." << std::endl;
+
+    static_assert(ObjectPool<PooledCounter>::INDEX == SizeClass::getFreeListIndex(sizeof(PooledCounter)),
+        "class index is computed at compile time");
+    static_assert(sizeof(ObjectPool<PooledCounter>::UniquePtr) == sizeof(PooledCounter*),
+        "deleter is stateless");
+
+    {
+        auto p = make_pooled<PooledCounter>(42);
+        assert(p->value == 42);
+        assert(PooledCounter::alive == 1);
+        assert(CentralCache::getInstance().getSpanTracker(p.get()) != nullptr);
+    }
+    assert(PooledCounter::alive == 0);
+
+    // 对齐要求大于8的类型
+    std::vector<ObjectPool<PooledAligned>::UniquePtr> aligned;
+    for (int i = 0; i < 100; ++i) 
+    {
+        aligned.push_back(make_pooled<PooledAligned>());
+        assert(reinterpret_cast<uintptr_t>(aligned.back().get()) % 64 == 0);
+    }
+    aligned.clear();
+
+    // 控制块和对象在同一个池化块中
+    {
+        auto s = make_pooled_shared<PooledCounter>(7);
+        std::shared_ptr<PooledCounter> copy = s;
+        assert(copy.use_count() == 2 && copy->value == 7);
+        assert(CentralCache::getInstance().getSpanTracker(s.get()) != nullptr);
+        assert(PooledCounter::alive == 1);
+    }
+    assert(PooledCounter::alive == 0);
+
+    // 一个线程创建，另一个线程销毁
+    std::vector<ObjectPool<PooledCounter>::UniquePtr> objects;
+    for (int i = 0; i < 1000; ++i) 
+    {
+        objects.push_back(make_pooled<PooledCounter>(i));
+    }
+    std::thread([&objects]() { objects.clear(); }).join();
+    assert(PooledCounter::alive == 0);
+
+    std::cout << "Object pool test passed!" << std::endl;
+}
+
+// span大小测试：每个大小类的span尾部浪费不超过上限，且能容纳要求的对象数
+void testSpanSizing() 
+{
+    std::cout << "Running span sizing test..." << std::endl;
+
+    for (size_t index = 0; index < FREE_LIST_NUM; ++index) 
+    {
+        size_t size = (index + 1) * ALIGNMENT;
+        size_t pages = SizeClass::getSpanPages(size);
+        size_t spanBytes = pages * PAGE_SIZE;
+        size_t objects = spanBytes / size;
+
+        assert(pages >= SPAN_PAGES);
+        assert((spanBytes % size) * SPAN_WASTE_RATIO <= spanBytes);
+        assert(objects >= std::max<size_t>(1, std::min(SPAN_MIN_OBJECTS, SPAN_MIN_OBJECT_BYTES / size)));
+    }
+
+    // 中等大小的块能正常分配释放
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < 16; ++i) 
+    {
+        void* ptr = MemoryPool::allocate(20 * 1024);
+        assert(ptr != nullptr);
+        memset(ptr, 0x5a, 20 * 1024);
+        ptrs.push_back(ptr);
+    }
+    for (void* ptr : ptrs) 
+    {
+        MemoryPool::deallocate(ptr, 20 * 1024);
+    }
+
+    std::cout << "Span sizing test passed!" << std::endl;
+}
+
+// span位图测试：小块乱序归还后再分配，地址不重复且都落在同一大小类的块边界上
+void testSpanBitmap() 
+{
+    std::cout << "Running span bitmap test..." << std::endl;
+
+    const size_t SIZE = 24;
+    const size_t COUNT = 20000; // 跨越多个span
+    std::vector<void*> ptrs(COUNT);
+    for (auto& ptr : ptrs) 
+    {
+        ptr = MemoryPool::allocate(SIZE);
+        assert(ptr != nullptr);
+    }
+
+    std::mt19937 gen(7);
+    std::shuffle(ptrs.begin(), ptrs.end(), gen);
+    // 归还一半，让span里出现零散的空闲位
+    for (size_t i = 0; i < COUNT / 2; ++i) 
+    {
+        MemoryPool::deallocate(ptrs[i], SIZE);
+    }
+    MemoryPool::releaseFreeMemory();
+
+    for (size_t i = 0; i < COUNT / 2; ++i) 
+    {
+        ptrs[i] = MemoryPool::allocate(SIZE);
+        assert(ptrs[i] != nullptr);
+    }
+
+    std::vector<void*> sorted = ptrs;
+    std::sort(sorted.begin(), sorted.end());
+    assert(std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end());
+    for (void* ptr : ptrs) 
+    {
+        SpanTracker* span = CentralCache::getInstance().getSpanTracker(ptr);
+        assert(span != nullptr);
+        size_t offset = static_cast<char*>(ptr) - static_cast<char*>(span->spanAddr);
+        assert(offset % SIZE == 0);
+    }
+
+    for (void* ptr : ptrs) 
+    {
+        MemoryPool::deallocate(ptr, SIZE);
+    }
+
+    std::cout << "Span bitmap test passed!" << std::endl;
+}
+
+// PageCache分片测试：多线程直接申请/释放各种页数的span，内容互不覆盖，释放后全部能还给系统
+void testPageShards() 
+{
+    std::cout << "Running page shard test..." << std::endl;
+
+    MemoryPool::releaseFreeMemory();
+    size_t baseBytes = MemoryPool::getSystemBytes();
+
+    const int NUM_THREADS = 8;
+    std::atomic<bool> ok{true};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; ++t) 
+    {
+        threads.emplace_back([t, &ok]() 
+        {
+            std::mt19937 gen(t);
+            std::uniform_int_distribution<size_t> pages(1, SMALL_SPAN_MAX_PAGES + 8);
+            std::vector<std::pair<char*, size_t>> spans;
+            for (int i = 0; i < 2000; ++i) 
+            {
+                if (spans.size() < 32 && (spans.empty() || gen() % 2)) 
+                {
+                    size_t pageNum = pages(gen);
+                    char* span = static_cast<char*>(PageCache::getInstance().allocateSpan(pageNum));
+                    assert(span != nullptr);
+                    memset(span, t + 1, pageNum * PAGE_SIZE);
+                    spans.push_back({span, pageNum});
+                }
+                else 
+                {
+                    size_t k = gen() % spans.size();
+                    char* span = spans[k].first;
+                    size_t bytes = spans[k].second * PAGE_SIZE;
+                    if (span[0] != t + 1 || span[bytes - 1] != t + 1) 
+                    {
+                        ok = false;
+                    }
+                    PageCache::getInstance().deallocateSpan(span, spans[k].second);
+                    spans[k] = spans.back();
+                    spans.pop_back();
+                }
+            }
+            for (auto& span : spans) 
+            {
+                PageCache::getInstance().deallocateSpan(span.first, span.second);
+            }
+        });
+    }
+    for (auto& thread : threads) 
+    {
+        thread.join();
+    }
+    assert(ok);
+
+    // 分片里缓存的span也要能还给系统
+    MemoryPool::releaseFreeMemory();
+    assert(MemoryPool::getSystemBytes() <= baseBytes);
+
+    std::cout << "Page shard test passed!" << std::endl;
+}
+
+// 共享内存池测试：同一个段映射两次，一边分配一边用偏移释放；POSIX下再fork子进程跨进程分配
+void testSharedMemoryPool() 
+{
+    std::cout << "Running shared memory pool test..." << std::endl;
+
+#ifdef _WIN32
+    std::string name = "Local\\MemoryPoolTest" + std::to_string(GetCurrentProcessId());
+#else
+    std::string name = "/MemoryPoolTest" + std::to_string(getpid());
+#endif
+    const size_t SEGMENT_BYTES = 64 * 1024 * 1024;
+    auto owner = SharedMemoryPool::create(name.c_str(), SEGMENT_BYTES);
+    assert(owner != nullptr);
+    assert(SharedMemoryPool::create(name.c_str(), SEGMENT_BYTES) == nullptr); // 不能重复创建
+    auto peer = SharedMemoryPool::open(name.c_str());
+    assert(peer != nullptr);
+    size_t freePages = owner->freePageCount();
+    assert(freePages == owner->pageCount());
+
+    // owner分配，peer按偏移找到同一块内存并释放
+    std::vector<uint64_t> offsets;
+    for (size_t size : {8, 24, 100, 1024, 4000, 70000, 300000, 1024 * 1024}) 
+    {
+        for (int i = 0; i < 20; ++i) 
+        {
+            char* ptr = static_cast<char*>(owner->allocate(size));
+            assert(ptr != nullptr && owner->contains(ptr));
+            memset(ptr, static_cast<int>(size & 0x7f), size);
+            offsets.push_back(owner->toOffset(ptr));
+        }
+    }
+    size_t k = 0;
+    for (size_t size : {8, 24, 100, 1024, 4000, 70000, 300000, 1024 * 1024}) 
+    {
+        for (int i = 0; i < 20; ++i, ++k) 
+        {
+            char* ptr = static_cast<char*>(peer->fromOffset(offsets[k]));
+            assert(ptr[0] == static_cast<char>(size & 0x7f) && ptr[size - 1] == ptr[0]);
+            peer->deallocate(ptr);
+        }
+    }
+    // 全部释放后空闲页段合并回初始状态
+    assert(owner->freePageCount() == freePages);
+
+    // 段用尽时返回nullptr而不是越界
+    assert(owner->allocate(SEGMENT_BYTES) == nullptr);
+
+#ifndef _WIN32
+    // 子进程分配并写入消息，通过管道传回偏移，父进程检查内容后释放
+    int fds[2];
+    assert(pipe(fds) == 0);
+    const int MESSAGES = 1000;
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) 
+    {
+        close(fds[0]);
+        auto pool = SharedMemoryPool::open(name.c_str());
+        for (int i = 0; pool && i < MESSAGES; ++i) 
+        {
+            size_t size = 16 + (i * 37) % 2000;
+            char* msg = static_cast<char*>(pool->allocate(size));
+            if (!msg) 
+            {
+                break;
+            }
+            memset(msg, i & 0x7f, size);
+            uint64_t message[2] = { pool->toOffset(msg), size };
+            if (write(fds[1], message, sizeof(message)) != sizeof(message)) 
+            {
+                break;
+            }
+        }
+        close(fds[1]);
+        _exit(0);
+    }
+    close(fds[1]);
+    int received = 0;
+    uint64_t message[2];
+    while (read(fds[0], message, sizeof(message)) == sizeof(message)) 
+    {
+        char* msg = static_cast<char*>(peer->fromOffset(message[0]));
+        assert(msg[0] == static_cast<char>(received & 0x7f) && msg[message[1] - 1] == msg[0]);
+        peer->deallocate(msg);
+        ++received;
+    }
+    close(fds[0]);
+    int status = 0;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(received == MESSAGES);
+    assert(owner->freePageCount() == freePages);
+#endif
+
+    // 小段：段头只占一页，40KB（SPAN_PAGES个数据页）的消息段就能分配小块
+    std::string smallName = name + "Small";
+    auto small = SharedMemoryPool::create(smallName.c_str(), (SPAN_PAGES + 2) * PAGE_SIZE);
+    assert(small != nullptr && small->pageCount() == SPAN_PAGES);
+    void* smallBlock = small->allocate(100);
+    assert(smallBlock != nullptr);
+    memset(smallBlock, 0x5A, 100);
+    small->deallocate(smallBlock);
+    assert(small->freePageCount() == small->pageCount());
+    SharedMemoryPool::remove(smallName.c_str());
+
+    SharedMemoryPool::remove(name.c_str());
+#ifndef _WIN32
+    // 名字删除后不能再打开，已有的映射仍然可用（Windows上名字随最后一个句柄一起消失）
+    assert(SharedMemoryPool::open(name.c_str()) == nullptr);
+    assert(owner->allocate(64) != nullptr);
+#endif
+
+    std::cout << "Shared memory pool test passed!" << std::endl;
+}
+
+// 文件堆测试：写入链表后关闭，重新打开时通过根对象找回全部数据；打开期间崩溃的文件不能再打开
+struct PersistentNode 
+{
+    uint64_t next; // 下一个节点的偏移，基址变化后仍然有效
+    int value;
+};
+
+void testPersistentHeap() 
+{
+    std::cout << "Running persistent heap test..." << std::endl;
+
+#ifdef _WIN32
+    std::string path = "MemoryPoolHeap" + std::to_string(GetCurrentProcessId()) + ".bin";
+#else
+    std::string path = "/tmp/MemoryPoolHeap" + std::to_string(getpid()) + ".bin";
+#endif
+    std::remove(path.c_str());
+    const size_t HEAP_BYTES = 16 * 1024 * 1024;
+    const int NODES = 5000;
+    size_t freePages = 0;
+    {
+        auto heap = SharedMemoryPool::openFile(path.c_str(), HEAP_BYTES);
+        assert(heap != nullptr && !heap->relocated());
+        assert(heap->getRoot() == nullptr);
+        // 同一时间只能有一个打开者
+        assert(SharedMemoryPool::openFile(path.c_str(), HEAP_BYTES) == nullptr);
+
+        uint64_t head = 0;
+        for (int i = 0; i < NODES; ++i) 
+        {
+            PersistentNode* node = static_cast<PersistentNode*>(heap->allocate(sizeof(PersistentNode)));
+            assert(node != nullptr);
+            node->next = head;
+            node->value = i;
+            head = heap->toOffset(node);
+        }
+        heap->setRoot(heap->fromOffset(head));
+        freePages = heap->freePageCount();
+    }
+
+    {
+        // 重启后直接映射，链表和空闲页都保持原样
+        auto heap = SharedMemoryPool::openFile(path.c_str(), 0);
+        assert(heap != nullptr);
+        assert(heap->freePageCount() == freePages);
+        PersistentNode* node = static_cast<PersistentNode*>(heap->getRoot());
+        int expected = NODES - 1;
+        while (node) 
+        {
+            assert(node->value == expected--);
+            PersistentNode* next = node->next ? static_cast<PersistentNode*>(heap->fromOffset(node->next)) : nullptr;
+            heap->deallocate(node);
+            node = next;
+        }
+        assert(expected == -1);
+        heap->setRoot(nullptr);
+        assert(heap->freePageCount() == heap->pageCount());
+    }
+
+#ifndef _WIN32
+    // 子进程打开后不关闭就退出，模拟崩溃
+    pid_t child = fork();
+    assert(child >= 0);
+    if (child == 0) 
+    {
+        auto heap = SharedMemoryPool::openFile(path.c_str(), 0);
+        _exit(heap != nullptr && heap->allocate(64) != nullptr ? 0 : 1);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(SharedMemoryPool::openFile(path.c_str(), 0) == nullptr);
+#endif
+
+    std::remove(path.c_str());
+
+    std::cout << "Persistent heap test passed!" << std::endl;
+}
+
+// 预留测试：预留之后分配同样数量的块不再向系统申请内存
+void testReserve() 
+{
+    std::cout << "Running reserve test..." << std::endl;
+
+    MemoryPool::releaseFreeMemory();
+
+    const size_t SIZE = 48;
+    const size_t COUNT = 10000;
+    assert(MemoryPool::reserve(SIZE, COUNT) >= COUNT);
+    assert(MemoryPool::prewarm({ {16, 1000}, {512, 200}, {200000, 3} }) >= 1203);
+    assert(MemoryPool::reserve(MAX_BYTES + 1, 10) == 0);
+    size_t reservedBytes = MemoryPool::getSystemBytes();
+
+    std::vector<void*> ptrs;
+    for (size_t i = 0; i < COUNT; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(SIZE));
+    }
+    for (size_t i = 0; i < 1000; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(16));
+    }
+    for (size_t i = 0; i < 200; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(512));
+    }
+    assert(MemoryPool::getSystemBytes() == reservedBytes);
+
+    for (size_t i = 0; i < COUNT; ++i) 
+    {
+        MemoryPool::deallocate(ptrs[i], SIZE);
+    }
+    for (size_t i = COUNT; i < COUNT + 1000; ++i) 
+    {
+        MemoryPool::deallocate(ptrs[i], 16);
+    }
+    for (size_t i = COUNT + 1000; i < ptrs.size(); ++i) 
+    {
+        MemoryPool::deallocate(ptrs[i], 512);
+    }
+    MemoryPool::releaseFreeMemory();
+
+    std::cout << "Reserve test passed!" << std::endl;
+}
+
+// 纪元回收测试：多线程无锁栈，读者在临界区内遍历，弹出的节点退休；读到的节点不能已被释放
+struct EpochNode 
+{
+    uint64_t magic; // 释放后第一个字会被自由链表覆盖
+    std::atomic<EpochNode*> next;
+};
+
+void testEpochReclamation() 
+{
+    std::cout << "Running epoch reclamation test..." << std::endl;
+
+    const uint64_t MAGIC = 0x5a5a5a5a5a5a5a5aull;
+    std::atomic<EpochNode*> head{nullptr};
+    std::atomic<bool> ok{true};
+    std::atomic<bool> stop{false};
+
+    auto push = [&head, MAGIC]() 
+    {
+        EpochNode* node = static_cast<EpochNode*>(MemoryPool::allocate(sizeof(EpochNode)));
+        node->magic = MAGIC;
+        EpochNode* old = head.load();
+        do 
+        {
+            node->next.store(old);
+        } while (!head.compare_exchange_weak(old, node));
+    };
+
+    std::vector<std::thread> threads;
+    // 读者：在临界区内遍历整个栈
+    for (int t = 0; t < 2; ++t) 
+    {
+        threads.emplace_back([&]() 
+        {
+            while (!stop.load()) 
+            {
+                MemoryPool::EpochGuard guard;
+                for (EpochNode* node = head.load(); node; node = node->next.load()) 
+                {
+                    if (node->magic != MAGIC) 
+                    {
+                        ok = false;
+                    }
+                }
+            }
+        });
+    }
+    // 写者：压入和弹出，弹出的节点退休
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; ++t) 
+    {
+        writers.emplace_back([&]() 
+        {
+            for (int i = 0; i < 20000; ++i) 
+            {
+                if (i % 2 == 0) 
+                {
+                    push();
+                    continue;
+                }
+                EpochNode* node;
+                {
+                    MemoryPool::EpochGuard guard;
+                    node = head.load();
+                    while (node && !head.compare_exchange_weak(node, node->next.load())) 
+                    {
+                    }
+                }
+                if (node) 
+                {
+                    MemoryPool::retire(node, sizeof(EpochNode));
+                }
+            }
+            MemoryPool::synchronizeRetired();
+        });
+    }
+    for (auto& writer : writers) 
+    {
+        writer.join();
+    }
+    stop = true;
+    for (auto& thread : threads) 
+    {
+        thread.join();
+    }
+    assert(ok);
+
+    EpochNode* node = head.exchange(nullptr);
+    while (node) 
+    {
+        EpochNode* next = node->next.load();
+        MemoryPool::deallocate(node, sizeof(EpochNode));
+        node = next;
+    }
+
+    // 有线程停在临界区中时，宽限期不会结束
+    std::atomic<bool> inside{false};
+    std::atomic<bool> leave{false};
+    std::atomic<bool> synchronized{false};
+    std::thread reader([&]() 
+    {
+        MemoryPool::EpochGuard guard;
+        inside = true;
+        while (!leave.load()) 
+        {
+            std::this_thread::yield();
+        }
+    });
+    while (!inside.load()) 
+    {
+        std::this_thread::yield();
+    }
+    void* block = MemoryPool::allocate(64);
+    std::thread reclaimer([&]() 
+    {
+        MemoryPool::synchronizeRetired();
+        synchronized = true;
+    });
+    MemoryPool::retire(block, 64);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(!synchronized.load());
+    leave = true;
+    reader.join();
+    reclaimer.join();
+    assert(synchronized.load());
+    MemoryPool::synchronizeRetired();
+
+    std::cout << "Epoch reclamation test passed!" << std::endl;
+}
+
+// 运行时参数测试：按名字读写、解析配置串，修改线程缓存上限后立即影响归还行为
+void testTuning() 
+{
+    std::cout << "Running tuning test..." << std::endl;
+
+    assert(!MemoryPool::getTuningNames().empty());
+    // 初值可能来自环境变量MEMORYPOOL_CONF，结束时恢复
+    size_t maxBlocks = 0, keepPercent = 0, advanceInterval = 0;
+    assert(MemoryPool::getTuning("thread_cache.max_blocks", maxBlocks));
+    assert(MemoryPool::getTuning("thread_cache.keep_percent", keepPercent));
+    assert(MemoryPool::getTuning("epoch.advance_interval", advanceInterval));
+    size_t value = 0;
+    assert(!MemoryPool::getTuning("no.such_param", value));
+    assert(!MemoryPool::setTuning("no.such_param", 1));
+    assert(!MemoryPool::setTuning("thread_cache.keep_percent", 101));
+
+    assert(applyTuningString("thread_cache.keep_percent=50,epoch.advance_interval=0x80"));
+    assert(MemoryPool::getTuning("thread_cache.keep_percent", value) && value == 50);
+    assert(MemoryPool::getTuning("epoch.advance_interval", value) && value == 128);
+    assert(!applyTuningString("thread_cache.keep_percent=abc,bogus"));
+    assert(MemoryPool::getTuning("thread_cache.keep_percent", value) && value == 50);
+
+    // 线程缓存上限调到8后，释放的块大部分回到中心缓存
+    MemoryPool::releaseFreeMemory();
+    assert(MemoryPool::setTuning("thread_cache.max_blocks", 8));
+    assert(MemoryPool::setTuning("thread_cache.keep_percent", 0));
+    const size_t SIZE = 4000; // 每个span只有几十块，便于观察
+    std::vector<void*> ptrs;
+    for (int i = 0; i < 40; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(SIZE));
+    }
+    for (void* ptr : ptrs) 
+    {
+        MemoryPool::deallocate(ptr, SIZE);
+    }
+    void* probe = MemoryPool::allocate(SIZE);
+    SpanTracker* span = CentralCache::getInstance().getSpanTracker(probe);
+    assert(span != nullptr && span->useCount <= 9);
+    MemoryPool::deallocate(probe, SIZE);
+
+    // keep_percent=100时溢出归还不出块，只释放的线程缓存仍然受额度限制
+    assert(MemoryPool::setTuning("thread_cache.keep_percent", 100));
+    ptrs.clear();
+    for (int i = 0; i < 100000; ++i) 
+    {
+        ptrs.push_back(MemoryPool::allocate(64));
+    }
+    std::thread consumer([&ptrs]() 
+    {
+        ThreadCache* cache = ThreadCache::getInstance();
+        for (void* ptr : ptrs) 
+        {
+            MemoryPool::deallocate(ptr, 64);
+            assert(cache->getCachedBytes() <= cache->getMaxCachedBytes());
+        }
+    });
+    consumer.join();
+
+    assert(MemoryPool::setTuning("thread_cache.max_blocks", maxBlocks));
+    assert(MemoryPool::setTuning("thread_cache.keep_percent", keepPercent));
+    assert(MemoryPool::setTuning("epoch.advance_interval", advanceInterval));
+    MemoryPool::releaseFreeMemory();
+
+    std::cout << "Tuning test passed!" << std::endl;
+}
+
+// 线程缓存额度测试：忙线程的额度变大，总额度用完后从空闲线程偷，被偷的线程之后缩小缓存
+void testThreadCacheBudget() 
+{
+    std::cout << "Running thread cache budget test..." << std::endl;
+
+    size_t totalBytes = 0;
+    assert(MemoryPool::getTuning("thread_cache.total_bytes", totalBytes));
+
+    // 各取40块8KB~16KB的块再全部释放，缓存远超最低额度
+    auto churn = []() 
+    {
+        std::vector<std::pair<void*, size_t>> ptrs;
+        for (size_t size = 8 * 1024; size <= 16 * 1024; size += 512) 
+        {
+            for (int i = 0; i < 40; ++i) 
+            {
+                ptrs.push_back({MemoryPool::allocate(size), size});
+            }
+        }
+        for (auto& ptr : ptrs) 
+        {
+            MemoryPool::deallocate(ptr.first, ptr.second);
+        }
+        ThreadCache* cache = ThreadCache::getInstance();
+        assert(cache->getCachedBytes() <= cache->getMaxCachedBytes());
+    };
+
+    std::atomic<int> stage{0};
+    ThreadCache* idleCache = nullptr;
+    size_t idleMax = 0;
+    size_t idleCached = 0;
+    std::thread idle([&]() 
+    {
+        idleCache = ThreadCache::getInstance();
+        assert(idleCache->getMaxCachedBytes() == THREAD_CACHE_MIN_BYTES);
+        churn();
+        idleMax = idleCache->getMaxCachedBytes();
+        idleCached = idleCache->getCachedBytes();
+        assert(idleMax > THREAD_CACHE_MIN_BYTES);
+        stage = 1;
+        while (stage.load() != 2) 
+        {
+            std::this_thread::yield();
+        }
+        // 额度被偷走后，下次走慢路径时把缓存缩回额度以内
+        void* ptr = MemoryPool::allocate(100 * 1024);
+        MemoryPool::deallocate(ptr, 100 * 1024);
+        assert(idleCache->getCachedBytes() <= idleCache->getMaxCachedBytes());
+    });
+    while (stage.load() != 1) 
+    {
+        std::this_thread::yield();
+    }
+
+    // 总额度调到最低，新线程只能从空闲线程偷
+    assert(MemoryPool::setTuning("thread_cache.total_bytes", THREAD_CACHE_MIN_BYTES));
+    std::thread busy([&]() 
+    {
+        churn();
+        assert(ThreadCache::getInstance()->getMaxCachedBytes() > THREAD_CACHE_MIN_BYTES);
+    });
+    busy.join();
+    assert(idleCache->getMaxCachedBytes() < idleMax);
+
+    // 空闲线程一直没有操作，回收线程定期替它把缓存缩回额度以内
+    assert(idleCached > idleCache->getMaxCachedBytes());
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (idleCache->getCachedBytes() > idleCache->getMaxCachedBytes()
+        && std::chrono::steady_clock::now() < deadline) 
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(idleCache->getCachedBytes() <= idleCache->getMaxCachedBytes());
+
+    stage = 2;
+    idle.join();
+    assert(MemoryPool::setTuning("thread_cache.total_bytes", totalBytes));
+
+    std::cout << "Thread cache budget test passed!" << std::endl;
+}
+
+// 分配提示测试：冷块和热块不在同一个span中，冷块按提示或按普通路径释放都正确
+void testAllocHints() 
+{
+    std::cout << "Running alloc hints test..." << std::endl;
+
+    const size_t SIZE = 64;
+    const size_t COUNT = 2000;
+    std::vector<void*> hot, cold, longLived;
+    for (size_t i = 0; i < COUNT; ++i) 
+    {
+        hot.push_back(MemoryPool::allocate(SIZE));
+        cold.push_back(MemoryPool::allocate(SIZE, AllocHint::Cold));
+        longLived.push_back(MemoryPool::allocate(SIZE, AllocHint::LongLived));
+        assert(hot.back() && cold.back() && longLived.back());
+        memset(cold.back(), 0x5A, SIZE);
+    }
+
+    std::set<SpanTracker*> hotSpans;
+    for (void* ptr : hot) 
+    {
+        SpanTracker* span = CentralCache::getInstance().getSpanTracker(ptr);
+        assert(span && !span->cold);
+        hotSpans.insert(span);
+    }
+    for (size_t i = 0; i < COUNT; ++i) 
+    {
+        SpanTracker* span = CentralCache::getInstance().getSpanTracker(cold[i]);
+        assert(span && span->cold && hotSpans.count(span) == 0);
+        span = CentralCache::getInstance().getSpanTracker(longLived[i]);
+        assert(span && span->cold && hotSpans.count(span) == 0);
+    }
+
+    // 大块和Hot提示照常走线程缓存
+    void* large = MemoryPool::allocate(MAX_BYTES + 1, AllocHint::Cold);
+    assert(large);
+    MemoryPool::deallocate(large, MAX_BYTES + 1, AllocHint::Cold);
+
+    for (size_t i = 0; i < COUNT; ++i) 
+    {
+        MemoryPool::deallocate(hot[i], SIZE);
+        MemoryPool::deallocate(cold[i], SIZE, AllocHint::Cold);
+        // 不带提示释放冷块也必须正确
+        MemoryPool::deallocate(longLived[i], SIZE);
+    }
+    MemoryPool::releaseFreeMemory();
+
+    std::cout << "Alloc hints test passed!" << std::endl;
+}
+
+// 私有堆测试：多线程分配释放，destroy()一次性归还所有span，堆可以继续使用
+void testPrivateHeap() 
+{
+    std::cout << "Running private heap test..." << std::endl;
+
+    MemoryPool::releaseFreeMemory();
+    size_t baseBytes = MemoryPool::getSystemBytes();
+
+    {
+        MemoryPool::Heap heap;
+
+        // 分配后释放一半，span中的块全部归还后span立即还回
+        std::vector<std::pair<void*, size_t>> blocks;
+        for (size_t i = 0; i < 5000; ++i) 
+        {
+            size_t size = 8 + (i % 64) * 24;
+            void* ptr = heap.allocate(size);
+            assert(ptr && heap.contains(ptr));
+            memset(ptr, static_cast<int>(i & 0xFF), size);
+            blocks.push_back({ptr, size});
+        }
+        void* large = heap.allocate(MAX_BYTES * 2);
+        assert(large && heap.contains(large));
+        memset(large, 0x7E, MAX_BYTES * 2);
+        heap.deallocate(large, MAX_BYTES * 2);
+        assert(!heap.contains(large));
+
+        for (size_t i = 0; i < blocks.size(); i += 2) 
+        {
+            heap.deallocate(blocks[i].first, blocks[i].second);
+        }
+        for (size_t i = 1; i < blocks.size(); i += 2) 
+        {
+            assert(*static_cast<unsigned char*>(blocks[i].first) == (i & 0xFF));
+        }
+
+        // 主内存池的块不属于堆
+        void* poolBlock = MemoryPool::allocate(64);
+        assert(!heap.contains(poolBlock));
+        MemoryPool::deallocate(poolBlock, 64);
+
+        // 多个线程共用一个堆，剩下的块不释放，交给destroy()
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) 
+        {
+            threads.emplace_back([&heap, t]()
+            {
+                std::vector<void*> ptrs;
+                for (size_t i = 0; i < 2000; ++i) 
+                {
+                    ptrs.push_back(heap.allocate(32 + t * 8));
+                    assert(ptrs.back());
+                    if (i % 3 == 0) 
+                    {
+                        heap.deallocate(ptrs.back(), 32 + t * 8);
+                        ptrs.pop_back();
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) 
+        {
+            thread.join();
+        }
+        assert(heap.spanCount() > 0 && heap.capacity() >= heap.spanCount() * PAGE_SIZE);
+
+        heap.destroy();
+        assert(heap.spanCount() == 0 && heap.capacity() == 0);
+        assert(!heap.contains(blocks[1].first));
+
+        // 销毁后继续使用，析构时再次整体释放
+        for (size_t i = 0; i < 100; ++i) 
+        {
+            assert(heap.allocate(128));
+        }
+    }
+
+    // 堆的span都还给了PageCache，释放空闲内存后系统内存回到原样
+    MemoryPool::releaseFreeMemory();
+    assert(MemoryPool::getSystemBytes() == baseBytes);
+
+    std::cout << "Private heap test passed!" << std::endl;
+}
+
+// 页来源测试：私有堆建在固定内存和大页文件上，内存用完时分配失败，析构后全部还给页来源
+// 统计PageCache调用各接口次数的页来源，canDecommit为false时模拟不支持丢弃物理页
+class CountingPageProvider : public MmapPageProvider
+{
+public:
+    explicit CountingPageProvider(bool canDecommit) : m_canDecommit(canDecommit) {}
+
+    void* allocate(size_t numPages) override 
+    {
+        ++allocateCalls;
+        return MmapPageProvider::allocate(numPages);
+    }
+    void release(void* ptr, size_t numPages) override 
+    {
+        ++releaseCalls;
+        MmapPageProvider::release(ptr, numPages);
+    }
+    bool commit(void* ptr, size_t numPages) override 
+    {
+        ++commitCalls;
+        return MmapPageProvider::commit(ptr, numPages);
+    }
+    bool decommit(void* ptr, size_t numPages) override 
+    {
+        ++decommitCalls;
+        return m_canDecommit && MmapPageProvider::decommit(ptr, numPages);
+    }
+
+    int allocateCalls = 0;
+    int releaseCalls = 0;
+    int commitCalls = 0;
+    int decommitCalls = 0;
+
+private:
+    bool m_canDecommit;
+};
+
+void testPageProviders() 
+{
+    std::cout << "Running page providers test..." << std::endl;
+
+    // 固定内存：分配不会超出缓冲区
+    std::vector<char> buffer(4 * 1024 * 1024);
+    StaticBufferPageProvider staticProvider(buffer.data(), buffer.size());
+    assert(staticProvider.valid());
+    size_t totalPages = staticProvider.pageCount();
+    {
+        MemoryPool::Heap heap(staticProvider);
+        std::vector<void*> ptrs;
+        while (void* ptr = heap.allocate(1024)) 
+        {
+            assert(ptr >= buffer.data() && ptr < buffer.data() + buffer.size());
+            memset(ptr, 0x3C, 1024);
+            ptrs.push_back(ptr);
+        }
+        assert(!ptrs.empty() && ptrs.size() * 1024 <= buffer.size());
+        assert(staticProvider.freePageCount() < totalPages);
+
+        // 释放后内存可以再次分配给其他大小类
+        for (void* ptr : ptrs) 
+        {
+            heap.deallocate(ptr, 1024);
+        }
+        void* large = heap.allocate(MAX_BYTES * 4);
+        assert(large && large >= buffer.data() && large < buffer.data() + buffer.size());
+    }
+    assert(staticProvider.freePageCount() == totalPages);
+
+    // 锁定的固定内存，锁定受资源限制时跳过
+    std::vector<char> pinnedBuffer(256 * 1024);
+    StaticBufferPageProvider pinnedProvider(pinnedBuffer.data(), pinnedBuffer.size(), true);
+    if (pinnedProvider.valid()) 
+    {
+        MemoryPool::Heap heap(pinnedProvider);
+        void* ptr = heap.allocate(4096);
+        assert(ptr);
+        heap.deallocate(ptr, 4096);
+    }
+
+#ifdef __linux__
+    // 大页文件：没有挂载hugetlbfs时用普通文件，打洞同样归还文件页
+    std::string path = "/tmp/MemoryPoolTestHuge" + std::to_string(getpid());
+    {
+        HugePageFileProvider hugeProvider(path.c_str(), 8 * 1024 * 1024);
+        assert(hugeProvider.valid() && hugeProvider.hugePageSize() >= PAGE_SIZE);
+        assert(access(path.c_str(), F_OK) != 0);
+
+        MemoryPool::Heap heap(hugeProvider);
+        std::vector<void*> ptrs;
+        for (size_t i = 0; i < 1000; ++i) 
+        {
+            ptrs.push_back(heap.allocate(2048));
+            assert(ptrs.back());
+            memset(ptrs.back(), static_cast<int>(i & 0xFF), 2048);
+        }
+        for (size_t i = 0; i < ptrs.size(); ++i) 
+        {
+            assert(*static_cast<unsigned char*>(ptrs[i]) == (i & 0xFF));
+            heap.deallocate(ptrs[i], 2048);
+        }
+        heap.destroy();
+    }
+#endif
+
+    // 默认的匿名映射来源
+    MmapPageProvider mmapProvider;
+    void* pages = mmapProvider.allocate(4);
+    assert(pages && reinterpret_cast<uintptr_t>(pages) % PAGE_SIZE == 0);
+    assert(mmapProvider.commit(pages, 4));
+    memset(pages, 1, 4 * PAGE_SIZE);
+    mmapProvider.decommit(pages, 4);
+    mmapProvider.release(pages, 4);
+#ifdef _WIN32
+    // 部分归还的地址在下次分配时重新提交，不占用新的地址空间
+    char* reserved = static_cast<char*>(mmapProvider.allocate(8));
+    assert(reserved);
+    mmapProvider.release(reserved + 2 * PAGE_SIZE, 4);
+    void* recommitted = mmapProvider.allocate(4);
+    assert(recommitted == reserved + 2 * PAGE_SIZE);
+    memset(recommitted, 2, 4 * PAGE_SIZE);
+    mmapProvider.release(reserved, 8);
+#endif
+
+    // 内存紧张时空闲span只丢弃物理页，地址范围留着再分配；页来源不支持丢弃时才归还给它
+    for (bool canDecommit : {true, false}) 
+    {
+        CountingPageProvider provider(canDecommit);
+        PageCache* pageCache = new PageCache(provider);
+        const size_t PAGES = SMALL_SPAN_MAX_PAGES + 1; // 不经过分片
+        void* first = pageCache->allocateSpan(PAGES);
+        void* second = pageCache->allocateSpan(PAGES);
+        assert(first && second);
+        pageCache->deallocateSpan(second, PAGES);
+
+        // 申请新内存时超过软上限，缓存的second被处理
+        pageCache->setMemoryLimit(2 * PAGES * PAGE_SIZE, 0);
+        void* large = pageCache->allocateSpan(2 * PAGES);
+        assert(large);
+        assert(provider.decommitCalls == 1);
+        assert(provider.releaseCalls == (canDecommit ? 0 : 1));
+        assert(pageCache->getSystemBytes() == 3 * PAGES * PAGE_SIZE);
+
+        // 丢弃过物理页的范围重新提交后分配出去，不向页来源申请
+        int allocateCalls = provider.allocateCalls;
+        void* again = pageCache->allocateSpan(PAGES);
+        assert(again);
+        memset(again, 0x6B, PAGES * PAGE_SIZE);
+        if (canDecommit) 
+        {
+            assert(again == second);
+            assert(provider.allocateCalls == allocateCalls && provider.commitCalls == 1);
+        }
+        else 
+        {
+            assert(provider.allocateCalls == allocateCalls + 1 && provider.commitCalls == 0);
+        }
+
+        // 超过软上限后释放的span同样处理
+        pageCache->deallocateSpan(first, PAGES);
+        assert(provider.decommitCalls == 2);
+        assert(provider.releaseCalls == (canDecommit ? 0 : 2));
+
+        pageCache->setMemoryLimit(0, 0);
+        pageCache->deallocateSpan(again, PAGES);
+        pageCache->deallocateSpan(large, 2 * PAGES);
+        pageCache->releaseFreeSpans();
+        assert(pageCache->getSystemBytes() == 0);
+        delete pageCache;
+    }
+
+    std::cout << "Page providers test passed!" << std::endl;
+}
+
+// 异步释放测试：开启后溢出的块交给回收线程，回收线程归还后块可以再次分配
+void testOffloadFree() 
+{
+    std::cout << "Running offload free test..." << std::endl;
+
+    const size_t SIZE = 96;
+    const size_t COUNT = 5000;
+
+    std::thread worker([&]()
+    {
+        MemoryPool::setOffloadFree(true);
+        assert(ThreadCache::getInstance()->getOffloadFree());
+
+        for (int round = 0; round < 10; ++round) 
+        {
+            std::vector<void*> ptrs;
+            for (size_t i = 0; i < COUNT; ++i) 
+            {
+                void* ptr = MemoryPool::allocate(SIZE);
+                assert(ptr);
+                memset(ptr, round, SIZE);
+                ptrs.push_back(ptr);
+            }
+            for (void* ptr : ptrs) 
+            {
+                assert(*static_cast<unsigned char*>(ptr) == round);
+                MemoryPool::deallocate(ptr, SIZE);
+            }
+        }
+
+        // 线程缓存只留下阈值以内的块，其余都交了出去
+        size_t maxBlocks = g_tuning.threadCacheMaxBlocks.load();
+        assert(ThreadCache::getInstance()->getCachedBytes() <= (maxBlocks + 1) * SIZE);
+        MemoryPool::setOffloadFree(false);
+    });
+    worker.join();
+
+    // 回收线程按间隔轮询，等它把积压的块全部归还
+    for (int i = 0; i < 1000 && MemoryPool::getOffloadBacklog() > 0; ++i) 
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(MemoryPool::getOffloadBacklog() == 0);
+
+    std::cout << "Offload free test passed!" << std::endl;
+}
+
+// 大对象测试：256KB到4MB的分配按大小类取整，释放后进CPU缓存，再次分配同一大小类直接复用
+void testLargeObjects() 
+{
+    std::cout << "Running large objects test..." << std::endl;
+
+    // 按默认的缓存上限测试，不受MEMORYPOOL_CONF影响
+    size_t cpuBytes = 0;
+    assert(MemoryPool::getTuning("large_cache.cpu_bytes", cpuBytes));
+    assert(MemoryPool::setTuning("large_cache.cpu_bytes", LARGE_CACHE_CPU_BYTES));
+
+    MemoryPool::releaseFreeMemory();
+    assert(LargeObjectCache::getInstance().getCachedBytes() == 0);
+
+    // 大小类都是整页，512KB和1MB正好一个大小类
+    for (size_t size = MAX_BYTES + 1; size <= LARGE_MAX_BYTES; size += 37 * 1024) 
+    {
+        size_t bytes = LargeSizeClass::getBytes(LargeSizeClass::getIndex(size));
+        assert(bytes >= size && bytes % PAGE_SIZE == 0 && bytes - size < bytes / 4);
+    }
+
+    // 分配的内存按页对齐，可以完整写入
+    std::vector<std::pair<void*, size_t>> blocks;
+    for (size_t size : {MAX_BYTES + 1, size_t(512 * 1024), size_t(1024 * 1024), size_t(3 * 1024 * 1024), LARGE_MAX_BYTES}) 
+    {
+        void* ptr = MemoryPool::allocate(size);
+        assert(ptr && reinterpret_cast<uintptr_t>(ptr) % PAGE_SIZE == 0);
+        memset(ptr, 0x6B, size);
+        blocks.push_back({ptr, size});
+    }
+    size_t systemBytes = MemoryPool::getSystemBytes();
+    for (auto& block : blocks) 
+    {
+        MemoryPool::deallocate(block.first, block.second);
+    }
+    assert(LargeObjectCache::getInstance().getCachedBytes() > 0);
+
+    // 热循环反复分配释放同样大小的缓冲区，基本不再向系统申请（线程换CPU时可能各缓存一个）
+    for (int i = 0; i < 1000; ++i) 
+    {
+        void* ptr = MemoryPool::allocate(512 * 1024);
+        assert(ptr);
+        static_cast<char*>(ptr)[i] = 1;
+        MemoryPool::deallocate(ptr, 512 * 1024);
+    }
+    assert(MemoryPool::getSystemBytes() <= systemBytes + LARGE_CACHE_CPU_NUM * 512 * 1024);
+
+    // 超过LARGE_MAX_BYTES的仍然用malloc
+    void* huge = MemoryPool::allocate(LARGE_MAX_BYTES + 1);
+    assert(huge);
+    MemoryPool::deallocate(huge, LARGE_MAX_BYTES + 1);
+
+    // 多线程同时使用各CPU缓存
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) 
+    {
+        threads.emplace_back([t]()
+        {
+            size_t size = (size_t(300) + t * 200) * 1024;
+            for (int i = 0; i < 500; ++i) 
+            {
+                void* ptr = MemoryPool::allocate(size);
+                assert(ptr);
+                memset(ptr, t, PAGE_SIZE);
+                MemoryPool::deallocate(ptr, size);
+            }
+        });
+    }
+    for (auto& thread : threads) 
+    {
+        thread.join();
+    }
+
+    // 缓存的span随释放空闲内存一起归还
+    MemoryPool::releaseFreeMemory();
+    assert(LargeObjectCache::getInstance().getCachedBytes() == 0);
+
+    // 接近软上限时大对象缓存也要归还
+    std::vector<void*> buffers;
+    for (int i = 0; i < 4; ++i) 
+    {
+        buffers.push_back(MemoryPool::allocate(1024 * 1024));
+        assert(buffers.back());
+    }
+    for (void* ptr : buffers) 
+    {
+        MemoryPool::deallocate(ptr, 1024 * 1024);
+    }
+    size_t cachedBytes = LargeObjectCache::getInstance().getCachedBytes();
+    assert(cachedBytes > 0);
+
+    // 全局空闲span先清空，下面的分配一定要向系统申请，从而触发软上限
+    PageCache::getInstance().releaseFreeSpans();
+    systemBytes = MemoryPool::getSystemBytes();
+    MemoryPool::setMemoryLimit(1, 0);
+    const size_t missSize = 3 * 1024 * 1024;
+    void* ptr = MemoryPool::allocate(missSize);
+    assert(ptr);
+    assert(LargeObjectCache::getInstance().getCachedBytes() == 0);
+    assert(MemoryPool::getSystemBytes() <= systemBytes - cachedBytes + missSize);
+
+    // 超过软上限时释放的大块不再进缓存
+    MemoryPool::deallocate(ptr, missSize);
+    assert(LargeObjectCache::getInstance().getCachedBytes() == 0);
+    MemoryPool::setMemoryLimit(0, 0);
+    assert(MemoryPool::setTuning("large_cache.cpu_bytes", cpuBytes));
+
+    std::cout << "Large objects test passed!" << std::endl;
+}
+
+// 中心缓存锁测试：自旋锁互斥正确，竞争统计前后一致
+void testCentralLock() 
+{
+    std::cout << "Running central lock test..." << std::endl;
+
+    // 锁内做较多工作，让等待者进入睡眠路径
+    SpinLock lock;
+    long counter = 0;
+    const int NUM_THREADS = 8;
+    const int INCREMENTS = 20000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < NUM_THREADS; ++t) 
+    {
+        threads.emplace_back([&]() 
+        {
+            for (int i = 0; i < INCREMENTS; ++i) 
+            {
+                lock.lock();
+                long value = counter;
+                if (i % 1000 == 0) 
+                {
+                    std::this_thread::yield();
+                }
+                counter = value + 1;
+                lock.unlock();
+            }
+        });
+    }
+    for (auto& thread : threads) 
+    {
+        thread.join();
+    }
+    assert(counter == static_cast<long>(NUM_THREADS) * INCREMENTS);
+
+    // 多个线程争同一个大小类
+    MemoryPool::resetCentralLockStats();
+    threads.clear();
+    for (int t = 0; t < NUM_THREADS; ++t) 
+    {
+        threads.emplace_back([]() 
+        {
+            std::vector<void*> ptrs;
+            for (int round = 0; round < 50; ++round) 
+            {
+                for (int i = 0; i < 200; ++i) 
+                {
+                    ptrs.push_back(MemoryPool::allocate(48));
+                }
+                for (void* ptr : ptrs) 
+                {
+                    MemoryPool::deallocate(ptr, 48);
+                }
+                ptrs.clear();
+            }
+        });
+    }
+    for (auto& thread : threads) 
+    {
+        thread.join();
+    }
+
+    std::vector<CentralLockStats> stats = MemoryPool::getCentralLockStats();
+    for (size_t i = 0; i < stats.size(); ++i) 
+    {
+        assert(stats[i].contendedCount > 0);
+        assert(stats[i].contendedCount <= stats[i].lockCount);
+        assert(i == 0 || stats[i - 1].waitNs >= stats[i].waitNs);
+    }
+
+    std::cout << "Central lock test passed!" << std::endl;
+}
+
 // 边界测试
 void testEdgeCases() 
 {
@@ -203,6 +1801,28 @@ int main()
         testBasicAllocation();
         testMemoryWriting();
         testMultiThreading();
+        testCrossThreadFree();
+        testArena();
+        testBatchAllocation();
+        testMemoryLimit();
+        testLatencyStats();
+        testCentralLock();
+        testTrace();
+        testObjectPool();
+        testSpanSizing();
+        testPageShards();
+        testSpanBitmap();
+        testSharedMemoryPool();
+        testPersistentHeap();
+        testReserve();
+        testEpochReclamation();
+        testTuning();
+        testThreadCacheBudget();
+        testAllocHints();
+        testPrivateHeap();
+        testPageProviders();
+        testOffloadFree();
+        testLargeObjects();
         testEdgeCases();
         testStress();
 